@@ -1,257 +1,415 @@
 #include "ft_list.h"
 #include "error_codes.h"
-#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
-int ft_list_add_last(void** _head, void* _node)
+int ft_list_init(ft_list_t* list, size_t elem_size)
 {
-    list_item_t** head = (list_item_t**)_head;
-    list_item_t* node = (list_item_t*)_node;
-    list_item_t* last;
-
-    if (!head || !node) return (INVALID_ARGS);
-
-    if (!*head)
+    if (!list || elem_size == 0)
     {
-        *head = node;
-        node->next = node;
-        node->prev = node;
-        return (OK);
+        return (INVALID_ARGS);
     }
 
-    last = (*head)->prev;
-    last->next = node;
-    node->prev = last;
-    node->next = *head;
-    (*head)->prev = node;
-    
+    memset(list, 0, sizeof(*list));
+    list->elem_size = elem_size;
+    list->per_chunk = FT_LIST_CHUNK_BYTES / elem_size;
+    if (list->per_chunk < 4)
+    {
+        list->per_chunk = 4;
+    }
     return (OK);
 }
 
-int ft_list_add_first(void** _head, void* _node)
+void ft_list_destroy(ft_list_t* list)
 {
-    list_item_t** head = (list_item_t**)_head;
-    list_item_t* node = (list_item_t*)_node;
-    list_item_t* first;
+    ft_list_chunk_t* chunk;
+    ft_list_chunk_t* next;
 
-    if (!head || !node)
+    if (!list)
     {
-        return (INVALID_ARGS);
+        return;
     }
 
-    if (!*head)
+    for (chunk = list->first; chunk; chunk = next)
     {
-        (*head)->next = node;
-        (*head)->prev = node;
-        return (OK);
+        next = chunk->next;
+        free(chunk);
     }
+    free(list->spare);
+    list->first = NULL;
+    list->last = NULL;
+    list->spare = NULL;
+    list->size = 0;
+}
 
-    first = *head;
-    while (first->prev != *head)
+static ft_list_chunk_t* chunk_get(ft_list_t* list)
+{
+    ft_list_chunk_t* chunk = list->spare;
+
+    if (chunk)
     {
-        first = first->prev;
+        list->spare = NULL;
+    }
+    else
+    {
+        chunk = malloc(sizeof(ft_list_chunk_t) + list->per_chunk * list->elem_size);
+        if (!chunk)
+        {
+            return (NULL);
+        }
     }
+    chunk->next = NULL;
+    chunk->prev = NULL;
+    return (chunk);
+}
 
-    first->prev = node;
-    node->next = first;
-    
-    return (OK);
+static void chunk_put(ft_list_t* list, ft_list_chunk_t* chunk)
+{
+    if (!list->spare)
+    {
+        list->spare = chunk;
+    }
+    else
+    {
+        free(chunk);
+    }
 }
 
-void* ft_list_get_next(void** _head, void* _node)
+void* ft_list_add_last_slot(ft_list_t* list)
 {
-    list_item_t** head = (list_item_t**)_head;
-    list_item_t* node = (list_item_t*)_node;
+    ft_list_chunk_t* chunk;
 
-    if (!head || !node)
+    if (!list || list->elem_size == 0)
     {
         return (NULL);
     }
 
-    if (!*head)
+    if (!list->last)
     {
-        return (NULL);
+        if (!(chunk = chunk_get(list)))
+        {
+            return (NULL);
+        }
+        list->first = chunk;
+        list->last = chunk;
+        list->head = 0;
+        list->tail = 0;
     }
-
-    if (node->next == *head)
+    else if (list->tail == list->per_chunk)
     {
-        return (NULL);
+        if (!(chunk = chunk_get(list)))
+        {
+            return (NULL);
+        }
+        chunk->prev = list->last;
+        list->last->next = chunk;
+        list->last = chunk;
+        list->tail = 0;
     }
 
-    return (node->next);
+    list->size++;
+    return (list->last->data + list->tail++ * list->elem_size);
 }
 
-void* ft_list_get_prev(void** _head, void* _node)
+void* ft_list_add_first_slot(ft_list_t* list)
 {
-    list_item_t** head = (list_item_t**)_head;
-    list_item_t* node = (list_item_t*)_node;
+    ft_list_chunk_t* chunk;
 
-    if (!head || !node)
+    if (!list || list->elem_size == 0)
     {
         return (NULL);
     }
 
-    if (!*head)
+    if (!list->first)
     {
-        return (NULL);
+        if (!(chunk = chunk_get(list)))
+        {
+            return (NULL);
+        }
+        list->first = chunk;
+        list->last = chunk;
+        list->head = list->per_chunk;
+        list->tail = list->per_chunk;
     }
-
-    if (node->prev == *head)
+    else if (list->head == 0)
     {
-        return (NULL);
+        if (!(chunk = chunk_get(list)))
+        {
+            return (NULL);
+        }
+        chunk->next = list->first;
+        list->first->prev = chunk;
+        list->first = chunk;
+        list->head = list->per_chunk;
     }
 
-    return (node->prev);
+    list->size++;
+    return (list->first->data + --list->head * list->elem_size);
 }
 
-int ft_list_pop(void** _head, void* _node)
+int ft_list_add_last(ft_list_t* list, const void* elem)
 {
-    list_item_t** head = (list_item_t**)_head;
-    list_item_t* node = (list_item_t*)_node;
-    list_item_t* prev;
-    list_item_t* next;
+    void* slot;
 
-    if (!head || !node || !*head)
+    if (!elem)
     {
         return (INVALID_ARGS);
     }
+    if (!(slot = ft_list_add_last_slot(list)))
+    {
+        return (list && list->elem_size ? FAILURE : INVALID_ARGS);
+    }
+    memcpy(slot, elem, list->elem_size);
+    return (OK);
+}
 
-    prev = node->prev;
-    next = node->next;
+int ft_list_add_first(ft_list_t* list, const void* elem)
+{
+    void* slot;
 
-    if (node == node->next && node == node->prev)
+    if (!elem)
     {
-        *head = NULL;
+        return (INVALID_ARGS);
     }
-    else
+    if (!(slot = ft_list_add_first_slot(list)))
     {
-        prev->next = next;
-        next->prev = prev;
-
-        if (*head == node)
-        {
-            *head = next;
-        }
+        return (list && list->elem_size ? FAILURE : INVALID_ARGS);
     }
-
-    node->next = NULL;
-    node->prev = NULL;
-
+    memcpy(slot, elem, list->elem_size);
     return (OK);
 }
 
-int ft_list_pop_first(void** _head)
+/* The last element went away: keep one chunk as the spare. */
+static void list_emptied(ft_list_t* list)
 {
-    return (ft_list_pop(_head, ft_list_get_first(_head)));
+    chunk_put(list, list->first);
+    list->first = NULL;
+    list->last = NULL;
 }
 
-int ft_list_pop_last(void** _head)
+int ft_list_pop_first(ft_list_t* list, void* out)
 {
-    return (ft_list_pop(_head, ft_list_get_last(_head)));
+    ft_list_chunk_t* chunk;
+
+    if (!list || list->size == 0)
+    {
+        return (FAILURE);
+    }
+
+    if (out)
+    {
+        memcpy(out, list->first->data + list->head * list->elem_size, list->elem_size);
+    }
+    list->head++;
+    list->size--;
+
+    if (list->size == 0)
+    {
+        list_emptied(list);
+    }
+    else if (list->head == list->per_chunk)
+    {
+        chunk = list->first;
+        list->first = chunk->next;
+        list->first->prev = NULL;
+        list->head = 0;
+        chunk_put(list, chunk);
+    }
+    return (OK);
 }
 
-int ft_list_get_size(void** _head)
+int ft_list_pop_last(ft_list_t* list, void* out)
 {
-    list_item_t** head = (list_item_t**)_head;
-    list_item_t* current;
-    int size;
+    ft_list_chunk_t* chunk;
 
-    if (!head)
+    if (!list || list->size == 0)
     {
-        return (0);
+        return (FAILURE);
     }
 
-    if (!*head)
+    list->tail--;
+    list->size--;
+    if (out)
     {
-        return (0);
+        memcpy(out, list->last->data + list->tail * list->elem_size, list->elem_size);
     }
 
-    current = *head;
-    size = 0;
-    do
+    if (list->size == 0)
     {
-        size++;
-        current = current->next;
-    } while (current != *head);
-
-    return (size);
+        list_emptied(list);
+    }
+    else if (list->tail == 0)
+    {
+        chunk = list->last;
+        list->last = chunk->prev;
+        list->last->next = NULL;
+        list->tail = list->per_chunk;
+        chunk_put(list, chunk);
+    }
+    return (OK);
 }
 
-void* ft_list_get_first(void** _head)
+void* ft_list_get_first(const ft_list_t* list)
 {
-    list_item_t** head = (list_item_t**)_head;
-    list_item_t* first;
-
-    if (!head)
+    if (!list || list->size == 0)
     {
         return (NULL);
     }
+    return (list->first->data + list->head * list->elem_size);
+}
 
-    if (!*head)
+void* ft_list_get_last(const ft_list_t* list)
+{
+    if (!list || list->size == 0)
     {
         return (NULL);
     }
+    return (list->last->data + (list->tail - 1) * list->elem_size);
+}
 
-    first = *head;
-    while (first->prev != *head)
+void ft_list_foreach(const ft_list_t* list, void (*f)(void* elem, void* arg), void* arg)
+{
+    ft_list_chunk_t* chunk;
+    size_t index;
+    size_t left;
+
+    if (!list || !f || list->size == 0)
     {
-        first = first->prev;
+        return;
     }
 
-    return (first);
+    chunk = list->first;
+    index = list->head;
+    for (left = list->size; left > 0; left--)
+    {
+        if (index == list->per_chunk)
+        {
+            chunk = chunk->next;
+            index = 0;
+        }
+        f(chunk->data + index++ * list->elem_size, arg);
+    }
+}
+
+/* Bounded queue after Vyukov: every slot carries a sequence number that
+ * says whose turn it is. A slot at position p is free for the producer
+ * when seq == p, holds an element for the consumers when seq == p + 1,
+ * and is handed back for the next lap as p + capacity. Consumers claim
+ * positions with a CAS on head; the producer owns tail outright. */
+typedef struct
+{
+    _Atomic size_t seq;
+    size_t pad;                 /* keeps the payload 16-byte aligned */
+    char data[];
+} ft_spmc_slot_t;
+
+struct ft_spmc_s
+{
+    _Alignas(64) _Atomic size_t head;
+    _Alignas(64) size_t tail;
+    size_t mask;
+    size_t elem_size;
+    size_t stride;
+    char* slots;
+};
+
+static inline ft_spmc_slot_t* spmc_slot(ft_spmc_t* queue, size_t pos)
+{
+    return ((ft_spmc_slot_t*)(queue->slots + (pos & queue->mask) * queue->stride));
 }
 
-void* ft_list_get_last(void** _head)
+ft_spmc_t* ft_spmc_create(size_t elem_size, size_t capacity)
 {
-    list_item_t** head = (list_item_t**)_head;
-    list_item_t* last;
+    ft_spmc_t* queue;
+    size_t size = 2;
 
-    if (!head)
+    if (elem_size == 0 || capacity == 0 || capacity > SIZE_MAX / 4)
     {
         return (NULL);
     }
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
 
-    if (!*head)
+    queue = aligned_alloc(64, sizeof(ft_spmc_t));
+    if (!queue)
     {
         return (NULL);
     }
-
-    last = *head;
-    while (last->next != *head)
+    queue->mask = size - 1;
+    queue->elem_size = elem_size;
+    queue->stride = (sizeof(ft_spmc_slot_t) + elem_size + 15) & ~(size_t)15;
+    queue->slots = malloc(size * queue->stride);
+    if (!queue->slots)
     {
-        last = last->next;
+        free(queue);
+        return (NULL);
     }
-
-    return (last);
+    for (size_t i = 0; i < size; i++)
+    {
+        atomic_init(&spmc_slot(queue, i)->seq, i);
+    }
+    atomic_init(&queue->head, 0);
+    queue->tail = 0;
+    return (queue);
 }
 
-int ft_list_find_node(void** _head, void* _node)
+void ft_spmc_destroy(ft_spmc_t* queue)
 {
-    list_item_t** head = (list_item_t**)_head;
-    list_item_t* node = (list_item_t*)_node;
-    list_item_t* current;
-    int index;
-
-    if (!head || !node)
+    if (!queue)
     {
-        return (INVALID_ARGS);
+        return;
     }
+    free(queue->slots);
+    free(queue);
+}
+
+int ft_spmc_push(ft_spmc_t* queue, const void* elem)
+{
+    ft_spmc_slot_t* slot = spmc_slot(queue, queue->tail);
 
-    if (!*head)
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != queue->tail)
     {
-        return (INVALID_ARGS);
+        return (FAILURE);
     }
+    memcpy(slot->data, elem, queue->elem_size);
+    atomic_store_explicit(&slot->seq, queue->tail + 1, memory_order_release);
+    queue->tail++;
+    return (OK);
+}
 
-    current = *head;
-    index = 0;
-    do
+int ft_spmc_pop(ft_spmc_t* queue, void* out)
+{
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    ft_spmc_slot_t* slot;
+    intptr_t diff;
+
+    for (;;)
     {
-        if (current == node)
+        slot = spmc_slot(queue, pos);
+        diff = (intptr_t)(atomic_load_explicit(&slot->seq, memory_order_acquire) - (pos + 1));
+        if (diff == 0)
         {
-            return (index);
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
         }
-        index++;
-        current = current->next;
-    } while (current != *head);
+        else if (diff < 0)
+        {
+            return (FAILURE);
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
 
-    return (FAILURE);
-}
\ No newline at end of file
+    memcpy(out, slot->data, queue->elem_size);
+    atomic_store_explicit(&slot->seq, pos + queue->mask + 1, memory_order_release);
+    return (OK);
+}
@@ -1,55 +1,79 @@
 #ifndef FT_LIST_H
 # define FT_LIST_H
 
-typedef struct list_item_s
-{
-    struct list_item_s* next;
-    struct list_item_s* prev;
-} list_item_t;
+# include <stddef.h>
 
-int ft_list_add_last(void** head, void* node);
-int ft_list_add_first(void** head, void* node);
-void* ft_list_get_next(void** head, void* node);
-void* ft_list_get_prev(void** head, void* node);
-int ft_list_pop(void** head, void* node);
-int ft_list_pop_first(void** head);
-int ft_list_pop_last(void** head);
-int ft_list_get_size(void** head);
-void* ft_list_get_first(void** head);
-void* ft_list_get_last(void** head);
-int ft_list_find_node(void** head, void* node);
+/* Chunked deque of fixed-size elements. Elements live by value in chunks
+ * of FT_LIST_CHUNK_BYTES linked both ways, so pushing and popping at
+ * either end, first/last and size are O(1), a walk touches memory
+ * sequentially and nothing is ever moved once pushed. The most recently
+ * emptied chunk is kept as a spare so a queue that hovers around a chunk
+ * boundary does not go back to malloc. */
+# define FT_LIST_CHUNK_BYTES (64 * 1024)
 
-/* Adds node to the last position of the head list. */
-#define FT_LIST_ADD_LAST(head, node) ft_list_add_last((void**)(head), (void*)(node))
+typedef struct ft_list_chunk_s
+{
+    struct ft_list_chunk_s* next;
+    struct ft_list_chunk_s* prev;
+    char data[];
+} ft_list_chunk_t;
 
-/* Adds node to the first position of the head list. */
-#define FT_LIST_ADD_FIRST(head, node) ft_list_add_first((void**)(head), (void*)(node))
+typedef struct
+{
+    ft_list_chunk_t* first;
+    ft_list_chunk_t* last;
+    ft_list_chunk_t* spare;
+    size_t head;                /* index of the first element in `first` */
+    size_t tail;                /* one past the last element in `last` */
+    size_t size;
+    size_t elem_size;
+    size_t per_chunk;
+} ft_list_t;
 
-/* get next node of 'node'. */
-#define FT_LIST_GET_NEXT(head, node) ft_list_get_next((void**)(head), (void*)(node))
+/* Returns OK or INVALID_ARGS; an initialized list needs no allocation
+ * until the first push. */
+int ft_list_init(ft_list_t* list, size_t elem_size);
+void ft_list_destroy(ft_list_t* list);
 
-/* gets prev node of 'node' */
-#define FT_LIST_GET_PREV(head, node) ft_list_get_prev((void**)(head), (void*)(node))
+/* Copy `elem` in; return OK, INVALID_ARGS or FAILURE (out of memory).
+ * The _slot variants hand back the uninitialized slot instead, NULL on
+ * failure, to build large elements in place. */
+int ft_list_add_last(ft_list_t* list, const void* elem);
+int ft_list_add_first(ft_list_t* list, const void* elem);
+void* ft_list_add_last_slot(ft_list_t* list);
+void* ft_list_add_first_slot(ft_list_t* list);
 
-/* unlinks a node from the head list */
-#define FT_LIST_POP(head, node) ft_list_pop((void**)(head), (void*)(node))
+/* Copy the element out to `out` (may be NULL) and remove it; return OK,
+ * or FAILURE on an empty list. */
+int ft_list_pop_first(ft_list_t* list, void* out);
+int ft_list_pop_last(ft_list_t* list, void* out);
 
-/* unlinks first node of the head list */
-#define FT_LIST_POP_FIRST(head) ft_list_pop_first((void**)(head))
+/* Point into the list, valid until that element is popped; NULL if empty. */
+void* ft_list_get_first(const ft_list_t* list);
+void* ft_list_get_last(const ft_list_t* list);
 
-/* unlinks last node of head list */
-#define FT_LIST_POP_LAST(head) ft_list_pop_last((void**)(head))
+/* Calls f(elem, arg) on every element, first to last. f must not add
+ * or remove elements. */
+void ft_list_foreach(const ft_list_t* list, void (*f)(void* elem, void* arg), void* arg);
+
+static inline size_t ft_list_get_size(const ft_list_t* list)
+{
+    return (list->size);
+}
 
-/* returns size of the list(members of it) */
-#define FT_LIST_GET_SIZE(head) ft_list_get_size((void**)(head))
+/* Bounded lock-free single-producer/multi-consumer queue of fixed-size
+ * elements. One thread pushes, any number pop; neither side ever blocks,
+ * so waiting for work is left to the caller. The capacity is rounded up
+ * to a power of two. */
+typedef struct ft_spmc_s ft_spmc_t;
 
-/* returns first node */
-#define FT_LIST_GET_FIRST(head) ft_list_get_first((void**)(head))
+ft_spmc_t* ft_spmc_create(size_t elem_size, size_t capacity);
+void ft_spmc_destroy(ft_spmc_t* queue);
 
-/* returns last node */
-#define FT_LIST_GET_LAST(head) ft_list_get_last((void**)(head))
+/* Producer only. OK, or FAILURE when the queue is full. */
+int ft_spmc_push(ft_spmc_t* queue, const void* elem);
 
-/* returns OK if given node it's from the list. */
-#define FT_LIST_FIND_NODE(head, node) ft_list_find_node((void**)(head), (void*)(node))
+/* Any thread. OK, or FAILURE when the queue is empty. */
+int ft_spmc_pop(ft_spmc_t* queue, void* out);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,105 @@
+#ifndef LIBFTLS_H
+# define LIBFTLS_H
+
+# include <stddef.h>
+# include <sys/stat.h>
+
+# define FTLS_API __attribute__((visibility("default")))
+
+/* Listing flags, one per ft_ls short option. */
+# define FTLS_LONG      0x00000001 /* -l long format */
+# define FTLS_RECURSIVE 0x00000002 /* -R recursive */
+# define FTLS_ALL       0x00000004 /* -a show hidden files */
+# define FTLS_REVERSE   0x00000008 /* -r reverse order */
+# define FTLS_SORT_TIME 0x00000010 /* -t sort by modification time */
+# define FTLS_UNSORTED  0x00000020 /* -f directory order */
+# define FTLS_NO_OWNER  0x00000040 /* -g long format without owner */
+# define FTLS_DIRECTORY 0x00000080 /* -d list directories themselves */
+# define FTLS_ATIME     0x00000100 /* -u use access time */
+# define FTLS_CTIME     0x00000200 /* -c use inode change time */
+# define FTLS_SORT_SIZE 0x00000400 /* -S sort by size */
+# define FTLS_ONE_FS    0x00000800 /* -x do not descend into other filesystems */
+# define FTLS_XATTR     0x00001000 /* -@ with -l, mark ACLs (+) and extended attributes (@) */
+
+/* ftls_set_option results. */
+# define FTLS_OK        0
+# define FTLS_EUNKNOWN  -1
+# define FTLS_EINVAL    -2
+
+/* ftls_list and ftls_diff result when the "deadline" option passed before
+ * the listing was complete: what was collected is printed, entries that
+ * could not be stat'ed in time with "?" fields. */
+# define FTLS_TIMEDOUT  3
+
+typedef struct ftls_ctx ftls_ctx;
+typedef struct ftls_iter ftls_iter;
+
+/* One directory entry. Pointers stay valid until the next ftls_next or
+ * ftls_closedir on the same iterator. */
+typedef struct ftls_entry
+{
+    const char *name;
+    size_t name_len;
+    const struct stat *st;
+    const char *link_target;    /* NULL unless the entry is a symlink */
+    size_t link_len;
+    unsigned long long checksum; /* content hash under the "checksum" option */
+    int has_checksum;           /* 0 when not a regular file or unreadable */
+    int unresolved;             /* the "deadline" passed first: st has the type only */
+} ftls_entry;
+
+/* A context owns every cache and buffer of a listing engine and is not
+ * shared between threads; use one context per thread. */
+FTLS_API ftls_ctx *ftls_create(void);
+FTLS_API void ftls_destroy(ftls_ctx *ctx);
+
+/* Drops the flags, options and output settings of the previous listing
+ * but keeps the warm parts: owner/group and time caches, the compiled
+ * LS_COLORS table and the scan buffers. */
+FTLS_API void ftls_reset(ftls_ctx *ctx);
+
+FTLS_API void ftls_set_flags(ftls_ctx *ctx, int flags);
+FTLS_API int ftls_get_flags(const ftls_ctx *ctx);
+
+/* Sets a long option by its ft_ls name without the dashes, e.g.
+ * ("head", "50"), ("exclude", "*.tmp"), ("color", "always"). A NULL value
+ * only checks the name: FTLS_EINVAL if it is known, FTLS_EUNKNOWN if not. */
+FTLS_API int ftls_set_option(ftls_ctx *ctx, const char *name, const char *value);
+
+/* Rendered output goes to out_fd, diagnostics to err_fd (-1 drops them). */
+FTLS_API void ftls_set_output(ftls_ctx *ctx, int out_fd, int err_fd);
+
+/* Relative operands are resolved against dir_fd (AT_FDCWD by default). */
+FTLS_API void ftls_set_cwd(ftls_ctx *ctx, int dir_fd);
+
+/* Lists the given operands (the current directory when count is 0)
+ * exactly like ft_ls. Returns 0, 1 if some operand failed, or
+ * FTLS_TIMEDOUT. Under the "snapshot-write" option the one operand's tree
+ * is recorded to that file instead; "snapshot-read" lists from such a file
+ * (ftls_diff and ftls_opendir too), operands relative to its root. With
+ * "estimate" set to a number of directories, each operand's tree is not
+ * listed but sized: entries, directories and bytes, exact if it fits in the
+ * budget and otherwise estimated from random paths with 95% intervals.
+ * With "files0-from" set to a file ("-" for standard input) there must be
+ * no operands: the NUL-terminated paths in it are listed as they are
+ * read, each under a "path:" header, with the caches and buffers of the
+ * context shared by all of them. */
+FTLS_API int ftls_list(ftls_ctx *ctx, const char *const *paths, int count);
+FTLS_API void ftls_flush(ftls_ctx *ctx);
+
+/* Walks the trees a and b in lockstep and writes one line per difference:
+ * "+ path" only in b, "- path" only in a, "~ path FIELD..." changed, with
+ * FIELD among type, mode, size, mtime and target. Only directories present
+ * on both sides are descended. The -a flag and the filters apply; sorting
+ * flags and --head/--tail do not. Returns 0 if the trees match, 1 if they
+ * differ, 2 if something could not be read and FTLS_TIMEDOUT. */
+FTLS_API int ftls_diff(ftls_ctx *ctx, const char *a, const char *b);
+
+/* Streaming access: scans, filters and sorts one directory with the
+ * context's flags and options, then yields its entries without any
+ * formatting. Every entry is stat'ed. */
+FTLS_API ftls_iter *ftls_opendir(ftls_ctx *ctx, const char *path);
+FTLS_API int ftls_next(ftls_iter *iter, ftls_entry *entry);
+FTLS_API void ftls_closedir(ftls_iter *iter);
+
+#endif
@@ -0,0 +1,374 @@
+#include "ftls_internal.h"
+#include <fcntl.h>
+
+/* --checkpoint FILE: every --checkpoint-interval seconds an -R walk saves
+ * where it is, between two directories: the operand, the directories
+ * left at every level of the walk in the order they will be listed, and
+ * how many bytes of output come before them. --resume FILE, given the
+ * same options and operands, truncates the output back to that offset
+ * when it is a regular file and lists the rest, so the output ends up
+ * the same as that of a run that was never interrupted; into a pipe, the
+ * rest simply follows. The granularity is one directory: a directory is
+ * sorted in full before any of it is shown, so one that was cut short is
+ * listed again from its header.
+ *
+ * The output is synced before the checkpoint that counts it is renamed
+ * into place, so a checkpoint never claims output a reboot lost. The
+ * walk itself is the sequential one: the pipelined walk keeps part of the
+ * frontier on its prefetch thread. The file is removed once the listing
+ * is complete.
+ *
+ * Layout, native byte order:
+ *   header
+ *   root      root_len bytes, the operand's path
+ *   dirs      dir_count times t_checkpoint_dir and path_len bytes */
+
+# define CHECKPOINT_MAGIC "FTLSCKP1"
+
+typedef struct
+{
+    char magic[8];
+    int32_t flags;
+    int32_t operand;            /* index among the operands, 0 for "." */
+    uint64_t output;            /* bytes of output before the first dir */
+    int32_t ws_cols;
+    int32_t block_shown;
+    uint32_t root_len;
+    uint32_t dir_count;
+} t_checkpoint_header;
+
+typedef struct
+{
+    int32_t depth;
+    uint32_t path_len;
+} t_checkpoint_dir;
+
+struct t_resume
+{
+    char *data;                 /* the whole file */
+    size_t size;
+};
+
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+    uint32_t count;
+    bool skip_first;            /* the level's first dir is being listed */
+    bool failed;
+} t_checkpoint_buffer;
+
+static void buffer_append(t_checkpoint_buffer *buffer, const void *data, size_t len)
+{
+    if (buffer->size + len > buffer->capacity)
+    {
+        size_t capacity = (buffer->capacity ? buffer->capacity : 4096) * 2;
+        char *grown;
+
+        while (capacity < buffer->size + len)
+            capacity *= 2;
+        grown = buffer->failed ? NULL : realloc(buffer->data, capacity);
+        if (grown == NULL)
+        {
+            buffer->failed = true;
+            return;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, len);
+    buffer->size += len;
+}
+
+static void buffer_dir(void *elem, void *arg)
+{
+    const dirs_todo *todo = elem;
+    t_checkpoint_buffer *buffer = arg;
+    t_checkpoint_dir dir = { todo->depth, (uint32_t)todo->path_len };
+
+    if (buffer->skip_first)
+    {
+        buffer->skip_first = false;
+        return;
+    }
+    buffer_append(buffer, &dir, sizeof(dir));
+    buffer_append(buffer, todo->path, todo->path_len);
+    buffer->count++;
+}
+
+static bool write_all(int fd, const char *data, size_t len)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < len)
+    {
+        n = pwrite(fd, data + done, len - done, done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+/* Writes FILE.tmp, syncs it and renames it over FILE, so a crash leaves
+ * either checkpoint whole. Once some output was lost, the last checkpoint
+ * is the last one that counts only output that was written. */
+static void checkpoint_save(ftls_ctx *ctx)
+{
+    t_checkpoint_buffer buffer;
+    t_checkpoint_header header;
+    char tmp[PATH_MAX];
+    struct stat st;
+    int fd;
+
+    flush_output(ctx);
+    if (ctx->output_failed)
+        return;
+    if (fstat(ctx->out_fd, &st) == 0 && S_ISREG(st.st_mode))
+        fdatasync(ctx->out_fd);
+
+    memset(&buffer, 0, sizeof(buffer));
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+    header.flags = ctx->flags;
+    header.operand = ctx->walk_operand;
+    header.output = ctx->output_offset;
+    header.ws_cols = ctx->ws_cols;
+    header.block_shown = ctx->block_shown;
+    header.root_len = strlen(ctx->walk_root);
+    buffer_append(&buffer, &header, sizeof(header));
+    buffer_append(&buffer, ctx->walk_root, header.root_len);
+    /* Innermost first; above it, each level's first dir is the one being
+     * listed, whose rest is the levels below. */
+    for (const t_walk_level *level = ctx->walk_top; level != NULL; level = level->up)
+    {
+        buffer.skip_first = level != ctx->walk_top;
+        ft_list_foreach(&level->dirs, buffer_dir, &buffer);
+    }
+    if (buffer.failed)
+    {
+        free(buffer.data);
+        report_error(ctx, "Cannot write checkpoint", ctx->checkpoint_out, ENOMEM);
+        return;
+    }
+    ((t_checkpoint_header *)buffer.data)->dir_count = buffer.count;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", ctx->checkpoint_out) >= (int)sizeof(tmp))
+        errno = ENAMETOOLONG;
+    else if ((fd = openat(ctx->cwd_fd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) != -1)
+    {
+        bool written = write_all(fd, buffer.data, buffer.size) && fsync(fd) == 0;
+
+        if (close(fd) == 0 && written &&
+            renameat(ctx->cwd_fd, tmp, ctx->cwd_fd, ctx->checkpoint_out) == 0)
+        {
+            free(buffer.data);
+            return;
+        }
+        unlinkat(ctx->cwd_fd, tmp, 0);
+    }
+    free(buffer.data);
+    report_error(ctx, "Cannot write checkpoint", ctx->checkpoint_out, errno);
+}
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* Output offsets count from the start of a regular output file, which
+ * may already hold something, and from the start of the listing for
+ * anything else. */
+void checkpoint_begin(ftls_ctx *ctx)
+{
+    struct stat st;
+    off_t at = 0;
+
+    flush_output(ctx);
+    if (fstat(ctx->out_fd, &st) == 0 && S_ISREG(st.st_mode))
+        at = (fcntl(ctx->out_fd, F_GETFL) & O_APPEND) ? st.st_size : lseek(ctx->out_fd, 0, SEEK_CUR);
+    ctx->output_offset = at > 0 ? (uint64_t)at : 0;
+    ctx->checkpoint_at = monotonic_ns() + (int64_t)ctx->checkpoint_interval * 1000000000LL;
+}
+
+/* Called between two directories of the walk: saves a checkpoint if one
+ * is due. Once the deadline has passed, the directories that are skipped
+ * are not listed, so the last checkpoint before it is kept. */
+void checkpoint_tick(ftls_ctx *ctx)
+{
+    int64_t now;
+
+    if (ctx->walk_root == NULL || ctx->deadline_hit)
+        return;
+    now = monotonic_ns();
+    if (now < ctx->checkpoint_at)
+        return;
+    checkpoint_save(ctx);
+    ctx->checkpoint_at = now + (int64_t)ctx->checkpoint_interval * 1000000000LL;
+}
+
+/* The listing is complete: there is nothing left to resume. */
+void checkpoint_finish(ftls_ctx *ctx)
+{
+    if (ctx->checkpoint_out != NULL && !ctx->deadline_hit)
+        unlinkat(ctx->cwd_fd, ctx->checkpoint_out, 0);
+}
+
+static bool resume_valid(const t_resume *resume)
+{
+    const t_checkpoint_header *header = (const t_checkpoint_header *)resume->data;
+    size_t offset = sizeof(*header);
+    t_checkpoint_dir dir;
+
+    if (resume->size < sizeof(*header) || memcmp(header->magic, CHECKPOINT_MAGIC, 8) != 0 ||
+        header->operand < 0 || header->root_len >= PATH_MAX ||
+        header->root_len > resume->size - offset)
+        return false;
+    offset += header->root_len;
+    for (uint32_t i = 0; i < header->dir_count; i++)
+    {
+        if (resume->size - offset < sizeof(dir))
+            return false;
+        memcpy(&dir, resume->data + offset, sizeof(dir));
+        offset += sizeof(dir);
+        if (dir.depth < 0 || dir.path_len == 0 || dir.path_len >= PATH_MAX ||
+            dir.path_len > resume->size - offset)
+            return false;
+        offset += dir.path_len;
+    }
+    return offset == resume->size;
+}
+
+/* The "resume" option. Reports why on the error fd and returns false if
+ * the file is not a checkpoint. */
+bool checkpoint_load(ftls_ctx *ctx, const char *file)
+{
+    t_resume *resume = calloc(1, sizeof(t_resume));
+    struct stat st;
+    int fd;
+
+    if (resume == NULL)
+        return false;
+    fd = openat(ctx->cwd_fd, file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1 || (resume->data = malloc(st.st_size + 1)) == NULL ||
+        read(fd, resume->data, st.st_size) != st.st_size)
+    {
+        report_error(ctx, "Cannot open checkpoint", file, errno);
+        if (fd != -1)
+            close(fd);
+        free(resume->data);
+        free(resume);
+        return false;
+    }
+    close(fd);
+    resume->size = st.st_size;
+    if (!resume_valid(resume))
+    {
+        report_error(ctx, "Cannot open checkpoint", file, EINVAL);
+        free(resume->data);
+        free(resume);
+        return false;
+    }
+    if (ctx->resume != NULL)
+        free(ctx->resume->data);
+    free(ctx->resume);
+    ctx->resume = resume;
+    return true;
+}
+
+void checkpoint_free(ftls_ctx *ctx)
+{
+    free(ctx->checkpoint_out);
+    ctx->checkpoint_out = NULL;
+    if (ctx->resume != NULL)
+        free(ctx->resume->data);
+    free(ctx->resume);
+    ctx->resume = NULL;
+}
+
+static bool resume_error(ftls_ctx *ctx, const char *message)
+{
+    if (ctx->err_fd >= 0)
+        write(ctx->err_fd, message, strlen(message));
+    return false;
+}
+
+/* Truncates a regular output file back to what the checkpoint counted. */
+static bool resume_output(ftls_ctx *ctx, uint64_t offset)
+{
+    struct stat st;
+
+    if (fstat(ctx->out_fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        if ((uint64_t)st.st_size < offset)
+            return resume_error(ctx, "ft_ls: the output is shorter than the checkpoint\n");
+        if (ftruncate(ctx->out_fd, offset) == -1 || lseek(ctx->out_fd, offset, SEEK_SET) == -1)
+        {
+            report_error(ctx, "Cannot truncate", "output", errno);
+            return false;
+        }
+    }
+    ctx->output_offset = offset;
+    return true;
+}
+
+/* Lists what the checkpoint had left of its operand. Returns the index of
+ * the next operand, or -1 if the checkpoint is not one of this command
+ * line. The checkpoint is used up either way. */
+int checkpoint_resume(ftls_ctx *ctx, const char *const *paths, int count, bool *first)
+{
+    t_resume *resume = ctx->resume;
+    const t_checkpoint_header *header = (const t_checkpoint_header *)resume->data;
+    const char *data = resume->data + sizeof(*header);
+    const char *root;
+    t_walk_level level;
+    int next = -1;
+
+    ctx->resume = NULL;
+    root = header->operand < (count > 0 ? count : 1) ? (count > 0 ? paths[header->operand] : ".") : NULL;
+    if (header->flags != ctx->flags || root == NULL || strlen(root) != header->root_len ||
+        memcmp(root, data, header->root_len) != 0)
+        resume_error(ctx, "ft_ls: the checkpoint is not from these options and operands\n");
+    else if (resume_output(ctx, header->output))
+    {
+        data += header->root_len;
+        ft_list_init(&level.dirs, sizeof(dirs_todo));
+        for (uint32_t i = 0; i < header->dir_count; i++)
+        {
+            t_checkpoint_dir dir;
+            dirs_todo *todo = ft_list_add_last_slot(&level.dirs);
+
+            memcpy(&dir, data, sizeof(dir));
+            data += sizeof(dir);
+            if (todo != NULL)
+            {
+                todo->depth = dir.depth;
+                todo->path_len = dir.path_len;
+                memcpy(todo->path, data, dir.path_len);
+                todo->path[dir.path_len] = '\0';
+            }
+            data += dir.path_len;
+        }
+        if (header->ws_cols > 0)
+            ctx->ws_cols = header->ws_cols;
+        ctx->walk_operand = header->operand;
+        ctx->walk_root = root;
+        walk_begin(ctx, root);
+        ctx->block_shown = header->block_shown != 0;
+        walk_queued(ctx, &level, ctx->flags);
+        ft_list_destroy(&level.dirs);
+        if (ctx->block_shown)
+            *first = false;
+        next = header->operand + 1;
+    }
+    free(resume->data);
+    free(resume);
+    return next;
+}
@@ -0,0 +1,533 @@
+#include "ftls_internal.h"
+#include "error_codes.h"
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef __SSE4_2__
+# include <nmmintrin.h>
+#endif
+
+/* --checksum: content hashes of regular files. A scan hands its regular
+ * files to a pool of hashing threads and moves on; the listing is waited
+ * for just before it is rendered, so with -R the files of one directory
+ * are read while the next directories are scanned. Files are read with
+ * large preads after POSIX_FADV_SEQUENTIAL rather than mapped: a file
+ * truncated while it is hashed then reads short instead of faulting.
+ * With --deadline the wait gives up at the deadline: the batch is
+ * abandoned to the pool, whose threads hash into their own buffers and
+ * only write back while someone still waits.
+ *
+ * The same pool looks up the -@ marks of a listing, see xattr.c. */
+
+# define CHECKSUM_READ_SIZE (1024 * 1024)
+# define CHECKSUM_MAX_THREADS 16
+
+/* The regular files of one scanned listing, hashed relative to dir_fd.
+ * An abandoned batch is freed by the thread finishing its last job. */
+struct t_checksum_batch
+{
+    int dir_fd;
+    int pending;
+    checksum_kind kind;
+    bool abandoned;
+    ftls_ctx *ctx;
+};
+
+typedef struct
+{
+    t_checksum_batch *batch;
+    t_file *file;
+    bool xattr;                 /* look up the -@ mark instead of hashing */
+} t_checksum_job;
+
+struct t_hasher
+{
+    pthread_t threads[CHECKSUM_MAX_THREADS];
+    int thread_count;
+    int live;                   /* threads not exited yet */
+    ft_list_t jobs;
+    bool stop;
+    bool abandoned;             /* a batch was given up on: do not join */
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t batch_done;
+    t_xattr_cache *xattrs;      /* -@ results, allocated on first use */
+};
+
+/* xxHash64, after the reference implementation. */
+# define XXH_PRIME1 0x9E3779B185EBCA87ULL
+# define XXH_PRIME2 0xC2B2AE3D27D4EB4FULL
+# define XXH_PRIME3 0x165667B19E3779F9ULL
+# define XXH_PRIME4 0x85EBCA77C2B2AE63ULL
+# define XXH_PRIME5 0x27D4EB2F165667C5ULL
+
+typedef struct
+{
+    uint64_t v[4];
+    uint64_t total;
+} t_xxh64;
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME2;
+    return rotl64(acc, 31) * XXH_PRIME1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t v)
+{
+    acc ^= xxh64_round(0, v);
+    return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+static void xxh64_init(t_xxh64 *state)
+{
+    state->v[0] = XXH_PRIME1 + XXH_PRIME2;
+    state->v[1] = XXH_PRIME2;
+    state->v[2] = 0;
+    state->v[3] = -XXH_PRIME1;
+    state->total = 0;
+}
+
+/* len must be a multiple of 32 except on the last call. */
+static uint64_t xxh64_update(t_xxh64 *state, const unsigned char *p, size_t len, bool last)
+{
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    state->total += len;
+    for (; end - p >= 32; p += 32)
+    {
+        state->v[0] = xxh64_round(state->v[0], read64(p));
+        state->v[1] = xxh64_round(state->v[1], read64(p + 8));
+        state->v[2] = xxh64_round(state->v[2], read64(p + 16));
+        state->v[3] = xxh64_round(state->v[3], read64(p + 24));
+    }
+    if (!last)
+        return 0;
+
+    if (state->total >= 32)
+    {
+        h = rotl64(state->v[0], 1) + rotl64(state->v[1], 7) + rotl64(state->v[2], 12) + rotl64(state->v[3], 18);
+        for (int i = 0; i < 4; i++)
+            h = xxh64_merge(h, state->v[i]);
+    }
+    else
+        h = state->v[2] + XXH_PRIME5;
+    h += state->total;
+
+    for (; end - p >= 8; p += 8)
+        h = rotl64(h ^ xxh64_round(0, read64(p)), 27) * XXH_PRIME1 + XXH_PRIME4;
+    if (end - p >= 4)
+    {
+        h = rotl64(h ^ (read32(p) * XXH_PRIME1), 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = rotl64(h ^ (*p * XXH_PRIME5), 11) * XXH_PRIME1;
+
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    return h ^ (h >> 32);
+}
+
+/* CRC-32C (Castagnoli): the SSE4.2 instruction when built for it,
+ * slicing-by-8 tables otherwise. */
+#ifdef __SSE4_2__
+static uint32_t crc32c_update(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t crc64 = crc;
+
+    for (; len >= 8; p += 8, len -= 8)
+        crc64 = _mm_crc32_u64(crc64, read64(p));
+    crc = (uint32_t)crc64;
+    for (; len > 0; p++, len--)
+        crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+
+static void crc32c_init_tables(void)
+{
+}
+#else
+static uint32_t g_crc32c_table[8][256];
+
+static void crc32c_init_tables(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+        g_crc32c_table[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++)
+        for (int t = 1; t < 8; t++)
+            g_crc32c_table[t][i] = (g_crc32c_table[t - 1][i] >> 8) ^
+                                   g_crc32c_table[0][g_crc32c_table[t - 1][i] & 0xff];
+}
+
+static uint32_t crc32c_update(uint32_t crc, const unsigned char *p, size_t len)
+{
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint32_t lo = read32(p) ^ crc;
+        uint32_t hi = read32(p + 4);
+        crc = g_crc32c_table[7][lo & 0xff] ^ g_crc32c_table[6][(lo >> 8) & 0xff] ^
+              g_crc32c_table[5][(lo >> 16) & 0xff] ^ g_crc32c_table[4][lo >> 24] ^
+              g_crc32c_table[3][hi & 0xff] ^ g_crc32c_table[2][(hi >> 8) & 0xff] ^
+              g_crc32c_table[1][(hi >> 16) & 0xff] ^ g_crc32c_table[0][hi >> 24];
+    }
+    for (; len > 0; p++, len--)
+        crc = (crc >> 8) ^ g_crc32c_table[0][(crc ^ *p) & 0xff];
+    return crc;
+}
+#endif
+
+static pthread_once_t g_crc32c_once = PTHREAD_ONCE_INIT;
+
+/* Reads the whole file in CHECKSUM_READ_SIZE blocks, each filled before it
+ * is hashed so only the last one has a partial xxh64 stripe. */
+static bool hash_file(int dir_fd, const char *name, checksum_kind kind, unsigned char *buffer, uint64_t *sum)
+{
+    t_xxh64 xxh;
+    uint32_t crc = 0xFFFFFFFF;
+    off_t offset = 0;
+    size_t filled;
+    ssize_t n;
+    int fd;
+
+    fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    xxh64_init(&xxh);
+
+    for (;;)
+    {
+        filled = 0;
+        while (filled < CHECKSUM_READ_SIZE)
+        {
+            n = pread(fd, buffer + filled, CHECKSUM_READ_SIZE - filled, offset);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1)
+            {
+                close(fd);
+                return false;
+            }
+            if (n == 0)
+                break;
+            filled += n;
+            offset += n;
+        }
+        if (kind == CHECKSUM_CRC32C)
+            crc = crc32c_update(crc, buffer, filled);
+        else if (filled < CHECKSUM_READ_SIZE)
+            *sum = xxh64_update(&xxh, buffer, filled, true);
+        else
+            xxh64_update(&xxh, buffer, filled, false);
+        if (filled < CHECKSUM_READ_SIZE)
+            break;
+    }
+    close(fd);
+    if (kind == CHECKSUM_CRC32C)
+        *sum = crc ^ 0xFFFFFFFF;
+    return true;
+}
+
+static void hasher_free(t_hasher *hasher)
+{
+    free(hasher->xattrs);
+    ft_list_destroy(&hasher->jobs);
+    pthread_cond_destroy(&hasher->work);
+    pthread_cond_destroy(&hasher->batch_done);
+    pthread_mutex_destroy(&hasher->lock);
+    free(hasher);
+}
+
+/* Under the lock. */
+static void batch_job_done(t_hasher *hasher, t_checksum_batch *batch)
+{
+    if (--batch->pending > 0)
+        return;
+    if (!batch->abandoned)
+    {
+        pthread_cond_broadcast(&hasher->batch_done);
+        return;
+    }
+    close(batch->dir_fd);
+    free(batch);
+}
+
+static void *hasher_main(void *arg)
+{
+    t_hasher *hasher = arg;
+    unsigned char *buffer = malloc(CHECKSUM_READ_SIZE);
+    char name[PATH_MAX];
+    t_checksum_job job;
+    uint64_t sum = 0;
+    bool ok;
+    bool last;
+
+    pthread_mutex_lock(&hasher->lock);
+    for (;;)
+    {
+        while (ft_list_get_size(&hasher->jobs) == 0 && !hasher->stop)
+            pthread_cond_wait(&hasher->work, &hasher->lock);
+        if (ft_list_pop_first(&hasher->jobs, &job) != OK)
+            break;
+        if (job.batch->abandoned)
+        {
+            batch_job_done(hasher, job.batch);
+            continue;
+        }
+        /* The listing may be dropped while the file is read. */
+        memcpy(name, job.file->name, job.file->name_len + 1);
+        if (job.xattr)
+        {
+            struct stat key = job.file->info;
+            bool unsupported;
+            char mark;
+
+            pthread_mutex_unlock(&hasher->lock);
+            mark = xattr_mark(job.batch->dir_fd, name, &unsupported);
+            pthread_mutex_lock(&hasher->lock);
+            xattr_remember(hasher->xattrs, &key, mark, unsupported);
+            if (!job.batch->abandoned)
+                job.file->xattr = mark;
+            batch_job_done(hasher, job.batch);
+            continue;
+        }
+        pthread_mutex_unlock(&hasher->lock);
+
+        ok = buffer && hash_file(job.batch->dir_fd, name, job.batch->kind, buffer, &sum);
+
+        pthread_mutex_lock(&hasher->lock);
+        if (!job.batch->abandoned)
+        {
+            job.file->checksum = sum;
+            job.file->checksum_state = ok ? CHECKSUM_STATE_OK : CHECKSUM_STATE_FAILED;
+        }
+        batch_job_done(hasher, job.batch);
+    }
+    last = --hasher->live == 0 && hasher->abandoned;
+    pthread_mutex_unlock(&hasher->lock);
+    free(buffer);
+    if (last)
+        hasher_free(hasher);
+    return NULL;
+}
+
+static t_hasher *hasher_start(bool remote)
+{
+    t_hasher *hasher = calloc(1, sizeof(t_hasher));
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_condattr_t attr;
+    int wanted;
+
+    if (hasher == NULL)
+        return NULL;
+    pthread_once(&g_crc32c_once, crc32c_init_tables);
+    /* At least two, so one file's reads overlap another's hashing; all of
+     * them when reads wait on the network rather than the CPU. */
+    wanted = remote ? CHECKSUM_MAX_THREADS :
+             cpus < 2 ? 2 : cpus > CHECKSUM_MAX_THREADS ? CHECKSUM_MAX_THREADS : (int)cpus;
+    ft_list_init(&hasher->jobs, sizeof(t_checksum_job));
+    pthread_mutex_init(&hasher->lock, NULL);
+    pthread_cond_init(&hasher->work, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&hasher->batch_done, &attr);
+    pthread_condattr_destroy(&attr);
+    hasher->live = wanted;
+    while (hasher->thread_count < wanted &&
+           pthread_create(&hasher->threads[hasher->thread_count], NULL, hasher_main, hasher) == 0)
+        hasher->thread_count++;
+    pthread_mutex_lock(&hasher->lock);
+    hasher->live -= wanted - hasher->thread_count;
+    pthread_mutex_unlock(&hasher->lock);
+    if (hasher->thread_count == 0)
+    {
+        checksum_stop(hasher);
+        return NULL;
+    }
+    return hasher;
+}
+
+/* After a deadline a thread may be stuck in a read that never returns:
+ * the threads are then detached and the last one out frees the pool. */
+void checksum_stop(t_hasher *hasher)
+{
+    pthread_t threads[CHECKSUM_MAX_THREADS];
+    int thread_count;
+    bool detach;
+
+    if (hasher == NULL)
+        return;
+    pthread_mutex_lock(&hasher->lock);
+    hasher->stop = true;
+    detach = hasher->abandoned && hasher->live > 0;
+    thread_count = hasher->thread_count;
+    memcpy(threads, hasher->threads, sizeof(threads));
+    pthread_cond_broadcast(&hasher->work);
+    pthread_mutex_unlock(&hasher->lock);
+    if (detach)
+    {
+        /* The pool may be gone already: only the copies are touched. */
+        for (int i = 0; i < thread_count; i++)
+            pthread_detach(threads[i]);
+        return;
+    }
+    for (int i = 0; i < hasher->thread_count; i++)
+        pthread_join(hasher->threads[i], NULL);
+    hasher_free(hasher);
+}
+
+bool checksum_parse(const char *value, checksum_kind *kind)
+{
+    if (strcmp(value, "xxh64") == 0)
+        *kind = CHECKSUM_XXH64;
+    else if (strcmp(value, "crc32c") == 0)
+        *kind = CHECKSUM_CRC32C;
+    else if (strcmp(value, "none") == 0)
+        *kind = CHECKSUM_NONE;
+    else
+        return false;
+    return true;
+}
+
+int checksum_width(checksum_kind kind)
+{
+    return kind == CHECKSUM_XXH64 ? 16 : kind == CHECKSUM_CRC32C ? 8 : 0;
+}
+
+/* Queues files[0..count) of listing, the regular ones under --checksum,
+ * for hashing, and with xattrs all of them whose -@ mark is not cached.
+ * Takes ownership of dir_fd. Entries that are not hashed are marked NONE,
+ * or FAILED when the pool cannot be started; marks not looked up are ' '.
+ * Nothing is hashed on a synthetic filesystem, where reading a file can
+ * block or change state. */
+void checksum_start(ftls_ctx *ctx, t_listing *listing, int dir_fd, int count, bool xattrs)
+{
+    t_checksum_batch *batch;
+    t_checksum_job job;
+    const t_fs_type *fs = fs_type_of(ctx, dir_fd);
+    bool hash = ctx->checksum != CHECKSUM_NONE && !fs->synthetic;
+    int queued = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        listing->files[i].checksum_state = hash && S_ISREG(listing->files[i].info.st_mode) ?
+                                           CHECKSUM_STATE_FAILED : CHECKSUM_STATE_NONE;
+        listing->files[i].xattr = ' ';
+    }
+    if (deadline_passed(ctx) || (!hash && !xattrs))
+    {
+        if (dir_fd != -1)
+            close(dir_fd);
+        return;
+    }
+    if (ctx->hasher == NULL)
+        ctx->hasher = hasher_start(fs->remote);
+    batch = malloc(sizeof(t_checksum_batch));
+    if (ctx->hasher == NULL || batch == NULL || dir_fd == -1)
+    {
+        free(batch);
+        if (dir_fd != -1)
+            close(dir_fd);
+        return;
+    }
+    batch->dir_fd = dir_fd;
+    batch->kind = ctx->checksum;
+    batch->pending = 0;
+    batch->abandoned = false;
+    batch->ctx = ctx;
+
+    pthread_mutex_lock(&ctx->hasher->lock);
+    if (xattrs && ctx->hasher->xattrs == NULL)
+        ctx->hasher->xattrs = xattr_cache_new();
+    xattrs = xattrs && ctx->hasher->xattrs != NULL;
+    job.batch = batch;
+    for (int i = 0; i < count; i++)
+    {
+        t_file *file = &listing->files[i];
+
+        job.file = file;
+        job.xattr = false;
+        if (file->checksum_state != CHECKSUM_STATE_NONE)
+        {
+            if (ft_list_add_last(&ctx->hasher->jobs, &job) != OK)
+                break;
+            batch->pending++;
+            queued++;
+        }
+        job.xattr = true;
+        if (xattrs && !file->unresolved && !xattr_cached(ctx->hasher->xattrs, &file->info, &file->xattr))
+        {
+            if (ft_list_add_last(&ctx->hasher->jobs, &job) != OK)
+                break;
+            batch->pending++;
+            queued++;
+        }
+    }
+    if (queued > 0)
+        pthread_cond_broadcast(&ctx->hasher->work);
+    pthread_mutex_unlock(&ctx->hasher->lock);
+
+    listing->checksums = batch;
+    listing->hasher = ctx->hasher;
+}
+
+/* Blocks until every file queued for listing has its checksum, or until
+ * the deadline: the files not hashed by then stay FAILED. */
+void checksum_wait(t_listing *listing)
+{
+    t_checksum_batch *batch = listing->checksums;
+    t_hasher *hasher = listing->hasher;
+    ftls_ctx *ctx;
+    int rc = 0;
+
+    if (batch == NULL)
+        return;
+    ctx = batch->ctx;
+    listing->checksums = NULL;
+    pthread_mutex_lock(&hasher->lock);
+    while (batch->pending > 0 && rc != ETIMEDOUT)
+    {
+        if (ctx->deadline_ms > 0)
+            rc = pthread_cond_timedwait(&hasher->batch_done, &hasher->lock, &ctx->deadline_at);
+        else
+            pthread_cond_wait(&hasher->batch_done, &hasher->lock);
+    }
+    if (batch->pending > 0)
+    {
+        batch->abandoned = true;
+        hasher->abandoned = true;
+        ctx->deadline_hit = true;
+        pthread_mutex_unlock(&hasher->lock);
+        return;
+    }
+    pthread_mutex_unlock(&hasher->lock);
+    close(batch->dir_fd);
+    free(batch);
+}
@@ -0,0 +1,465 @@
+#define _GNU_SOURCE
+#include "ft_ls.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+static int ignore_write;
+
+#define write(fd, str, len) do { ignore_write = write(fd, str, len); } while (0)
+
+/* Wire format of one request, client to server:
+ *
+ *   t_request_header, sent with SCM_RIGHTS carrying three descriptors:
+ *     the client's working directory, stdout and stderr
+ *   `length` bytes: `argc` NUL-terminated arguments (argv without argv[0])
+ *
+ * The server lists straight into the client's stdout/stderr and answers
+ * with one status byte (the ftls_list or ftls_diff result, 2 for a
+ * malformed request) once everything is written. */
+#define REQUEST_MAGIC 0x66746c73u   /* "ftls" */
+#define REQUEST_MAX_ARGS 4096
+#define REQUEST_MAX_LENGTH (1024 * 1024)
+#define REQUEST_FDS 3
+/* Seconds a client gets to send its request before the worker moves on. */
+#define REQUEST_TIMEOUT 5
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t argc;
+    uint32_t length;
+} t_request_header;
+
+#define QUEUE_SIZE 256
+#define MAX_WORKERS 64
+
+/* Accepted connections waiting for a worker. */
+typedef struct
+{
+    int fds[QUEUE_SIZE];
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} t_queue;
+
+static t_queue g_queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER,
+};
+
+static void queue_push(t_queue *queue, int fd)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == QUEUE_SIZE)
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    queue->fds[(queue->head + queue->count) % QUEUE_SIZE] = fd;
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static int queue_pop(t_queue *queue)
+{
+    int fd;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0)
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    fd = queue->fds[queue->head];
+    queue->head = (queue->head + 1) % QUEUE_SIZE;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return fd;
+}
+
+static bool read_full(int fd, void *buffer, size_t len)
+{
+    char *p = buffer;
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = read(fd, p, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool send_full(int fd, const void *buffer, size_t len)
+{
+    const char *p = buffer;
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool socket_address(const char *socket_path, struct sockaddr_un *addr)
+{
+    size_t len = strlen(socket_path);
+
+    if (len >= sizeof(addr->sun_path))
+    {
+        write(2, "ft_ls: socket path too long '", 29);
+        write(2, socket_path, len);
+        write(2, "'\n", 2);
+        return false;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, socket_path, len + 1);
+    return true;
+}
+
+/* Receives the header and its descriptors. Returns the number of fds
+ * stored in fds, or -1 if the header is missing or malformed. */
+static int receive_header(int sock, t_request_header *header, int *fds)
+{
+    char control[CMSG_SPACE(REQUEST_FDS * sizeof(int))];
+    struct iovec iov = { header, sizeof(*header) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t n;
+    int count = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    do
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    while (n == -1 && errno == EINTR);
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (count > REQUEST_FDS)
+            count = REQUEST_FDS;
+        memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+    }
+
+    if (n != sizeof(*header) || (msg.msg_flags & MSG_CTRUNC) ||
+        header->magic != REQUEST_MAGIC || header->argc > REQUEST_MAX_ARGS ||
+        header->length > REQUEST_MAX_LENGTH)
+    {
+        for (int i = 0; i < count; i++)
+            close(fds[i]);
+        return -1;
+    }
+    return count;
+}
+
+/* Splits the payload into argv, argv[0] being the program name. */
+static char **request_argv(char *payload, uint32_t length, uint32_t argc)
+{
+    char **argv = malloc((argc + 2) * sizeof(char *));
+    uint32_t offset = 0;
+
+    if (argv == NULL)
+        return NULL;
+    argv[0] = "ft_ls";
+    for (uint32_t i = 0; i < argc; i++)
+    {
+        char *end = offset < length ? memchr(payload + offset, '\0', length - offset) : NULL;
+        if (end == NULL)
+        {
+            free(argv);
+            return NULL;
+        }
+        argv[i + 1] = payload + offset;
+        offset = end - payload + 1;
+    }
+    argv[argc + 1] = NULL;
+    return offset == length ? argv : (free(argv), NULL);
+}
+
+/* Runs one request on a worker's context. The context is reset, not
+ * recreated, so its owner/group, time and color caches stay warm. */
+static unsigned char serve_request(ftls_ctx *ctx, int sock, const char **paths)
+{
+    t_request_header header;
+    int fds[REQUEST_FDS];
+    char *payload = NULL;
+    char **argv = NULL;
+    int path_count;
+    int options;
+    unsigned char status = 2;
+    int count;
+
+    count = receive_header(sock, &header, fds);
+    if (count != REQUEST_FDS)
+    {
+        /* A well-formed header with one or two descriptors. */
+        for (int i = 0; i < count; i++)
+            close(fds[i]);
+        return status;
+    }
+
+    payload = malloc(header.length + 1);
+    if (payload && read_full(sock, payload, header.length))
+        argv = request_argv(payload, header.length, header.argc);
+
+    if (argv != NULL)
+    {
+        ftls_reset(ctx);
+        ftls_set_cwd(ctx, fds[0]);
+        ftls_set_output(ctx, fds[1], fds[2]);
+        /* -q by default when the client's stdout is a terminal, as in main. */
+        if (isatty(fds[1]))
+            ftls_set_option(ctx, "hide-control-chars", "1");
+        options = parse_args(ctx, header.argc + 1, argv, paths, &path_count);
+        if (options >= 0)
+        {
+            ftls_set_flags(ctx, options & ~FLAG_DIFF);
+            if (options & FLAG_DIFF)
+                status = ftls_diff(ctx, paths[0], paths[1]);
+            else
+                status = ftls_list(ctx, paths, path_count);
+        }
+        ftls_flush(ctx);
+        ftls_reset(ctx);
+    }
+
+    for (int i = 0; i < REQUEST_FDS; i++)
+        close(fds[i]);
+    free(argv);
+    free(payload);
+    return status;
+}
+
+static void *worker_main(void *arg)
+{
+    ftls_ctx *ctx = arg;
+    const char **paths = malloc((REQUEST_MAX_ARGS + 1) * sizeof(char *));
+    unsigned char status;
+    int sock;
+
+    for (;;)
+    {
+        sock = queue_pop(&g_queue);
+        status = serve_request(ctx, sock, paths);
+        send_full(sock, &status, 1);
+        close(sock);
+    }
+    return NULL;
+}
+
+static int worker_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n < 1)
+        return 1;
+    return n > MAX_WORKERS ? MAX_WORKERS : (int)n;
+}
+
+/* Only the server's own user may use it: the socket is created 0600 and
+ * a peer running as anyone else is hung up on. A connected client must
+ * send its request within REQUEST_TIMEOUT, or it would hold a worker. */
+static bool accept_peer(int sock)
+{
+    struct timeval timeout = { REQUEST_TIMEOUT, 0 };
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1 || cred.uid != geteuid())
+        return false;
+    return setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0;
+}
+
+/* ft_ls --serve SOCKET: binds SOCKET and answers requests until killed,
+ * one resident context per worker thread. */
+int serve(const char *socket_path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    pthread_t thread;
+    ftls_ctx *ctx;
+    int workers = worker_count();
+    int sock;
+    int client_sock;
+    mode_t mask;
+    int bound;
+
+    if (!socket_address(socket_path, &addr))
+        return 1;
+
+    setlocale(LC_ALL, "");
+    signal(SIGPIPE, SIG_IGN);
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+    {
+        perror("ft_ls: socket");
+        return 1;
+    }
+    /* Only a stale socket is replaced, never a regular file. */
+    if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socket_path);
+    mask = umask(0177);
+    bound = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (bound == -1 || listen(sock, SOMAXCONN) == -1)
+    {
+        write(2, "ft_ls: Cannot listen on '", 25);
+        write(2, socket_path, strlen(socket_path));
+        write(2, "': ", 3);
+        perror("");
+        close(sock);
+        return 1;
+    }
+
+    for (int i = 0; i < workers; i++)
+    {
+        ctx = ftls_create();
+        if (ctx == NULL || pthread_create(&thread, NULL, worker_main, ctx) != 0)
+        {
+            perror("ft_ls: worker");
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+
+    for (;;)
+    {
+        client_sock = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+        if (client_sock == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("ft_ls: accept");
+            close(sock);
+            return 1;
+        }
+        if (!accept_peer(client_sock))
+        {
+            close(client_sock);
+            continue;
+        }
+        queue_push(&g_queue, client_sock);
+    }
+}
+
+/* ft_ls --client SOCKET ARGS...: hands ARGS, the working directory and
+ * stdout/stderr to the server and waits for it to finish writing.
+ * argv[0] is SOCKET; the arguments are validated locally first so usage
+ * errors and --help behave exactly like a local run. */
+int client(const char *socket_path, int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    t_request_header header = { REQUEST_MAGIC, argc - 1, 0 };
+    char control[CMSG_SPACE(REQUEST_FDS * sizeof(int))];
+    struct iovec iov = { &header, sizeof(header) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    const char **paths;
+    ftls_ctx *ctx;
+    int fds[REQUEST_FDS];
+    int path_count;
+    int options;
+    int sock;
+    unsigned char status;
+    bool sent;
+
+    if (!socket_address(socket_path, &addr))
+        return 1;
+
+    ctx = ftls_create();
+    paths = malloc(argc * sizeof(char *));
+    if (ctx == NULL || paths == NULL)
+        return 1;
+    options = parse_args(ctx, argc, argv, paths, &path_count);
+    ftls_destroy(ctx);
+    free(paths);
+    if (options < 0)
+        return options == -2 ? 0 : 1;
+
+    for (int i = 1; i < argc; i++)
+        header.length += strlen(argv[i]) + 1;
+    if (argc - 1 > REQUEST_MAX_ARGS || header.length > REQUEST_MAX_LENGTH)
+    {
+        write(2, "ft_ls: request too large\n", 25);
+        return 1;
+    }
+
+    fds[0] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    fds[1] = STDOUT_FILENO;
+    fds[2] = STDERR_FILENO;
+    if (fds[0] == -1)
+    {
+        perror("ft_ls: Cannot open working directory");
+        return 1;
+    }
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        write(2, "ft_ls: Cannot connect to '", 26);
+        write(2, socket_path, strlen(socket_path));
+        write(2, "': ", 3);
+        perror("");
+        return 1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    sent = sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(header);
+    for (int i = 1; sent && i < argc; i++)
+        sent = send_full(sock, argv[i], strlen(argv[i]) + 1);
+    close(fds[0]);
+
+    if (!sent || !read_full(sock, &status, 1))
+    {
+        write(2, "ft_ls: connection to the server lost\n", 37);
+        close(sock);
+        return 1;
+    }
+    close(sock);
+    if ((options & FLAG_DIFF) || status == FTLS_TIMEDOUT)
+        return status;
+    return status == 2 ? 1 : 0;
+}
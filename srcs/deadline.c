@@ -0,0 +1,480 @@
+#include "ftls_internal.h"
+#include "error_codes.h"
+#include <fcntl.h>
+#include <pthread.h>
+
+/* --deadline MS. Every call that can hang on a sick mount runs on a helper
+ * thread owned by the context while the caller waits on a condition timed
+ * against the deadline. A directory is one request: the helper reads all
+ * its names, then stats them, publishing each entry as it goes, so when
+ * the deadline passes the scan still gets every name read so far, those
+ * not stat'ed yet marked unresolved. The call in flight cannot be
+ * cancelled: the helper is abandoned to it and releases the descriptors it
+ * holds once it returns. After that no new I/O is issued. Nothing the
+ * helper reads belongs to the context, which may be reset or destroyed
+ * under an abandoned helper: it filters names with its own copy of the
+ * filter, taken again for every listing. */
+
+typedef enum
+{
+    IO_OPEN,
+    IO_COLLECT
+} io_op;
+
+/* One entry read by the helper. */
+typedef struct
+{
+    unsigned char d_type;
+    char name[256];
+    int stat_error;             /* 0, or the errno of fstatat */
+    bool resolved;              /* false: not stat'ed before the deadline */
+    struct stat st;
+    char *link_target;          /* malloc'd for symlinks */
+    size_t link_len;
+    int link_error;             /* why link_target is NULL for a symlink */
+} t_collected_entry;
+
+struct t_collected
+{
+    ft_list_t entries;
+    t_collected_entry current;
+    struct dirent entry;        /* what collected_next hands out */
+    DIR *dir;
+    bool abandoned;
+};
+
+typedef struct t_io_helper
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int refs;                   /* the context and the thread */
+    bool busy;                  /* a request is posted and not answered */
+    bool stop;
+    bool abandoned;
+
+    io_op op;
+    int cwd_fd;
+    char path[PATH_MAX];
+    int result;
+    int error;
+    bool accessible;
+
+    t_collected *collected;
+    DIR *dir;
+    int options;
+    t_filter filter;            /* the helper's copy of ctx->filter */
+    bool filter_copied;         /* for the current listing */
+    bool need_stat;
+    bool type_filter;
+} t_io_helper;
+
+static void io_release(t_io_helper *io)
+{
+    bool last;
+
+    pthread_mutex_lock(&io->lock);
+    last = --io->refs == 0;
+    pthread_mutex_unlock(&io->lock);
+    if (!last)
+        return;
+    pthread_cond_destroy(&io->changed);
+    pthread_mutex_destroy(&io->lock);
+    free_filter(&io->filter);
+    free(io);
+}
+
+static void io_open(t_io_helper *io)
+{
+    io->accessible = faccessat(io->cwd_fd, io->path, F_OK, 0) == 0;
+    io->result = io->accessible ? openat(io->cwd_fd, io->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    io->error = errno;
+}
+
+/* Publishes under the lock, and only while the caller still waits. */
+static void io_collect(t_io_helper *io)
+{
+    t_collected_entry **pending = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    t_collected_entry *slot;
+    struct dirent *entry;
+    struct stat st;
+    char link[PATH_MAX];
+    ssize_t link_len;
+    int error;
+
+    while ((entry = readdir(io->dir)) != NULL)
+    {
+        size_t name_len = strlen(entry->d_name);
+
+        if (entry->d_name[0] == '.' && !(io->options & FLAG_a))
+            continue;
+        if (filter_active(&io->filter) &&
+            !filter_name(&io->filter, entry->d_name, name_len, entry->d_type, io->options))
+            continue;
+
+        pthread_mutex_lock(&io->lock);
+        slot = io->abandoned ? NULL : ft_list_add_last_slot(&io->collected->entries);
+        if (slot != NULL)
+        {
+            slot->d_type = entry->d_type;
+            memcpy(slot->name, entry->d_name, name_len + 1);
+            slot->resolved = false;
+            slot->link_target = NULL;
+        }
+        pthread_mutex_unlock(&io->lock);
+        if (slot == NULL)
+            break;
+        if (!io->need_stat && !(io->type_filter && entry->d_type == DT_UNKNOWN))
+            continue;
+        if (count == capacity)
+        {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            t_collected_entry **grown = realloc(pending, capacity * sizeof(*pending));
+            if (grown == NULL)
+                break;
+            pending = grown;
+        }
+        pending[count++] = slot;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        char *target = NULL;
+        int link_error = 0;
+
+        error = fstatat(dirfd(io->dir), pending[i]->name, &st, AT_SYMLINK_NOFOLLOW) == -1 ? errno : 0;
+        if (error == 0 && S_ISLNK(st.st_mode))
+        {
+            link_len = readlinkat(dirfd(io->dir), pending[i]->name, link, sizeof(link) - 1);
+            if (link_len == -1)
+                link_error = errno;
+            else if ((target = malloc(link_len + 1)) == NULL)
+                link_error = ENOMEM;
+            else
+            {
+                memcpy(target, link, link_len);
+                target[link_len] = '\0';
+            }
+        }
+
+        pthread_mutex_lock(&io->lock);
+        if (io->abandoned)
+        {
+            pthread_mutex_unlock(&io->lock);
+            free(target);
+            break;
+        }
+        pending[i]->stat_error = error;
+        pending[i]->st = st;
+        pending[i]->link_target = target;
+        pending[i]->link_len = target ? link_len : 0;
+        pending[i]->link_error = link_error;
+        pending[i]->resolved = true;
+        pthread_mutex_unlock(&io->lock);
+    }
+    free(pending);
+}
+
+/* Cleanup of a request nobody waits for any more, under the lock. */
+static void io_abandoned(t_io_helper *io)
+{
+    if (io->op == IO_OPEN && io->result != -1)
+        close(io->result);
+    if (io->op == IO_COLLECT)
+        closedir(io->dir);
+}
+
+static void *io_main(void *arg)
+{
+    t_io_helper *io = arg;
+
+    pthread_mutex_lock(&io->lock);
+    for (;;)
+    {
+        while (!io->busy && !io->stop)
+            pthread_cond_wait(&io->changed, &io->lock);
+        if (!io->busy)
+            break;
+        pthread_mutex_unlock(&io->lock);
+
+        if (io->op == IO_OPEN)
+            io_open(io);
+        else
+            io_collect(io);
+
+        pthread_mutex_lock(&io->lock);
+        io->busy = false;
+        if (io->abandoned)
+        {
+            io_abandoned(io);
+            break;
+        }
+        pthread_cond_broadcast(&io->changed);
+    }
+    pthread_mutex_unlock(&io->lock);
+    io_release(io);
+    return NULL;
+}
+
+static t_io_helper *io_get(ftls_ctx *ctx)
+{
+    pthread_condattr_t attr;
+    pthread_attr_t thread_attr;
+    pthread_t thread;
+    t_io_helper *io;
+
+    if (ctx->io != NULL)
+        return ctx->io;
+    io = calloc(1, sizeof(t_io_helper));
+    if (io == NULL)
+        return NULL;
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&io->changed, &attr);
+    pthread_condattr_destroy(&attr);
+    io->refs = 2;
+
+    /* Detached: an abandoned helper frees itself whenever its call returns. */
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &thread_attr, io_main, io) != 0)
+    {
+        pthread_attr_destroy(&thread_attr);
+        io->refs = 1;
+        io_release(io);
+        return NULL;
+    }
+    pthread_attr_destroy(&thread_attr);
+    ctx->io = io;
+    return io;
+}
+
+/* Posts the request filled in ctx->io and waits for the answer until the
+ * deadline. false, with the helper abandoned, if the deadline won. */
+static bool io_run(ftls_ctx *ctx, t_io_helper *io)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&io->lock);
+    io->busy = true;
+    pthread_cond_broadcast(&io->changed);
+    while (io->busy && rc != ETIMEDOUT)
+        rc = pthread_cond_timedwait(&io->changed, &io->lock, &ctx->deadline_at);
+    if (!io->busy)
+    {
+        pthread_mutex_unlock(&io->lock);
+        return true;
+    }
+    io->abandoned = true;
+    pthread_mutex_unlock(&io->lock);
+    ctx->io = NULL;
+    ctx->deadline_hit = true;
+    io_release(io);
+    return false;
+}
+
+/* Starts a listing. Its filter may differ from the last one's, so an idle
+ * helper takes a fresh copy with the next deadline_collect. */
+void deadline_arm(ftls_ctx *ctx)
+{
+    ctx->deadline_hit = false;
+    if (ctx->io != NULL)
+        ctx->io->filter_copied = false;
+    if (ctx->deadline_ms == 0)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &ctx->deadline_at);
+    ctx->deadline_at.tv_sec += ctx->deadline_ms / 1000;
+    ctx->deadline_at.tv_nsec += (ctx->deadline_ms % 1000) * 1000000L;
+    if (ctx->deadline_at.tv_nsec >= 1000000000L)
+    {
+        ctx->deadline_at.tv_sec++;
+        ctx->deadline_at.tv_nsec -= 1000000000L;
+    }
+}
+
+/* True once the deadline has passed; no new I/O should be issued. */
+bool deadline_passed(ftls_ctx *ctx)
+{
+    struct timespec now;
+
+    if (ctx->deadline_ms == 0)
+        return false;
+    if (!ctx->deadline_hit)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > ctx->deadline_at.tv_sec ||
+            (now.tv_sec == ctx->deadline_at.tv_sec && now.tv_nsec >= ctx->deadline_at.tv_nsec))
+            ctx->deadline_hit = true;
+    }
+    return ctx->deadline_hit;
+}
+
+/* The result of a walk: status, or FTLS_TIMEDOUT, reported, if the
+ * deadline cut it short. */
+int deadline_status(ftls_ctx *ctx, int status)
+{
+    char message[96];
+    int len;
+
+    if (!ctx->deadline_hit)
+        return status;
+    len = snprintf(message, sizeof(message),
+                   "ft_ls: deadline of %d ms passed, listing is incomplete\n", ctx->deadline_ms);
+    if (ctx->err_fd >= 0)
+        write(ctx->err_fd, message, len);
+    return FTLS_TIMEDOUT;
+}
+
+void deadline_free(ftls_ctx *ctx)
+{
+    t_io_helper *io = ctx->io;
+
+    if (io == NULL)
+        return;
+    pthread_mutex_lock(&io->lock);
+    io->stop = true;
+    pthread_cond_broadcast(&io->changed);
+    pthread_mutex_unlock(&io->lock);
+    ctx->io = NULL;
+    io_release(io);
+}
+
+/* faccessat + openat of a directory operand on the helper. Returns the fd,
+ * or -1 with errno set and *accessible telling which call failed; errno
+ * is ETIMEDOUT once the deadline has passed. */
+int deadline_open(ftls_ctx *ctx, const char *path, bool *accessible)
+{
+    t_io_helper *io;
+    size_t len = strlen(path);
+
+    *accessible = true;
+    if (deadline_passed(ctx))
+    {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    if ((io = io_get(ctx)) == NULL || len >= PATH_MAX)
+    {
+        /* No helper: unguarded, like without --deadline. */
+        if (faccessat(ctx->cwd_fd, path, F_OK, 0) == -1)
+        {
+            *accessible = false;
+            return -1;
+        }
+        return openat(ctx->cwd_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+
+    io->op = IO_OPEN;
+    io->cwd_fd = ctx->cwd_fd;
+    memcpy(io->path, path, len + 1);
+    if (!io_run(ctx, io))
+    {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    *accessible = io->accessible;
+    errno = io->error;
+    return io->result;
+}
+
+/* Reads and stats dir on the helper. The scan then walks the result with
+ * collected_next/collected_stat/collected_readlink and hands it back with
+ * collected_free, which also closes dir. NULL if no helper could run. */
+t_collected *deadline_collect(ftls_ctx *ctx, DIR *dir, int options, bool need_stat, bool type_filter)
+{
+    t_collected *collected;
+    t_io_helper *io;
+
+    collected = calloc(1, sizeof(t_collected));
+    if (collected == NULL)
+        return NULL;
+    ft_list_init(&collected->entries, sizeof(t_collected_entry));
+    collected->dir = dir;
+    if (deadline_passed(ctx))
+        return collected;
+    if ((io = io_get(ctx)) == NULL)
+    {
+        free(collected);
+        return NULL;
+    }
+
+    io->op = IO_COLLECT;
+    io->collected = collected;
+    io->dir = dir;
+    io->options = options;
+    if (!io->filter_copied)
+    {
+        /* A failed copy filters nothing here; the scan still does. */
+        free_filter(&io->filter);
+        filter_copy(&io->filter, &ctx->filter);
+        io->filter_copied = true;
+    }
+    io->need_stat = need_stat;
+    io->type_filter = type_filter;
+    if (!io_run(ctx, io))
+        collected->abandoned = true;
+    return collected;
+}
+
+struct dirent *collected_next(t_collected *collected)
+{
+    free(collected->current.link_target);
+    collected->current.link_target = NULL;
+    if (ft_list_pop_first(&collected->entries, &collected->current) != OK)
+        return NULL;
+    collected->entry.d_type = collected->current.d_type;
+    memcpy(collected->entry.d_name, collected->current.name, strlen(collected->current.name) + 1);
+    return &collected->entry;
+}
+
+/* 0 with *st filled, -1 with errno set, or 1 for an entry the deadline
+ * left unresolved: *st is then zero but for the file type from readdir. */
+int collected_stat(t_collected *collected, struct stat *st)
+{
+    const t_collected_entry *current = &collected->current;
+
+    if (!current->resolved)
+    {
+        memset(st, 0, sizeof(*st));
+        st->st_mode = current->d_type == DT_UNKNOWN ? 0 : DTTOIF(current->d_type);
+        return 1;
+    }
+    if (current->stat_error != 0)
+    {
+        errno = current->stat_error;
+        return -1;
+    }
+    *st = current->st;
+    return 0;
+}
+
+ssize_t collected_readlink(t_collected *collected, char *buffer, size_t size)
+{
+    const t_collected_entry *current = &collected->current;
+    size_t len;
+
+    if (current->link_target == NULL)
+    {
+        errno = current->link_error;
+        return -1;
+    }
+    len = current->link_len < size ? current->link_len : size;
+    memcpy(buffer, current->link_target, len);
+    return len;
+}
+
+void collected_free(t_collected *collected)
+{
+    t_collected_entry entry;
+
+    free(collected->current.link_target);
+    while (ft_list_pop_first(&collected->entries, &entry) == OK)
+        free(entry.link_target);
+    ft_list_destroy(&collected->entries);
+    /* An abandoned helper still reads the stream and closes it itself. */
+    if (!collected->abandoned)
+        closedir(collected->dir);
+    free(collected);
+}
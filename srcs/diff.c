@@ -0,0 +1,246 @@
+#include "ftls_internal.h"
+
+/* Lockstep walk behind ftls_diff. Each level scans both sides into the two
+ * reused listings, merge-joins the sorted names and keeps only the names
+ * of the common subdirectories before descending, so memory is two
+ * directory listings plus the pending directory names of the current
+ * path, never a whole tree. */
+
+typedef struct
+{
+    ftls_ctx *ctx;
+    t_listing a;
+    t_listing b;
+    int options;
+    int status;
+    char a_path[PATH_MAX];
+    char b_path[PATH_MAX];
+    char rel[PATH_MAX];
+} t_diff;
+
+/* Common subdirectories of one level, NUL-separated. */
+typedef struct
+{
+    char *names;
+    size_t len;
+    size_t capacity;
+    int count;
+} t_subdirs;
+
+/* Out of memory the directory is reported and not descended, like one
+ * that cannot be opened. */
+static void subdirs_add(t_diff *diff, t_subdirs *subdirs, const char *name, size_t name_len)
+{
+    if (subdirs->len + name_len + 1 > subdirs->capacity)
+    {
+        size_t capacity = (subdirs->capacity + name_len + 1) * 2;
+        char *grown = realloc(subdirs->names, capacity);
+
+        if (grown == NULL)
+        {
+            report_error(diff->ctx, "Cannot open directory", name, ENOMEM);
+            diff->status = 2;
+            return;
+        }
+        subdirs->names = grown;
+        subdirs->capacity = capacity;
+    }
+    memcpy(subdirs->names + subdirs->len, name, name_len + 1);
+    subdirs->len += name_len + 1;
+    subdirs->count++;
+}
+
+static void diff_line(t_diff *diff, char mark, size_t rel_len, const t_file *file, const char *fields)
+{
+    char prefix[2] = { mark, ' ' };
+    char path[2 * PATH_MAX];
+
+    /* Quoted as one path, so -Q puts one pair of quotes around it. */
+    memcpy(path, diff->rel, rel_len);
+    memcpy(path + rel_len, file->name, file->name_len);
+    buffered_write(diff->ctx, prefix, 2);
+    quote_write(diff->ctx, path, rel_len + file->name_len);
+    if (fields != NULL)
+        buffered_write(diff->ctx, fields, strlen(fields));
+    buffered_write(diff->ctx, "\n", 1);
+    diff->status = diff->status > 1 ? diff->status : 1;
+}
+
+/* Appends the names of the differing fields to out (" mode size ..."). */
+static bool diff_fields(const t_file *a, const t_file *b, char *out)
+{
+    out[0] = '\0';
+    if ((a->info.st_mode & S_IFMT) != (b->info.st_mode & S_IFMT))
+    {
+        strcat(out, " type");
+        return true;
+    }
+    if ((a->info.st_mode & 07777) != (b->info.st_mode & 07777))
+        strcat(out, " mode");
+    /* A directory's size and mtime follow its contents, which the walk
+     * reports entry by entry. */
+    if (!S_ISDIR(a->info.st_mode))
+    {
+        if (a->info.st_size != b->info.st_size)
+            strcat(out, " size");
+        if (a->info.st_mtim.tv_sec != b->info.st_mtim.tv_sec ||
+            a->info.st_mtim.tv_nsec != b->info.st_mtim.tv_nsec)
+            strcat(out, " mtime");
+    }
+    if (S_ISLNK(a->info.st_mode) &&
+        (a->link_len != b->link_len || memcmp(a->link_target, b->link_target, a->link_len) != 0))
+        strcat(out, " target");
+    return out[0] != '\0';
+}
+
+static bool diff_scan(t_diff *diff, const char *path, t_listing *listing)
+{
+    DIR *dir;
+
+    if (!open_directory(diff->ctx, path, &dir))
+    {
+        diff->status = 2;
+        return false;
+    }
+    scan_directory(diff->ctx, listing, path, dir, diff->options);
+
+    /* "." and ".." (listed with -a) are the directories being compared. */
+    int kept = 0;
+    for (int i = 0; i < listing->count; i++)
+    {
+        const char *name = listing->files[i].name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        if (kept != i)
+            listing->files[kept] = listing->files[i];
+        kept++;
+    }
+    listing->count = kept;
+    return true;
+}
+
+static bool path_join(char *path, size_t *len, const char *name, size_t name_len)
+{
+    if (*len + name_len + 2 > PATH_MAX)
+        return false;
+    memcpy(path + *len, name, name_len);
+    path[*len + name_len] = '/';
+    path[*len + name_len + 1] = '\0';
+    *len += name_len + 1;
+    return true;
+}
+
+static void diff_level(t_diff *diff, size_t a_len, size_t b_len, size_t rel_len)
+{
+    t_subdirs subdirs = { NULL, 0, 0, 0 };
+    char fields[64];
+    int i = 0;
+    int j = 0;
+    int cmp;
+
+    if (!diff_scan(diff, diff->a_path, &diff->a) || !diff_scan(diff, diff->b_path, &diff->b))
+        return;
+
+    while (i < diff->a.count || j < diff->b.count)
+    {
+        const t_file *a = &diff->a.files[i];
+        const t_file *b = &diff->b.files[j];
+
+        if (i == diff->a.count)
+            cmp = 1;
+        else if (j == diff->b.count)
+            cmp = -1;
+        else
+            cmp = compare_files(a, b, 0);
+
+        if (cmp < 0)
+        {
+            diff_line(diff, '-', rel_len, a, NULL);
+            i++;
+        }
+        else if (cmp > 0)
+        {
+            diff_line(diff, '+', rel_len, b, NULL);
+            j++;
+        }
+        else
+        {
+            if (diff_fields(a, b, fields))
+                diff_line(diff, '~', rel_len, a, fields);
+            if (S_ISDIR(a->info.st_mode) && S_ISDIR(b->info.st_mode) &&
+                !filter_pruned(&diff->ctx->filter, a->name, a->name_len))
+                subdirs_add(diff, &subdirs, a->name, a->name_len);
+            i++;
+            j++;
+        }
+    }
+
+    for (size_t offset = 0; offset < subdirs.len; )
+    {
+        const char *name = subdirs.names + offset;
+        size_t name_len = strlen(name);
+        size_t a_next = a_len;
+        size_t b_next = b_len;
+        size_t rel_next = rel_len;
+
+        offset += name_len + 1;
+        if (!path_join(diff->a_path, &a_next, name, name_len) ||
+            !path_join(diff->b_path, &b_next, name, name_len) ||
+            !path_join(diff->rel, &rel_next, name, name_len))
+        {
+            report_error(diff->ctx, "Cannot open directory", name, ENAMETOOLONG);
+            diff->status = 2;
+            continue;
+        }
+        diff_level(diff, a_next, b_next, rel_next);
+    }
+    free(subdirs.names);
+}
+
+static bool diff_root(char *out, size_t *len, const char *root)
+{
+    *len = strlen(root);
+    if (*len + 2 > PATH_MAX)
+        return false;
+    memcpy(out, root, *len + 1);
+    if (*len > 0 && out[*len - 1] != '/')
+    {
+        out[(*len)++] = '/';
+        out[*len] = '\0';
+    }
+    return true;
+}
+
+int ftls_diff(ftls_ctx *ctx, const char *a, const char *b)
+{
+    t_diff *diff = calloc(1, sizeof(t_diff));
+    int limit = ctx->limit;
+    size_t a_len;
+    size_t b_len;
+    int status;
+
+    if (diff == NULL)
+        return 2;
+    diff->ctx = ctx;
+    diff->options = (ctx->flags & FLAG_a) | FLAG_STAT;
+    if (!diff_root(diff->a_path, &a_len, a) || !diff_root(diff->b_path, &b_len, b))
+    {
+        report_error(ctx, "Cannot open directory", a, ENAMETOOLONG);
+        free(diff);
+        return 2;
+    }
+
+    ctx->limit = 0;
+    deadline_arm(ctx);
+    throttle_begin(ctx);
+    diff_level(diff, a_len, b_len, 0);
+    throttle_end(ctx);
+    ctx->limit = limit;
+    flush_output(ctx);
+
+    status = diff->status;
+    free_listing(&diff->a);
+    free_listing(&diff->b);
+    free(diff);
+    return deadline_status(ctx, status);
+}
@@ -0,0 +1,360 @@
+#include "ftls_internal.h"
+#include <math.h>
+
+/* --estimate[=DIRS]: entry, directory and byte totals of the trees -R would
+ * walk, reading at most DIRS directories. Half the budget goes to an exact
+ * breadth-first walk; if the tree fits, the totals are exact. Otherwise the
+ * rest goes to Knuth's random-path probes: from the root, descend into a
+ * uniformly chosen subdirectory until a leaf, weighting each directory's
+ * counts by the product of the fan-outs above it. Every probe is an
+ * unbiased estimate of the totals; their mean is reported with a 95%
+ * interval. Directories already read, the whole top of the tree after the
+ * first phase, are served from a cache and cost no budget. */
+
+# define ESTIMATE_MAX_PROBES 100000
+
+typedef struct
+{
+    char *path;                 /* NULL for an empty slot */
+    uint64_t entries;
+    uint64_t bytes;
+    uint32_t child_count;
+    uint32_t *child_offsets;    /* into child_names */
+    char *child_names;
+} t_estimate_dir;
+
+typedef struct
+{
+    ftls_ctx *ctx;
+    int options;
+    int budget;
+    int reads;
+    t_estimate_dir *table;      /* open addressing on the path */
+    size_t mask;
+    size_t used;
+    t_listing listing;
+    uint64_t rng;
+} t_estimator;
+
+/* Running sums of the probes, one per quantity. */
+typedef struct
+{
+    double sum[3];
+    double squares[3];
+    long probes;
+} t_estimate_stats;
+
+static const char *g_quantities[3] = { "entries    ", "directories", "bytes      " };
+
+static uint64_t hash_path(const char *path)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (; *path; path++)
+        hash = (hash ^ (unsigned char)*path) * 0x100000001b3ULL;
+    return hash;
+}
+
+static uint64_t next_random(t_estimator *est)
+{
+    est->rng ^= est->rng << 13;
+    est->rng ^= est->rng >> 7;
+    est->rng ^= est->rng << 17;
+    return est->rng;
+}
+
+static t_estimate_dir *slot_for(t_estimator *est, const char *path)
+{
+    size_t i = hash_path(path) & est->mask;
+
+    while (est->table[i].path != NULL && strcmp(est->table[i].path, path) != 0)
+        i = (i + 1) & est->mask;
+    return &est->table[i];
+}
+
+static bool table_grow(t_estimator *est)
+{
+    t_estimate_dir *old = est->table;
+    size_t old_size = old ? est->mask + 1 : 0;
+    size_t size = old_size ? old_size * 2 : 1024;
+
+    est->table = calloc(size, sizeof(t_estimate_dir));
+    if (est->table == NULL)
+    {
+        est->table = old;
+        return false;
+    }
+    est->mask = size - 1;
+    for (size_t i = 0; i < old_size; i++)
+        if (old[i].path != NULL)
+            *slot_for(est, old[i].path) = old[i];
+    free(old);
+    return true;
+}
+
+/* Whether -R would go into file, like dirs_add, without queueing it. */
+static bool descends(ftls_ctx *ctx, size_t path_len, int depth, const t_file *file)
+{
+    return walk_descends(ctx, depth, file) && path_len + file->name_len + 2 <= PATH_MAX;
+}
+
+/* Entry i of the listing, past its end the directories the filters hide,
+ * which -R goes into all the same. NULL after the last. */
+static const t_file *child_at(const t_listing *listing, int i)
+{
+    if (i < listing->count)
+        return &listing->files[i];
+    i -= listing->count;
+    return listing->hidden && i < listing->hidden->count ? &listing->hidden->files[i] : NULL;
+}
+
+/* The counts of the directory at path, depth levels below the root, read
+ * unless cached. NULL once the budget is spent or out of memory. A
+ * directory that cannot be opened is reported once and counts as empty. */
+static t_estimate_dir *estimate_read(t_estimator *est, const char *path, int depth)
+{
+    t_estimate_dir *dir;
+    DIR *stream;
+    const t_file *file;
+    size_t path_len = strlen(path);
+    size_t names_size = 0;
+    size_t names_len = 0;
+    uint32_t count = 0;
+
+    if (est->used * 2 >= est->mask + 1 && !table_grow(est))
+        return NULL;
+    dir = slot_for(est, path);
+    if (dir->path != NULL)
+        return dir;
+    if (est->reads >= est->budget || (dir->path = strdup(path)) == NULL)
+        return NULL;
+    est->used++;
+    est->reads++;
+    if (!open_directory(est->ctx, path, &stream))
+        return dir;
+
+    scan_directory(est->ctx, &est->listing, path, stream, est->options);
+    for (int i = 0; i < est->listing.count; i++)
+    {
+        dir->entries++;
+        dir->bytes += est->listing.files[i].info.st_size;
+    }
+    for (int i = 0; (file = child_at(&est->listing, i)) != NULL; i++)
+        if (descends(est->ctx, path_len, depth, file))
+        {
+            count++;
+            names_size += file->name_len + 1;
+        }
+
+    dir->child_offsets = malloc(count * sizeof(uint32_t) + 1);
+    dir->child_names = malloc(names_size + 1);
+    for (int i = 0; dir->child_offsets && dir->child_names &&
+                    (file = child_at(&est->listing, i)) != NULL; i++)
+    {
+        if (!descends(est->ctx, path_len, depth, file))
+            continue;
+        dir->child_offsets[dir->child_count++] = names_len;
+        memcpy(dir->child_names + names_len, file->name, file->name_len + 1);
+        names_len += file->name_len + 1;
+    }
+    return dir;
+}
+
+static void estimator_free(t_estimator *est)
+{
+    for (size_t i = 0; est->table && i <= est->mask; i++)
+    {
+        free(est->table[i].path);
+        free(est->table[i].child_offsets);
+        free(est->table[i].child_names);
+    }
+    free(est->table);
+    free_listing(&est->listing);
+}
+
+static t_estimate_dir *estimate_cached(t_estimator *est, const char *path)
+{
+    t_estimate_dir *dir = slot_for(est, path);
+
+    return dir->path != NULL ? dir : NULL;
+}
+
+/* Breadth-first from root until reads directories have been read. True if
+ * the whole tree was. */
+static bool estimate_walk(t_estimator *est, const char *root, int reads)
+{
+    t_dirs queue;
+    dirs_todo *todo;
+    t_estimate_dir *dir;
+    bool complete = true;
+
+    ft_list_init(&queue, sizeof(dirs_todo));
+    todo = ft_list_add_last_slot(&queue);
+    if (todo == NULL)
+        return false;
+    todo->path_len = strlen(root);
+    todo->depth = 0;
+    memcpy(todo->path, root, todo->path_len + 1);
+    while ((todo = ft_list_get_first(&queue)) != NULL)
+    {
+        dir = estimate_cached(est, todo->path);
+        if (dir == NULL && est->reads < reads)
+            dir = estimate_read(est, todo->path, todo->depth);
+        if (dir == NULL)
+        {
+            complete = false;
+            break;
+        }
+        /* A frontier beyond the budget cannot be walked anyway. */
+        if (ft_list_get_size(&queue) + dir->child_count > (size_t)est->budget)
+        {
+            complete = false;
+            break;
+        }
+        for (uint32_t i = 0; i < dir->child_count; i++)
+        {
+            const char *name = dir->child_names + dir->child_offsets[i];
+            dirs_todo *child = ft_list_add_last_slot(&queue);
+
+            if (child == NULL)
+            {
+                complete = false;
+                break;
+            }
+            child->path_len = todo->path_len + 1 + strlen(name);
+            child->depth = todo->depth + 1;
+            memcpy(child->path, todo->path, todo->path_len);
+            child->path[todo->path_len] = '/';
+            memcpy(child->path + todo->path_len + 1, name, child->path_len - todo->path_len);
+        }
+        ft_list_pop_first(&queue, NULL);
+    }
+    ft_list_destroy(&queue);
+    return complete;
+}
+
+/* One random root-to-leaf path. False, and nothing added, if the budget
+ * ran out on the way. */
+static bool estimate_probe(t_estimator *est, const char *root, t_estimate_stats *stats)
+{
+    char path[PATH_MAX];
+    size_t path_len = strlen(root);
+    double weight = 1;
+    double sample[3] = { 0, 0, 0 };
+    t_estimate_dir *dir;
+    int depth = 0;
+
+    memcpy(path, root, path_len + 1);
+    while ((dir = estimate_read(est, path, depth++)) != NULL)
+    {
+        sample[0] += weight * dir->entries;
+        sample[1] += weight * dir->child_count;
+        sample[2] += weight * dir->bytes;
+        if (dir->child_count == 0)
+            break;
+
+        const char *name = dir->child_names + dir->child_offsets[next_random(est) % dir->child_count];
+        size_t name_len = strlen(name);
+        if (path_len + name_len + 2 > PATH_MAX)
+            break;
+        weight *= dir->child_count;
+        path[path_len] = '/';
+        memcpy(path + path_len + 1, name, name_len + 1);
+        path_len += name_len + 1;
+    }
+    if (dir == NULL)
+        return false;
+    for (int i = 0; i < 3; i++)
+    {
+        stats->sum[i] += sample[i];
+        stats->squares[i] += sample[i] * sample[i];
+    }
+    stats->probes++;
+    return true;
+}
+
+static void estimate_line(ftls_ctx *ctx, int quantity, double value, double low, double high, bool exact)
+{
+    char line[160];
+    int len;
+
+    if (exact)
+        len = snprintf(line, sizeof(line), "%s  %.0f\n", g_quantities[quantity], value);
+    else
+        len = snprintf(line, sizeof(line), "%s  %.0f  [%.0f, %.0f]\n", g_quantities[quantity], value, low, high);
+    buffered_write(ctx, line, len);
+}
+
+/* Prints the estimate for the tree under root. Returns 0, or 1 if root
+ * could not be read. */
+int estimate_tree(ftls_ctx *ctx, const char *root)
+{
+    t_estimator est;
+    t_estimate_stats stats;
+    double known[3] = { 0, 0, 0 };
+    bool exact;
+    char line[PATH_MAX + 96];
+    int limit = ctx->limit;
+    int len;
+
+    memset(&est, 0, sizeof(est));
+    memset(&stats, 0, sizeof(stats));
+    est.ctx = ctx;
+    est.options = (ctx->flags & FLAG_a) | FLAG_STAT | FLAG_f;
+    est.budget = ctx->estimate_budget;
+    est.rng = ((uint64_t)getpid() << 32 ^ (uint64_t)time(NULL)) | 1;
+    ctx->limit = 0;
+    walk_begin(ctx, root);
+
+    /* A root that cannot be opened is cached without children. */
+    if (strlen(root) >= PATH_MAX || !table_grow(&est) || estimate_read(&est, root, 0) == NULL ||
+        estimate_cached(&est, root)->child_offsets == NULL)
+    {
+        ctx->limit = limit;
+        estimator_free(&est);
+        return 1;
+    }
+    exact = estimate_walk(&est, root, (est.budget + 1) / 2);
+    while (!exact && stats.probes < ESTIMATE_MAX_PROBES && estimate_probe(&est, root, &stats))
+        ;
+    /* The probes may have read what the walk left. */
+    if (!exact)
+        exact = estimate_walk(&est, root, est.reads);
+    ctx->limit = limit;
+
+    /* What was read is a floor for the totals. */
+    for (size_t i = 0; i <= est.mask; i++)
+    {
+        if (est.table[i].path == NULL)
+            continue;
+        known[0] += est.table[i].entries;
+        known[1] += est.table[i].child_count;
+        known[2] += est.table[i].bytes;
+    }
+
+    if (exact || stats.probes < 2)
+        len = snprintf(line, sizeof(line), "%s: %s, %d directories read\n", root,
+                       exact ? "exact" : "too few probes, lower bounds", est.reads);
+    else
+        len = snprintf(line, sizeof(line), "%s: %ld probes, %d directories read, 95%% intervals\n",
+                       root, stats.probes, est.reads);
+    buffered_write(ctx, line, len);
+    for (int i = 0; i < 3; i++)
+    {
+        double n = stats.probes;
+        double mean;
+        double spread;
+
+        if (exact || stats.probes < 2)
+        {
+            estimate_line(ctx, i, known[i], 0, 0, true);
+            continue;
+        }
+        mean = stats.sum[i] / n;
+        spread = 1.96 * sqrt(fmax(0, (stats.squares[i] - n * mean * mean) / (n - 1)) / n);
+        estimate_line(ctx, i, fmax(mean, known[i]), fmax(mean - spread, known[i]),
+                      fmax(mean + spread, known[i]), false);
+    }
+    estimator_free(&est);
+    return 0;
+}
@@ -0,0 +1,388 @@
+#include "ftls_internal.h"
+#include <fnmatch.h>
+#include <pwd.h>
+#include <grp.h>
+#include <time.h>
+
+bool parse_count(const char *value, int *out)
+{
+    long n = 0;
+
+    if (*value == '\0')
+        return false;
+    for (; *value; value++)
+    {
+        if (*value < '0' || *value > '9')
+            return false;
+        n = n * 10 + (*value - '0');
+        /* Below INT_MAX, so --head/--tail can keep count + 1 slots. */
+        if (n >= INT_MAX)
+            return false;
+    }
+    *out = (int)n;
+    return true;
+}
+
+static bool is_glob_special(char c)
+{
+    return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+static bool has_glob_special(const char *str, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        if (is_glob_special(str[i]))
+            return true;
+    return false;
+}
+
+static bool compile_pattern(t_pattern_set *set, const char *pattern, bool regex)
+{
+    if (set->count == set->capacity)
+    {
+        set->capacity = set->capacity == 0 ? 8 : set->capacity * 2;
+        set->items = realloc(set->items, set->capacity * sizeof(t_pattern));
+    }
+
+    t_pattern *p = &set->items[set->count];
+    size_t len = strlen(pattern);
+
+    p->source = strdup(pattern);
+    pattern = p->source;
+    p->text = pattern;
+    p->len = len;
+    if (regex)
+    {
+        if (regcomp(&p->regex, pattern, REG_EXTENDED | REG_NOSUB) != 0)
+        {
+            free(p->source);
+            return false;
+        }
+        p->kind = MATCH_REGEX;
+    }
+    else if (!has_glob_special(pattern, len))
+        p->kind = MATCH_LITERAL;
+    else if (len > 1 && pattern[0] == '*' && pattern[len - 1] == '*' && !has_glob_special(pattern + 1, len - 2))
+    {
+        p->kind = MATCH_SUBSTRING;
+        p->text = pattern + 1;
+        p->len = len - 2;
+    }
+    else if (pattern[0] == '*' && !has_glob_special(pattern + 1, len - 1))
+    {
+        p->kind = MATCH_SUFFIX;
+        p->text = pattern + 1;
+        p->len = len - 1;
+    }
+    else if (pattern[len - 1] == '*' && !has_glob_special(pattern, len - 1))
+    {
+        p->kind = MATCH_PREFIX;
+        p->len = len - 1;
+    }
+    else
+        p->kind = MATCH_GLOB;
+
+    set->count++;
+    return true;
+}
+
+static bool pattern_matches(const t_pattern *p, const char *name, size_t name_len)
+{
+    switch (p->kind)
+    {
+        case MATCH_LITERAL:
+            return name_len == p->len && memcmp(name, p->text, name_len) == 0;
+        case MATCH_PREFIX:
+            return name_len >= p->len && memcmp(name, p->text, p->len) == 0;
+        case MATCH_SUFFIX:
+            return name_len >= p->len && memcmp(name + name_len - p->len, p->text, p->len) == 0;
+        case MATCH_SUBSTRING:
+            return memmem(name, name_len, p->text, p->len) != NULL;
+        case MATCH_GLOB:
+            return fnmatch(p->text, name, 0) == 0;
+        case MATCH_REGEX:
+            return regexec(&p->regex, name, 0, NULL, 0) == 0;
+    }
+    return false;
+}
+
+static bool pattern_set_matches(const t_pattern_set *set, const char *name, size_t name_len)
+{
+    for (int i = 0; i < set->count; i++)
+        if (pattern_matches(&set->items[i], name, name_len))
+            return true;
+    return false;
+}
+
+static void free_pattern_set(t_pattern_set *set)
+{
+    for (int i = 0; i < set->count; i++)
+    {
+        if (set->items[i].kind == MATCH_REGEX)
+            regfree(&set->items[i].regex);
+        free(set->items[i].source);
+    }
+    free(set->items);
+}
+
+void free_filter(t_filter *filter)
+{
+    free_pattern_set(&filter->include);
+    free_pattern_set(&filter->exclude);
+    free_pattern_set(&filter->prune);
+}
+
+static bool copy_pattern_set(t_pattern_set *dst, const t_pattern_set *src)
+{
+    for (int i = 0; i < src->count; i++)
+        if (!compile_pattern(dst, src->items[i].source, src->items[i].kind == MATCH_REGEX))
+            return false;
+    return true;
+}
+
+/* A copy owning its patterns, regexes compiled anew: the --deadline helper
+ * filters with one that outlives the context's. On failure dst is left
+ * empty, which filters nothing. */
+bool filter_copy(t_filter *dst, const t_filter *src)
+{
+    *dst = *src;
+    memset(&dst->include, 0, sizeof(dst->include));
+    memset(&dst->exclude, 0, sizeof(dst->exclude));
+    memset(&dst->prune, 0, sizeof(dst->prune));
+    if (copy_pattern_set(&dst->include, &src->include) &&
+        copy_pattern_set(&dst->exclude, &src->exclude) &&
+        copy_pattern_set(&dst->prune, &src->prune))
+        return true;
+    free_filter(dst);
+    memset(dst, 0, sizeof(*dst));
+    return false;
+}
+
+bool filter_needs_stat(const t_filter *filter)
+{
+    return filter->has_min_size || filter->has_max_size || filter->has_newer ||
+           filter->has_older || filter->has_uid || filter->has_gid;
+}
+
+/* Anything that must run on d_name before the entry is stat'ed. */
+bool filter_active(const t_filter *filter)
+{
+    return filter->include.count || filter->exclude.count || filter->type_mask;
+}
+
+bool filter_pruned(const t_filter *filter, const char *name, size_t name_len)
+{
+    return filter->prune.count && pattern_set_matches(&filter->prune, name, name_len);
+}
+
+/* With -R directories pass --include, --type and the metadata predicates
+ * so the walk can still reach matching entries below them; --exclude and
+ * --prune are what cut subtrees. filter_shown then says whether one is
+ * also listed. */
+static bool filter_keep_dir(unsigned char d_type, int options)
+{
+    return (options & FLAG_R) && d_type == DT_DIR;
+}
+
+/* Applied to the raw dirent before any stat. DT_UNKNOWN entries that need a
+ * type decision are let through and settled by filter_stat. */
+bool filter_name(const t_filter *filter, const char *name, size_t name_len, unsigned char d_type, int options)
+{
+    if (filter->exclude.count && pattern_set_matches(&filter->exclude, name, name_len))
+        return false;
+    if (filter_keep_dir(d_type, options))
+        return true;
+    if (filter->include.count && d_type != DT_UNKNOWN && !pattern_set_matches(&filter->include, name, name_len))
+        return false;
+    if (filter->type_mask && d_type != DT_UNKNOWN && !(filter->type_mask & (1u << d_type)))
+        return false;
+    return true;
+}
+
+bool filter_stat(const t_filter *filter, const char *name, size_t name_len, unsigned char d_type,
+                 const struct stat *st, int options)
+{
+    unsigned char type = IFTODT(st->st_mode);
+
+    if (filter_keep_dir(type, options))
+        return true;
+    if (d_type == DT_UNKNOWN)
+    {
+        if (filter->include.count && !pattern_set_matches(&filter->include, name, name_len))
+            return false;
+        if (filter->type_mask && !(filter->type_mask & (1u << type)))
+            return false;
+    }
+    if (filter->has_min_size && st->st_size < filter->min_size)
+        return false;
+    if (filter->has_max_size && st->st_size > filter->max_size)
+        return false;
+    if (filter->has_newer && st->st_mtime < filter->newer)
+        return false;
+    if (filter->has_older && st->st_mtime > filter->older)
+        return false;
+    if (filter->has_uid && st->st_uid != filter->uid)
+        return false;
+    if (filter->has_gid && st->st_gid != filter->gid)
+        return false;
+    return true;
+}
+
+/* Whether a directory filter_stat kept for -R also matches the filters
+ * that let it through, and so is listed rather than only walked. Without
+ * -R and a d_type, filter_stat runs every check. */
+bool filter_shown(const t_filter *filter, const char *name, size_t name_len, const struct stat *st)
+{
+    return filter_stat(filter, name, name_len, DT_UNKNOWN, st, 0);
+}
+
+bool parse_size(const char *value, off_t *out)
+{
+    off_t n = 0;
+
+    if (*value < '0' || *value > '9')
+        return false;
+    for (; *value >= '0' && *value <= '9'; value++)
+        n = n * 10 + (*value - '0');
+    switch (*value)
+    {
+        case 'T': n <<= 10; /* fall through */
+        case 'G': n <<= 10; /* fall through */
+        case 'M': n <<= 10; /* fall through */
+        case 'K': n <<= 10; value++; break;
+        default: break;
+    }
+    *out = n;
+    return *value == '\0';
+}
+
+/* "@EPOCH" is an absolute time, "N[smhdw]" an age relative to now. */
+static bool parse_time(const char *value, time_t *out)
+{
+    bool absolute = (*value == '@');
+    long n = 0;
+
+    if (absolute)
+        value++;
+    if (*value < '0' || *value > '9')
+        return false;
+    for (; *value >= '0' && *value <= '9'; value++)
+        n = n * 10 + (*value - '0');
+    if (absolute)
+    {
+        *out = n;
+        return *value == '\0';
+    }
+    switch (*value)
+    {
+        case 'w': n *= 7; /* fall through */
+        case 'd': n *= 24; /* fall through */
+        case 'h': n *= 60; /* fall through */
+        case 'm': n *= 60; /* fall through */
+        case 's': value++; break;
+        case '\0': break;
+        default: return false;
+    }
+    *out = time(NULL) - n;
+    return *value == '\0';
+}
+
+static bool parse_type_mask(const char *value, unsigned int *out)
+{
+    *out = 0;
+    for (; *value; value++)
+    {
+        switch (*value)
+        {
+            case 'f': *out |= 1u << DT_REG; break;
+            case 'd': *out |= 1u << DT_DIR; break;
+            case 'l': *out |= 1u << DT_LNK; break;
+            case 'p': *out |= 1u << DT_FIFO; break;
+            case 's': *out |= 1u << DT_SOCK; break;
+            case 'c': *out |= 1u << DT_CHR; break;
+            case 'b': *out |= 1u << DT_BLK; break;
+            case ',': break;
+            default: return false;
+        }
+    }
+    return *out != 0;
+}
+
+static bool parse_owner(const char *value, bool is_group, unsigned int *out)
+{
+    int id;
+    char buffer[NSS_BUFFER_SIZE];
+
+    if (parse_count(value, &id))
+    {
+        *out = (unsigned int)id;
+        return true;
+    }
+    if (is_group)
+    {
+        struct group gr_buf;
+        struct group *gr = NULL;
+        getgrnam_r(value, &gr_buf, buffer, sizeof(buffer), &gr);
+        if (gr)
+            *out = gr->gr_gid;
+        return gr != NULL;
+    }
+    struct passwd pw_buf;
+    struct passwd *pw = NULL;
+    getpwnam_r(value, &pw_buf, buffer, sizeof(buffer), &pw);
+    if (pw)
+        *out = pw->pw_uid;
+    return pw != NULL;
+}
+
+static const char *const g_filter_options[] = {
+    "include", "exclude", "prune", "include-regex", "exclude-regex", "min-size", "max-size",
+    "newer", "older", "type", "user", "group", NULL
+};
+
+bool filter_option_known(const char *name)
+{
+    for (int i = 0; g_filter_options[i]; i++)
+    {
+        if (strcmp(name, g_filter_options[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Handles the filter options of ftls_set_option. Returns false if `name`
+ * is not a filter option; *status tells whether `value` was accepted. */
+bool filter_set_option(t_filter *filter, const char *name, const char *value, int *status)
+{
+    bool ok;
+
+    if (strcmp(name, "include") == 0)
+        ok = compile_pattern(&filter->include, value, false);
+    else if (strcmp(name, "exclude") == 0)
+        ok = compile_pattern(&filter->exclude, value, false);
+    else if (strcmp(name, "prune") == 0)
+        ok = compile_pattern(&filter->prune, value, false);
+    else if (strcmp(name, "include-regex") == 0)
+        ok = compile_pattern(&filter->include, value, true);
+    else if (strcmp(name, "exclude-regex") == 0)
+        ok = compile_pattern(&filter->exclude, value, true);
+    else if (strcmp(name, "min-size") == 0)
+        ok = filter->has_min_size = parse_size(value, &filter->min_size);
+    else if (strcmp(name, "max-size") == 0)
+        ok = filter->has_max_size = parse_size(value, &filter->max_size);
+    else if (strcmp(name, "newer") == 0)
+        ok = filter->has_newer = parse_time(value, &filter->newer);
+    else if (strcmp(name, "older") == 0)
+        ok = filter->has_older = parse_time(value, &filter->older);
+    else if (strcmp(name, "type") == 0)
+        ok = parse_type_mask(value, &filter->type_mask);
+    else if (strcmp(name, "user") == 0)
+        ok = filter->has_uid = parse_owner(value, false, &filter->uid);
+    else if (strcmp(name, "group") == 0)
+        ok = filter->has_gid = parse_owner(value, true, &filter->gid);
+    else
+        return false;
+
+    *status = ok ? FTLS_OK : FTLS_EINVAL;
+    return true;
+}
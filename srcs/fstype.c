@@ -0,0 +1,82 @@
+#include "ftls_internal.h"
+#include <sys/vfs.h>
+
+/* What kind of filesystem a directory is on, looked up with fstatfs once
+ * per device and kept in a small table in the context. The kind picks
+ * the strategy where it matters:
+ *
+ *   remote     stat and read latency dominate: --checksum uses its full
+ *              pool of threads
+ *   diskless   nothing to protect or wait for: --max-iops and friends do
+ *              not apply, and on one CPU -R is not pipelined
+ *   synthetic  contents are generated on read (procfs, sysfs...): sizes
+ *              mean nothing and --checksum does not read the files
+ *   inode_order inode numbers follow the layout on disk: large
+ *              directories are stat'ed in inode order, see prestat.c
+ *
+ * The table is only used by the scanning thread. */
+
+/* f_type values from linux/magic.h. */
+static const t_fs_type g_fs_types[] = {
+    { "ext4",       0xEF53,     false, false, false, true  },
+    { "xfs",        0x58465342, false, false, false, true  },
+    { "btrfs",      0x9123683E, false, false, false, true  },
+    { "overlay",    0x794C7630, false, false, false, false },
+    { "tmpfs",      0x01021994, false, true,  false, false },
+    { "ramfs",      0x858458F6, false, true,  false, false },
+    { "nfs",        0x6969,     true,  false, false, false },
+    { "smb2",       0xFE534D42, true,  false, false, false },
+    { "cifs",       0xFF534D42, true,  false, false, false },
+    { "ceph",       0x00C36400, true,  false, false, false },
+    { "fuse",       0x65735546, true,  false, false, false },
+    { "afs",        0x6B414653, true,  false, false, false },
+    { "proc",       0x9FA0,     false, true,  true,  false },
+    { "sysfs",      0x62656572, false, true,  true,  false },
+    { "debugfs",    0x64626720, false, true,  true,  false },
+    { "tracefs",    0x74726163, false, true,  true,  false },
+    { "cgroup2",    0x63677270, false, true,  true,  false },
+    { "cgroup",     0x0027E0EB, false, true,  true,  false },
+    { "devpts",     0x1CD1,     false, true,  true,  false },
+    { "securityfs", 0x73636673, false, true,  true,  false },
+    { "configfs",   0x62656570, false, true,  true,  false },
+    { "bpf",        0xCAFE4A11, false, true,  true,  false },
+    { "pstore",     0x6165676C, false, true,  true,  false },
+    { "efivarfs",   0xDE5E81E4, false, true,  true,  false },
+};
+
+/* Anything else is treated as a local disk, like before the table. */
+static const t_fs_type g_fs_default = { "other", 0, false, false, false, true };
+
+static const t_fs_type *fs_type_for_magic(unsigned long magic)
+{
+    for (size_t i = 0; i < sizeof(g_fs_types) / sizeof(g_fs_types[0]); i++)
+        if (g_fs_types[i].magic == (magic & 0xFFFFFFFFUL))
+            return &g_fs_types[i];
+    return &g_fs_default;
+}
+
+/* The kind of filesystem the open directory fd is on. Costs an fstat,
+ * and an fstatfs the first time a device is seen. Under --deadline
+ * nothing is looked up: either call can hang on the very filesystems
+ * the deadline is for. */
+const t_fs_type *fs_type_of(ftls_ctx *ctx, int fd)
+{
+    struct stat st;
+    struct statfs fs;
+    t_fs_cache_entry *entry;
+
+    if (fd == -1 || ctx->deadline_ms > 0 || fstat(fd, &st) == -1)
+        return &g_fs_default;
+    for (int i = 0; i < ctx->fs_cache_count; i++)
+        if (ctx->fs_cache[i].dev == st.st_dev)
+            return ctx->fs_cache[i].type;
+
+    /* Past FS_CACHE_SIZE devices the oldest entry goes. */
+    entry = &ctx->fs_cache[ctx->fs_cache_next];
+    ctx->fs_cache_next = (ctx->fs_cache_next + 1) % FS_CACHE_SIZE;
+    if (ctx->fs_cache_count < FS_CACHE_SIZE)
+        ctx->fs_cache_count++;
+    entry->dev = st.st_dev;
+    entry->type = fstatfs(fd, &fs) == 0 ? fs_type_for_magic(fs.f_type) : &g_fs_default;
+    return entry->type;
+}
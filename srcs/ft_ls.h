@@ -0,0 +1,22 @@
+#ifndef FT_LS_H
+# define FT_LS_H
+
+# include <libftls.h>
+
+typedef enum
+{
+    false,
+    true
+} bool;
+
+/* --diff: handled by main, never passed to the library. */
+# define FLAG_DIFF 0x20000000
+
+/* ft_ls.c */
+int parse_args(ftls_ctx *ctx, int argc, char** argv, const char **paths, int *path_count);
+
+/* daemon.c */
+int serve(const char *socket_path);
+int client(const char *socket_path, int argc, char **argv);
+
+#endif
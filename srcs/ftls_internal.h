@@ -0,0 +1,538 @@
+#ifndef FTLS_INTERNAL_H
+# define FTLS_INTERNAL_H
+
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+# endif
+
+# include <stdio.h>
+# include <string.h>
+# include <dirent.h>
+# include <sys/stat.h>
+# include <limits.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <errno.h>
+# include <unistd.h>
+# include <regex.h>
+# include <time.h>
+# include <libftls.h>
+# include <ft_list.h>
+
+# define FLAG_l FTLS_LONG      /* long format */
+# define FLAG_R FTLS_RECURSIVE /* recursive */
+# define FLAG_a FTLS_ALL       /* show hidden files */
+# define FLAG_r FTLS_REVERSE   /* reverse order */
+# define FLAG_t FTLS_SORT_TIME /* sort by modification time */
+# define FLAG_f FTLS_UNSORTED  /* display files without order, just as i encounter them */
+# define FLAG_g FTLS_NO_OWNER  /* display files without owner */
+# define FLAG_d FTLS_DIRECTORY /* list directories themselves, not their contents */
+# define FLAG_u FTLS_ATIME     /* use time of last access */
+# define FLAG_c FTLS_CTIME     /* use time of last modification of the inode */
+# define FLAG_S FTLS_SORT_SIZE /* sort by file size, largest first */
+# define FLAG_x FTLS_ONE_FS    /* stay on the filesystem of each operand */
+# define FLAG_XATTR FTLS_XATTR /* -@: mark files with ACLs or extended attributes */
+
+/* Internal: stat every entry even when no listing flag needs it. */
+# define FLAG_STAT 0x40000000
+/* Internal: the scan may spill sorted runs to disk under --max-memory. */
+# define FLAG_SPILL 0x10000000
+/* Internal: hash regular files under --checksum even without -l. */
+# define FLAG_CHECKSUM 0x08000000
+
+# define BUFFER_SIZE 1024
+# define OUTPUT_BUFFER_SIZE 8192
+# define NSS_BUFFER_SIZE 4096   /* getpwuid_r & co. scratch space */
+
+typedef enum
+{
+    false,
+    true
+} bool;
+
+static int ignore_write __attribute__((unused));
+
+# define write(fd, str, len) do { ignore_write = write(fd, str, len); } while (0)
+
+typedef enum
+{
+    CHECKSUM_NONE,
+    CHECKSUM_XXH64,
+    CHECKSUM_CRC32C
+} checksum_kind;
+
+typedef enum
+{
+    PIPELINE_AUTO,              /* where there is I/O to overlap, see list_pipelined */
+    PIPELINE_ALWAYS,
+    PIPELINE_NEVER
+} pipeline_mode;
+
+/* How names are written, see quote.c. */
+typedef enum
+{
+    QUOTE_LITERAL,              /* as they are, or '?' for -q */
+    QUOTE_ESCAPE,               /* -b: backslash escapes */
+    QUOTE_C                     /* -Q: escapes inside double quotes */
+} quoting_style;
+
+typedef enum
+{
+    CHECKSUM_STATE_NONE,        /* not hashed: not a regular file */
+    CHECKSUM_STATE_OK,
+    CHECKSUM_STATE_FAILED       /* could not be read */
+} checksum_state;
+
+typedef struct t_file
+{
+    char name[PATH_MAX];
+    size_t name_len;
+    uint64_t sort_prefix;       /* first 8 collation key bytes, big-endian */
+    const char *sort_key;       /* strxfrm key in the listing arena, NULL in the C locale */
+    size_t sort_key_len;
+    struct stat info;
+    const char *owner;          /* resolved while scanning in -l mode */
+    const char *group;
+    unsigned short owner_len;
+    unsigned short group_len;
+    char link_target[PATH_MAX];
+    size_t link_len;
+    uint64_t checksum;          /* --checksum, valid once the listing is waited for */
+    unsigned char checksum_state;
+    char xattr;                 /* -@ mark, valid once the listing is waited for */
+    bool unresolved;            /* --deadline passed before it was stat'ed */
+} t_file;
+
+/* The fields the listing order looks at, for entries that are not held
+ * in a t_file: see compare_views. name is NUL-terminated. */
+typedef struct
+{
+    const struct stat *info;
+    uint64_t sort_prefix;
+    const char *sort_key;
+    size_t sort_key_len;
+    const char *name;
+    size_t name_len;
+} t_sort_view;
+
+typedef struct dirs
+{
+    char path[PATH_MAX];
+    size_t path_len;
+    int depth;                  /* levels below the operand */
+} dirs_todo;
+
+/* Subdirectories queued for -R, a deque of dirs_todo. */
+typedef ft_list_t t_dirs;
+
+/* One level of the -R walk: the subdirectories left to list, the first
+ * of them being listed while there is a level below. The levels are
+ * linked from the innermost, ctx->walk_top, for --checkpoint. */
+typedef struct t_walk_level
+{
+    t_dirs dirs;
+    struct t_walk_level *up;
+} t_walk_level;
+
+/* Cached names are heap copies so t_file can point at them even after the
+ * cache array itself is grown. */
+typedef struct {
+    uid_t uid;
+    const char *name;
+    size_t len;
+} uid_cache_entry;
+
+typedef struct {
+    gid_t gid;
+    const char *name;
+    size_t len;
+} gid_cache_entry;
+
+/* Column widths of the -l output, grown as entries are scanned. */
+typedef struct {
+    int link;
+    int owner;
+    int group;
+    int size;
+} t_widths;
+
+/* Bump allocator for per-directory data. Chunks are kept across
+ * arena_reset so steady-state listing does not touch malloc. */
+# define ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct arena_chunk
+{
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_chunk;
+
+typedef struct
+{
+    arena_chunk *first;
+    arena_chunk *current;
+} t_arena;
+
+/* A kind of filesystem, see fstype.c. */
+typedef struct
+{
+    const char *name;
+    unsigned long magic;        /* statfs f_type */
+    bool remote;                /* latency-bound: overlap I/O even on one CPU */
+    bool diskless;              /* no device to protect from the crawl */
+    bool synthetic;             /* contents generated on read, sizes meaningless */
+    bool inode_order;           /* inode numbers follow the disk layout */
+} t_fs_type;
+
+# define FS_CACHE_SIZE 8
+
+typedef struct
+{
+    dev_t dev;
+    const t_fs_type *type;
+} t_fs_cache_entry;
+
+typedef struct t_spill t_spill;
+typedef struct t_hasher t_hasher;
+typedef struct t_xattr_cache t_xattr_cache;
+typedef struct t_checksum_batch t_checksum_batch;
+typedef struct t_io_helper t_io_helper;
+typedef struct t_collected t_collected;
+typedef struct t_snapshot t_snapshot;
+typedef struct t_snapshot_entry t_snapshot_entry;
+typedef struct t_throttle t_throttle;
+typedef struct t_prestat t_prestat;
+typedef struct t_resume t_resume;
+
+/* scan_directory's position in a snapshot directory. */
+typedef struct
+{
+    const t_snapshot *snapshot;
+    uint64_t next;
+    uint64_t end;
+    const t_snapshot_entry *current;
+    struct dirent entry;
+} t_snapshot_cursor;
+
+/* A --head/--tail heap slot's strxfrm key, reused by whoever takes the slot. */
+typedef struct
+{
+    char *data;
+    size_t size;
+} t_slot_key;
+
+/* The entries of one scanned directory. With --max-memory a large
+ * directory is left in `spill` as sorted runs and `count` is 0. Under
+ * --checksum or -@ the files may still be read: see checksum_wait. Under
+ * -R the directories the filters leave out are kept, sorted, in `hidden`
+ * for the walk alone: see walk_add_dirs. */
+typedef struct t_listing
+{
+    t_file *files;
+    int count;
+    int capacity;
+    size_t max_len;
+    t_widths widths;
+    t_arena keys;
+    t_slot_key *slot_keys;      /* limit + 1 of them under --head/--tail */
+    int slot_key_count;
+    t_spill *spill;
+    t_checksum_batch *checksums;
+    t_hasher *hasher;
+    struct t_listing *hidden;
+} t_listing;
+
+/* Name patterns are classified once at startup so the common shapes
+ * ("*.log", "tmp*", "core") never reach fnmatch/regexec in the scan loop. */
+typedef enum
+{
+    MATCH_LITERAL,
+    MATCH_PREFIX,
+    MATCH_SUFFIX,
+    MATCH_SUBSTRING,
+    MATCH_GLOB,
+    MATCH_REGEX
+} match_kind;
+
+typedef struct
+{
+    match_kind kind;
+    char *source;
+    const char *text;
+    size_t len;
+    regex_t regex;
+} t_pattern;
+
+typedef struct
+{
+    t_pattern *items;
+    int count;
+    int capacity;
+} t_pattern_set;
+
+typedef struct
+{
+    t_pattern_set include;
+    t_pattern_set exclude;
+    t_pattern_set prune;
+    unsigned int type_mask;     /* bit (1 << DT_*) per accepted type, 0 = any */
+    bool has_min_size;
+    bool has_max_size;
+    bool has_newer;
+    bool has_older;
+    bool has_uid;
+    bool has_gid;
+    off_t min_size;
+    off_t max_size;
+    time_t newer;
+    time_t older;
+    uid_t uid;
+    gid_t gid;
+} t_filter;
+
+typedef enum
+{
+    COLOR_FILE,
+    COLOR_DIR,
+    COLOR_LINK,
+    COLOR_FIFO,
+    COLOR_SOCK,
+    COLOR_BLK,
+    COLOR_CHR,
+    COLOR_EXEC,
+    COLOR_SETUID,
+    COLOR_SETGID,
+    COLOR_STICKY_OTHER_WRITABLE,
+    COLOR_OTHER_WRITABLE,
+    COLOR_STICKY,
+    COLOR_COUNT
+} color_type;
+
+typedef struct
+{
+    const char *code;
+    size_t len;
+} t_color;
+
+typedef struct
+{
+    const char *suffix;
+    size_t suffix_len;
+    t_color color;
+    int order;                  /* position in LS_COLORS: the last match wins */
+} t_suffix_color;
+
+typedef struct
+{
+    char *spec;
+    t_color types[COLOR_COUNT];
+    t_suffix_color *ext_table;
+    uint32_t ext_mask;
+    uint32_t ext_seed;
+    t_suffix_color *suffixes;
+    int suffix_count;
+} t_colors;
+
+struct ftls_ctx
+{
+    int flags;
+    int limit;                  /* --head/--tail N, 0 = everything */
+    size_t max_memory;          /* --max-memory, 0 = unbounded */
+    bool limit_tail;
+    bool color;
+    bool collate_bytewise;
+    checksum_kind checksum;
+    quoting_style quoting;      /* --quoting-style, -b, -Q */
+    bool hide_control;          /* -q: nonprintable characters shown as '?' */
+    int ws_cols;
+    int out_fd;
+    int err_fd;
+    int cwd_fd;                 /* relative operands are resolved here */
+    int deadline_ms;            /* --deadline, 0 = none */
+    bool deadline_hit;
+    struct timespec deadline_at; /* CLOCK_MONOTONIC, set by deadline_arm */
+    t_io_helper *io;
+    t_snapshot *snapshot;       /* --snapshot-read: listings come from here */
+    char *snapshot_out;         /* --snapshot-write: ftls_list records to here */
+    char *files_from;           /* --files0-from: ftls_list reads its operands from here */
+    int estimate_budget;        /* --estimate: directories to read, 0 = off */
+    int max_depth;              /* --max-depth, -1 = unlimited */
+    int min_depth;              /* --min-depth: shallower directories are walked, not shown */
+    dev_t root_dev;             /* -x: the operand's filesystem, see walk_begin */
+    bool block_shown;           /* -R: the next directory header needs a blank line */
+    int max_iops;               /* --max-iops, 0 = unlimited */
+    int max_dirs_per_sec;       /* --max-dirs-per-sec, 0 = unlimited */
+    int throttle_latency_us;    /* --throttle-latency, 0 = fixed rates */
+    bool idle_io;               /* --idle-io */
+    pipeline_mode pipeline;     /* --pipeline: -R scans on a thread ahead of the output */
+    t_throttle *throttle;       /* set up by throttle_begin when any of the above is */
+    t_fs_cache_entry fs_cache[FS_CACHE_SIZE]; /* filesystem kind by device */
+    int fs_cache_count;
+    int fs_cache_next;
+    t_prestat *prestat;         /* inode-ordered stat buffers, see prestat.c */
+    char *checkpoint_out;       /* --checkpoint: -R saves where it is here */
+    int checkpoint_interval;    /* --checkpoint-interval, seconds */
+    int64_t checkpoint_at;      /* CLOCK_MONOTONIC ns when the next one is due */
+    t_resume *resume;           /* --resume: where a checkpointed run stopped */
+    int walk_operand;           /* index of the operand being listed */
+    const char *walk_root;      /* and its path */
+    t_walk_level *walk_top;     /* innermost level of the -R walk */
+
+    t_filter filter;
+    t_colors colors;
+    t_listing listing;
+    t_hasher *hasher;           /* --checksum and -@ pool, started on first use */
+
+    uid_cache_entry *uid_cache;
+    size_t uid_cache_count;
+    size_t uid_cache_capacity;
+    size_t uid_cache_last;
+    gid_cache_entry *gid_cache;
+    size_t gid_cache_count;
+    size_t gid_cache_capacity;
+    size_t gid_cache_last;
+
+    time_t cached_minute;
+    char cached_time[13];
+
+    char output_buffer[OUTPUT_BUFFER_SIZE];
+    int output_index;
+    uint64_t output_offset;     /* bytes flushed to out_fd, for --checkpoint */
+    bool output_failed;         /* a write to out_fd failed: no more checkpoints */
+};
+
+struct ftls_iter
+{
+    ftls_ctx *ctx;
+    t_listing listing;
+    int position;
+};
+
+/* libftls.c */
+void buffered_write(ftls_ctx *ctx, const char *data, size_t len);
+void flush_output(ftls_ctx *ctx);
+void report_error(ftls_ctx *ctx, const char *what, const char *path, int err);
+bool open_directory(ftls_ctx *ctx, const char *path, DIR **dir);
+void scan_directory(ftls_ctx *ctx, t_listing *listing, const char *path, DIR *dir, int options);
+void free_listing(t_listing *listing);
+int compare_files(const void *a, const void *b, int flags);
+int compare_views(const t_sort_view *a, const t_sort_view *b, int flags);
+void walk_begin(ftls_ctx *ctx, const char *root);
+bool walk_descends(const ftls_ctx *ctx, int depth, const t_file *file);
+bool walk_shown(const ftls_ctx *ctx, int options, int depth);
+void walk_header(ftls_ctx *ctx, const char *path, size_t path_len, int depth);
+void dirs_add(ftls_ctx *ctx, t_dirs *dirs, const char *path, size_t path_len, int depth, const t_file *file);
+void dirs_add_hidden(ftls_ctx *ctx, t_dirs *dirs, const char *path, size_t path_len, int depth,
+                     const t_listing *listing, int *next, const t_file *file, int options);
+void dirs_add_listing(ftls_ctx *ctx, t_dirs *dirs, const char *path, size_t path_len, int depth,
+                      const t_listing *listing, int options);
+void walk_queued(ftls_ctx *ctx, t_walk_level *level, int options);
+
+/* checksum.c */
+bool checksum_parse(const char *value, checksum_kind *kind);
+int checksum_width(checksum_kind kind);
+void checksum_start(ftls_ctx *ctx, t_listing *listing, int dir_fd, int count, bool xattrs);
+void checksum_wait(t_listing *listing);
+void checksum_stop(t_hasher *hasher);
+
+/* deadline.c */
+void deadline_arm(ftls_ctx *ctx);
+bool deadline_passed(ftls_ctx *ctx);
+int deadline_status(ftls_ctx *ctx, int status);
+void deadline_free(ftls_ctx *ctx);
+int deadline_open(ftls_ctx *ctx, const char *path, bool *accessible);
+t_collected *deadline_collect(ftls_ctx *ctx, DIR *dir, int options, bool need_stat, bool type_filter);
+struct dirent *collected_next(t_collected *collected);
+int collected_stat(t_collected *collected, struct stat *st);
+ssize_t collected_readlink(t_collected *collected, char *buffer, size_t size);
+void collected_free(t_collected *collected);
+
+/* checkpoint.c */
+# define CHECKPOINT_INTERVAL 60
+bool checkpoint_load(ftls_ctx *ctx, const char *file);
+void checkpoint_free(ftls_ctx *ctx);
+void checkpoint_begin(ftls_ctx *ctx);
+void checkpoint_tick(ftls_ctx *ctx);
+void checkpoint_finish(ftls_ctx *ctx);
+int checkpoint_resume(ftls_ctx *ctx, const char *const *paths, int count, bool *first);
+
+/* xattr.c */
+t_xattr_cache *xattr_cache_new(void);
+bool xattr_cached(t_xattr_cache *cache, const struct stat *st, char *mark);
+void xattr_remember(t_xattr_cache *cache, const struct stat *st, char mark, bool unsupported);
+char xattr_mark(int dir_fd, const char *name, bool *unsupported);
+
+/* quote.c; quote_special writes at most QUOTE_SPECIAL_MAX bytes. */
+# define QUOTE_SPECIAL_MAX MB_LEN_MAX
+bool quote_parse(const char *value, quoting_style *style);
+bool quote_active(const ftls_ctx *ctx);
+size_t quote_plain(const ftls_ctx *ctx, const char *name, size_t len);
+size_t quote_special(const ftls_ctx *ctx, const char *name, size_t len, char *out, size_t *out_len,
+                     size_t *width);
+size_t quote_width(const ftls_ctx *ctx, const char *name, size_t len);
+void quote_write(ftls_ctx *ctx, const char *name, size_t len);
+
+/* estimate.c */
+int estimate_tree(ftls_ctx *ctx, const char *root);
+
+/* fstype.c */
+const t_fs_type *fs_type_of(ftls_ctx *ctx, int fd);
+
+/* prestat.c */
+t_prestat *prestat_begin(ftls_ctx *ctx, DIR *dir, int options, const t_fs_type *fs, t_throttle *throttle);
+struct dirent *prestat_next(t_prestat *prestat);
+int prestat_stat(t_prestat *prestat, struct stat *st);
+void prestat_free(ftls_ctx *ctx);
+
+/* filter.c */
+bool filter_option_known(const char *name);
+bool filter_set_option(t_filter *filter, const char *name, const char *value, int *status);
+void free_filter(t_filter *filter);
+bool filter_copy(t_filter *dst, const t_filter *src);
+bool filter_active(const t_filter *filter);
+bool filter_needs_stat(const t_filter *filter);
+bool filter_name(const t_filter *filter, const char *name, size_t name_len, unsigned char d_type, int options);
+bool filter_stat(const t_filter *filter, const char *name, size_t name_len, unsigned char d_type,
+                 const struct stat *st, int options);
+bool filter_shown(const t_filter *filter, const char *name, size_t name_len, const struct stat *st);
+bool filter_pruned(const t_filter *filter, const char *name, size_t name_len);
+bool parse_count(const char *value, int *out);
+bool parse_size(const char *value, off_t *out);
+
+/* snapshot.c */
+bool snapshot_open(ftls_ctx *ctx, const char *file);
+void snapshot_close(ftls_ctx *ctx);
+bool snapshot_open_directory(ftls_ctx *ctx, const char *path);
+void snapshot_cursor(ftls_ctx *ctx, const char *path, t_snapshot_cursor *cursor);
+struct dirent *snapshot_next(t_snapshot_cursor *cursor);
+void snapshot_stat(const t_snapshot_cursor *cursor, struct stat *st);
+ssize_t snapshot_readlink(const t_snapshot_cursor *cursor, char *buffer, size_t size);
+int snapshot_write(ftls_ctx *ctx, const char *root, const char *file);
+
+/* throttle.c */
+void throttle_begin(ftls_ctx *ctx);
+void throttle_end(ftls_ctx *ctx);
+void throttle_free(ftls_ctx *ctx);
+void throttle_wait(t_throttle *throttle, bool directory);
+int throttled_fstatat(t_throttle *throttle, int dir_fd, const char *name, struct stat *st);
+
+/* pipeline.c */
+bool list_pipelined(ftls_ctx *ctx, const char *path, int options, DIR *dir);
+
+/* spill.c */
+int spill_threshold(const ftls_ctx *ctx, int options);
+bool spill_run(ftls_ctx *ctx, t_listing *listing, int count);
+void spill_display(ftls_ctx *ctx, t_listing *listing, const char *path, int options, t_dirs *dirs, int depth);
+void spill_free(t_listing *listing);
+
+/* render.c */
+void render_init(void);
+bool init_colors(t_colors *colors);
+void free_colors(t_colors *colors);
+void free_caches(ftls_ctx *ctx);
+void widths_add(ftls_ctx *ctx, t_widths *widths, t_file *file, int flags);
+void display_files(ftls_ctx *ctx, t_file *files, int count, int flags, size_t max_name_length,
+                   const t_widths *widths);
+
+#endif
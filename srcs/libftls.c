@@ -0,0 +1,1585 @@
+#include "ftls_internal.h"
+#include <locale.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+
+static char *arena_alloc(t_arena *arena, size_t size)
+{
+    arena_chunk *chunk = arena->current;
+
+    while (chunk == NULL || chunk->size - chunk->used < size)
+    {
+        if (chunk && chunk->next)
+        {
+            chunk = chunk->next;
+            chunk->used = 0;
+            continue;
+        }
+        size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        arena_chunk *fresh = malloc(sizeof(arena_chunk) + chunk_size);
+        fresh->next = NULL;
+        fresh->size = chunk_size;
+        fresh->used = 0;
+        if (chunk)
+            chunk->next = fresh;
+        else
+            arena->first = fresh;
+        chunk = fresh;
+    }
+    arena->current = chunk;
+    char *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+/* Gives back the last `size` bytes of the most recent allocation. */
+static void arena_release_tail(t_arena *arena, size_t size)
+{
+    arena->current->used -= size;
+}
+
+static void arena_reset(t_arena *arena)
+{
+    arena->current = arena->first;
+    if (arena->first)
+        arena->first->used = 0;
+}
+
+static void arena_free(t_arena *arena)
+{
+    arena_chunk *chunk = arena->first;
+
+    while (chunk)
+    {
+        arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->first = arena->current = NULL;
+}
+
+/* Collation. In the C/POSIX locale names sort bytewise, so the key is the
+ * name itself and only its packed 8-byte prefix is stored. Elsewhere the
+ * strxfrm key is computed once per entry into the listing arena; either way
+ * most comparisons are a single integer compare and the full key is only
+ * consulted when prefixes tie. */
+static bool collate_bytewise(void)
+{
+    const char *locale = setlocale(LC_COLLATE, NULL);
+
+    return locale == NULL || strcmp(locale, "C") == 0 || strcmp(locale, "POSIX") == 0;
+}
+
+static uint64_t pack_prefix(const unsigned char *key, size_t len)
+{
+    uint64_t prefix = 0;
+
+    for (size_t i = 0; i < 8; i++)
+        prefix = (prefix << 8) | (i < len ? key[i] : 0);
+    return prefix;
+}
+
+/* The key buffer of --head/--tail heap slot `slot`, grown to size. */
+static char *slot_key(t_listing *listing, int slot, size_t size)
+{
+    t_slot_key *key = &listing->slot_keys[slot];
+
+    if (key->size < size)
+    {
+        char *grown = realloc(key->data, size);
+
+        if (grown == NULL)
+            return NULL;
+        key->data = grown;
+        key->size = size;
+    }
+    return key->data;
+}
+
+/* Under --head/--tail, slot >= 0: the key goes into that heap slot's own
+ * buffer, which the next entry to take the slot overwrites, so evicted and
+ * rejected entries give their keys back. Otherwise into the arena. */
+static void collate_prepare(ftls_ctx *ctx, t_listing *listing, t_file *file, int slot)
+{
+    if (ctx->collate_bytewise)
+    {
+        file->sort_key = NULL;
+        file->sort_key_len = file->name_len;
+        file->sort_prefix = pack_prefix((const unsigned char *)file->name, file->name_len);
+        return;
+    }
+
+    size_t cap = file->name_len * 4 + 1;
+    char *key = slot >= 0 ? slot_key(listing, slot, cap) : NULL;
+    size_t len;
+
+    if (key == NULL)
+        slot = -1;
+    if (slot >= 0)
+    {
+        len = strxfrm(key, file->name, cap);
+        if (len >= cap && (key = slot_key(listing, slot, len + 1)) != NULL)
+            strxfrm(key, file->name, len + 1);
+    }
+    if (key == NULL)
+    {
+        t_arena *keys = &listing->keys;
+
+        key = arena_alloc(keys, cap);
+        len = strxfrm(key, file->name, cap);
+        if (len >= cap)
+        {
+            arena_release_tail(keys, cap);
+            key = arena_alloc(keys, len + 1);
+            strxfrm(key, file->name, len + 1);
+        }
+        else
+            arena_release_tail(keys, cap - (len + 1));
+    }
+
+    file->sort_key = key;
+    file->sort_key_len = len;
+    file->sort_prefix = pack_prefix((const unsigned char *)key, len);
+}
+
+static int collate_view(const t_sort_view *a, const t_sort_view *b)
+{
+    if (a->sort_prefix != b->sort_prefix)
+        return a->sort_prefix < b->sort_prefix ? -1 : 1;
+
+    if (a->sort_key && a->sort_key_len > 8 && b->sort_key_len > 8)
+    {
+        size_t len = a->sort_key_len < b->sort_key_len ? a->sort_key_len : b->sort_key_len;
+        int cmp = memcmp(a->sort_key + 8, b->sort_key + 8, len - 8);
+        if (cmp != 0)
+            return cmp;
+        if (a->sort_key_len != b->sort_key_len)
+            return a->sort_key_len < b->sort_key_len ? -1 : 1;
+    }
+    else if (a->sort_key && a->sort_key_len != b->sort_key_len)
+        return a->sort_key_len < b->sort_key_len ? -1 : 1;
+
+    if (!a->sort_key && a->name_len > 8 && b->name_len > 8)
+        return strcmp(a->name + 8, b->name + 8);
+    return strcmp(a->name, b->name);
+}
+
+# define FILE_VIEW(file) { &(file)->info, (file)->sort_prefix, (file)->sort_key, \
+                           (file)->sort_key_len, (file)->name, (file)->name_len }
+
+static int collate_compare(const t_file *a, const t_file *b)
+{
+    t_sort_view view_a = FILE_VIEW(a);
+    t_sort_view view_b = FILE_VIEW(b);
+
+    return collate_view(&view_a, &view_b);
+}
+
+/* compare_files on the sort fields alone: spill.c merges records that are
+ * never turned back into t_files. */
+int compare_views(const t_sort_view *a, const t_sort_view *b, int flags)
+{
+    int cmp;
+    if (flags & FLAG_t)
+    {
+        time_t time_a = (flags & FLAG_u) ? a->info->st_atime :
+                        (flags & FLAG_c) ? a->info->st_ctime :
+                        a->info->st_mtime;
+        time_t time_b = (flags & FLAG_u) ? b->info->st_atime :
+                        (flags & FLAG_c) ? b->info->st_ctime :
+                        b->info->st_mtime;
+
+        if (time_a > time_b)
+            cmp = -1;
+        else if (time_a < time_b)
+            cmp = 1;
+        else
+            cmp = collate_view(a, b);
+    }
+    else if (flags & FLAG_S)
+    {
+        if (a->info->st_size > b->info->st_size)
+            cmp = -1;
+        else if (a->info->st_size < b->info->st_size)
+            cmp = 1;
+        else
+            cmp = collate_view(a, b);
+    }
+    else
+    {
+        cmp = collate_view(a, b);
+    }
+
+    return (flags & FLAG_r) ? -cmp : cmp;
+}
+
+int compare_files(const void *a, const void *b, int flags)
+{
+    t_sort_view view_a = FILE_VIEW((const t_file *)a);
+    t_sort_view view_b = FILE_VIEW((const t_file *)b);
+
+    return compare_views(&view_a, &view_b, flags);
+}
+
+#ifdef USE_MERGE_SORT
+static int compare_by_name(const t_file *a, const t_file *b)
+{
+    return collate_compare(a, b);
+}
+
+static int compare_by_size(const t_file *a, const t_file *b)
+{
+    if (a->info.st_size > b->info.st_size)
+        return -1;
+    else if (a->info.st_size < b->info.st_size)
+        return 1;
+    return compare_by_name(a, b);
+}
+
+static int compare_by_time(const t_file *a, const t_file *b, int flags)
+{
+    time_t time_a = (flags & FLAG_u) ? a->info.st_atime :
+                    (flags & FLAG_c) ? a->info.st_ctime :
+                    a->info.st_mtime;
+    time_t time_b = (flags & FLAG_u) ? b->info.st_atime :
+                    (flags & FLAG_c) ? b->info.st_ctime :
+                    b->info.st_mtime;
+
+    if (time_a > time_b)
+        return -1;
+    else if (time_a < time_b)
+        return 1;
+    return compare_by_name(a, b);
+}
+
+/* TODO
+ * Move it to top of the file
+ */
+static void merge(t_file *files, int left, int mid, int right, int flags);
+
+static void merge_sort(t_file *files, int left, int right, int flags)
+{
+    if (left < right)
+    {
+        int mid = (left + right) / 2;
+        merge_sort(files, left, mid, flags);
+        merge_sort(files, mid + 1, right, flags);
+        merge(files, left, mid, right, flags);
+    }
+}
+
+static void merge(t_file *files, int left, int mid, int right, int flags)
+{
+    int n1 = mid - left + 1;
+    int n2 = right - mid;
+    t_file *L = malloc(n1 * sizeof(t_file));
+    t_file *R = malloc(n2 * sizeof(t_file));
+    
+    for (int i = 0; i < n1; i++) L[i] = files[left + i];
+    for (int i = 0; i < n2; i++) R[i] = files[mid + 1 + i];
+
+    int i = 0, j = 0, k = left;
+    while (i < n1 && j < n2)
+    {
+        int cmp = (flags & FLAG_t) ? compare_by_time(&L[i], &R[j], flags) :
+                  (flags & FLAG_S) ? compare_by_size(&L[i], &R[j]) :
+                  compare_by_name(&L[i], &R[j]);
+        if ((flags & FLAG_r) ? cmp > 0 : cmp <= 0)
+        {
+            files[k++] = L[i++];
+        }
+        else
+        {
+            files[k++] = R[j++];
+        }
+    }
+
+    while (i < n1) files[k++] = L[i++];
+    while (j < n2) files[k++] = R[j++];
+    free(L);
+    free(R);
+}
+#else
+/* Sort kernels. compare_files tests the flags on every call; a listing
+ * is instead sorted with a comparator instantiated for its sort key and
+ * direction, picked once, so qsort runs with no flag tests inside. */
+# define COMPARE_DESCENDING(a, b, field) \
+    ((a)->info.field > (b)->info.field ? -1 : \
+     (a)->info.field < (b)->info.field ? 1 : collate_compare(a, b))
+
+# define DEFINE_COMPARE(key, expression) \
+static int compare_##key(const void *a, const void *b) \
+{ \
+    const t_file *file_a = a; \
+    const t_file *file_b = b; \
+    return expression; \
+} \
+static int compare_##key##_reverse(const void *a, const void *b) \
+{ \
+    return -compare_##key(a, b); \
+}
+
+DEFINE_COMPARE(name, collate_compare(file_a, file_b))
+DEFINE_COMPARE(size, COMPARE_DESCENDING(file_a, file_b, st_size))
+DEFINE_COMPARE(mtime, COMPARE_DESCENDING(file_a, file_b, st_mtime))
+DEFINE_COMPARE(atime, COMPARE_DESCENDING(file_a, file_b, st_atime))
+DEFINE_COMPARE(ctime, COMPARE_DESCENDING(file_a, file_b, st_ctime))
+
+typedef int (*t_compare)(const void *, const void *);
+
+/* Indexed by sort key, then by -r. */
+static const t_compare g_comparators[5][2] = {
+    { compare_name,  compare_name_reverse },
+    { compare_size,  compare_size_reverse },
+    { compare_mtime, compare_mtime_reverse },
+    { compare_atime, compare_atime_reverse },
+    { compare_ctime, compare_ctime_reverse },
+};
+
+/* The same precedence as compare_files: -t over -S, -u over -c. */
+static t_compare comparator_for(int flags)
+{
+    int key = (flags & FLAG_t) ? ((flags & FLAG_u) ? 3 : (flags & FLAG_c) ? 4 : 2) :
+              (flags & FLAG_S) ? 1 : 0;
+
+    return g_comparators[key][(flags & FLAG_r) != 0];
+}
+
+static void sort_files(t_file *files, int count, int flags)
+{
+    qsort(files, count, sizeof(t_file), comparator_for(flags));
+}
+#endif
+
+static void sort_listing(t_file *files, int count, int options)
+{
+    if (options & FLAG_f)
+        return;
+#ifdef USE_MERGE_SORT
+    merge_sort(files, 0, count - 1, options);
+#else
+    sort_files(files, count, options);
+#endif
+}
+
+/* Bounded heap backing --head/--tail. heap[] holds slot indices into the
+ * file array; heap[0] is the kept entry that would be evicted first, so a
+ * new entry costs a single compare unless it belongs in the result. */
+static bool topk_above(const ftls_ctx *ctx, const t_file *files, int a, int b, int flags)
+{
+    int cmp = compare_files(&files[a], &files[b], flags);
+    return ctx->limit_tail ? cmp < 0 : cmp > 0;
+}
+
+static void topk_sift_up(const ftls_ctx *ctx, const t_file *files, int *heap, int pos, int flags)
+{
+    while (pos > 0)
+    {
+        int parent = (pos - 1) / 2;
+        if (!topk_above(ctx, files, heap[pos], heap[parent], flags))
+            break;
+        int tmp = heap[pos];
+        heap[pos] = heap[parent];
+        heap[parent] = tmp;
+        pos = parent;
+    }
+}
+
+static void topk_sift_down(const ftls_ctx *ctx, const t_file *files, int *heap, int count, int flags)
+{
+    int pos = 0;
+
+    for (;;)
+    {
+        int child = pos * 2 + 1;
+        if (child >= count)
+            break;
+        if (child + 1 < count && topk_above(ctx, files, heap[child + 1], heap[child], flags))
+            child++;
+        if (!topk_above(ctx, files, heap[child], heap[pos], flags))
+            break;
+        int tmp = heap[pos];
+        heap[pos] = heap[child];
+        heap[child] = tmp;
+        pos = child;
+    }
+}
+
+/* tmp is local: contexts on other threads rotate their own tails. */
+static void swap_files(t_file *a, t_file *b)
+{
+    t_file tmp;
+
+    tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void reverse_files(t_file *files, int left, int right)
+{
+    while (left < right)
+        swap_files(&files[left++], &files[right--]);
+}
+
+/* Restores encounter order of the --tail ring buffer used with -f. */
+static void rotate_files(t_file *files, int count, int start)
+{
+    if (start == 0 || start >= count)
+        return;
+    reverse_files(files, 0, start - 1);
+    reverse_files(files, start, count - 1);
+    reverse_files(files, 0, count - 1);
+}
+
+ftls_ctx *ftls_create(void)
+{
+    ftls_ctx *ctx = calloc(1, sizeof(ftls_ctx));
+
+    if (ctx == NULL)
+        return NULL;
+    ctx->out_fd = STDOUT_FILENO;
+    ctx->err_fd = STDERR_FILENO;
+    ctx->cwd_fd = AT_FDCWD;
+    ctx->cached_minute = -1;
+    ctx->max_depth = -1;
+    ctx->checkpoint_interval = CHECKPOINT_INTERVAL;
+    ctx->collate_bytewise = collate_bytewise();
+    render_init();
+    return ctx;
+}
+
+void free_listing(t_listing *listing)
+{
+    if (listing->hidden != NULL)
+    {
+        free_listing(listing->hidden);
+        free(listing->hidden);
+        listing->hidden = NULL;
+    }
+    checksum_wait(listing);
+    spill_free(listing);
+    free(listing->files);
+    arena_free(&listing->keys);
+    for (int i = 0; i < listing->slot_key_count; i++)
+        free(listing->slot_keys[i].data);
+    free(listing->slot_keys);
+}
+
+void ftls_destroy(ftls_ctx *ctx)
+{
+    if (ctx == NULL)
+        return;
+    flush_output(ctx);
+    free_caches(ctx);
+    free_filter(&ctx->filter);
+    free_colors(&ctx->colors);
+    free_listing(&ctx->listing);
+    checksum_stop(ctx->hasher);
+    deadline_free(ctx);
+    snapshot_close(ctx);
+    free(ctx->snapshot_out);
+    free(ctx->files_from);
+    checkpoint_free(ctx);
+    throttle_free(ctx);
+    prestat_free(ctx);
+    free(ctx);
+}
+
+void ftls_reset(ftls_ctx *ctx)
+{
+    flush_output(ctx);
+    free_filter(&ctx->filter);
+    memset(&ctx->filter, 0, sizeof(ctx->filter));
+    ctx->flags = 0;
+    ctx->limit = 0;
+    ctx->limit_tail = false;
+    ctx->max_memory = 0;
+    ctx->color = false;
+    ctx->checksum = CHECKSUM_NONE;
+    ctx->quoting = QUOTE_LITERAL;
+    ctx->hide_control = false;
+    ctx->deadline_ms = 0;
+    snapshot_close(ctx);
+    free(ctx->snapshot_out);
+    ctx->snapshot_out = NULL;
+    free(ctx->files_from);
+    ctx->files_from = NULL;
+    checkpoint_free(ctx);
+    ctx->checkpoint_interval = CHECKPOINT_INTERVAL;
+    ctx->estimate_budget = 0;
+    ctx->max_depth = -1;
+    ctx->min_depth = 0;
+    ctx->max_iops = 0;
+    ctx->max_dirs_per_sec = 0;
+    ctx->throttle_latency_us = 0;
+    ctx->idle_io = false;
+    ctx->pipeline = PIPELINE_AUTO;
+    throttle_free(ctx);
+    ctx->fs_cache_count = 0;
+    ctx->fs_cache_next = 0;
+    ctx->ws_cols = 0;
+    ctx->out_fd = STDOUT_FILENO;
+    ctx->err_fd = STDERR_FILENO;
+    ctx->output_failed = false;
+    ctx->cwd_fd = AT_FDCWD;
+}
+
+void ftls_set_flags(ftls_ctx *ctx, int flags)
+{
+    ctx->flags = flags;
+}
+
+int ftls_get_flags(const ftls_ctx *ctx)
+{
+    return ctx->flags;
+}
+
+void ftls_set_output(ftls_ctx *ctx, int out_fd, int err_fd)
+{
+    flush_output(ctx);
+    ctx->out_fd = out_fd;
+    ctx->err_fd = err_fd;
+    ctx->output_failed = false;
+}
+
+void ftls_set_cwd(ftls_ctx *ctx, int dir_fd)
+{
+    ctx->cwd_fd = dir_fd;
+}
+
+static bool set_pipeline_when(ftls_ctx *ctx, const char *when)
+{
+    if (strcmp(when, "always") == 0)
+        ctx->pipeline = PIPELINE_ALWAYS;
+    else if (strcmp(when, "never") == 0)
+        ctx->pipeline = PIPELINE_NEVER;
+    else if (strcmp(when, "auto") == 0)
+        ctx->pipeline = PIPELINE_AUTO;
+    else
+        return false;
+    return true;
+}
+
+static bool set_color_when(ftls_ctx *ctx, const char *when)
+{
+    if (strcmp(when, "always") == 0 || strcmp(when, "yes") == 0 || strcmp(when, "force") == 0)
+        ctx->color = true;
+    else if (strcmp(when, "never") == 0 || strcmp(when, "no") == 0 || strcmp(when, "none") == 0)
+        ctx->color = false;
+    else if (strcmp(when, "auto") == 0 || strcmp(when, "tty") == 0 || strcmp(when, "if-tty") == 0)
+        ctx->color = isatty(ctx->out_fd);
+    else
+        return false;
+    if (ctx->color && ctx->colors.spec == NULL)
+        init_colors(&ctx->colors);
+    return true;
+}
+
+int ftls_set_option(ftls_ctx *ctx, const char *name, const char *value)
+{
+    int status;
+
+    if (value == NULL)
+    {
+        if (strcmp(name, "head") == 0 || strcmp(name, "tail") == 0 ||
+            strcmp(name, "color") == 0 || strcmp(name, "max-memory") == 0 ||
+            strcmp(name, "checksum") == 0 || strcmp(name, "deadline") == 0 ||
+            strcmp(name, "snapshot-read") == 0 || strcmp(name, "snapshot-write") == 0 ||
+            strcmp(name, "estimate") == 0 || strcmp(name, "max-depth") == 0 ||
+            strcmp(name, "min-depth") == 0 || strcmp(name, "max-iops") == 0 ||
+            strcmp(name, "max-dirs-per-sec") == 0 || strcmp(name, "throttle-latency") == 0 ||
+            strcmp(name, "idle-io") == 0 || strcmp(name, "pipeline") == 0 ||
+            strcmp(name, "files0-from") == 0 ||
+            strcmp(name, "quoting-style") == 0 || strcmp(name, "hide-control-chars") == 0 ||
+            strcmp(name, "checkpoint") == 0 || strcmp(name, "checkpoint-interval") == 0 ||
+            strcmp(name, "resume") == 0 || filter_option_known(name))
+            return FTLS_EINVAL;
+        return FTLS_EUNKNOWN;
+    }
+    if (strcmp(name, "head") == 0 || strcmp(name, "tail") == 0)
+    {
+        if (!parse_count(value, &ctx->limit))
+            return FTLS_EINVAL;
+        ctx->limit_tail = (name[0] == 't');
+        return FTLS_OK;
+    }
+    if (strcmp(name, "color") == 0)
+        return set_color_when(ctx, value) ? FTLS_OK : FTLS_EINVAL;
+    if (strcmp(name, "checksum") == 0)
+        return checksum_parse(value, &ctx->checksum) ? FTLS_OK : FTLS_EINVAL;
+    if (strcmp(name, "quoting-style") == 0)
+        return quote_parse(value, &ctx->quoting) ? FTLS_OK : FTLS_EINVAL;
+    if (strcmp(name, "hide-control-chars") == 0)
+    {
+        int on;
+        if (!parse_count(value, &on) || on > 1)
+            return FTLS_EINVAL;
+        ctx->hide_control = on;
+        return FTLS_OK;
+    }
+    if (strcmp(name, "deadline") == 0)
+        return parse_count(value, &ctx->deadline_ms) ? FTLS_OK : FTLS_EINVAL;
+    if (strcmp(name, "estimate") == 0)
+        return parse_count(value, &ctx->estimate_budget) && ctx->estimate_budget > 0 ?
+               FTLS_OK : FTLS_EINVAL;
+    if (strcmp(name, "max-depth") == 0)
+        return parse_count(value, &ctx->max_depth) ? FTLS_OK : FTLS_EINVAL;
+    if (strcmp(name, "min-depth") == 0)
+        return parse_count(value, &ctx->min_depth) ? FTLS_OK : FTLS_EINVAL;
+    if (strcmp(name, "max-iops") == 0)
+        return parse_count(value, &ctx->max_iops) ? FTLS_OK : FTLS_EINVAL;
+    if (strcmp(name, "max-dirs-per-sec") == 0)
+        return parse_count(value, &ctx->max_dirs_per_sec) ? FTLS_OK : FTLS_EINVAL;
+    if (strcmp(name, "throttle-latency") == 0)
+        return parse_count(value, &ctx->throttle_latency_us) ? FTLS_OK : FTLS_EINVAL;
+    if (strcmp(name, "idle-io") == 0)
+    {
+        int on;
+        if (!parse_count(value, &on) || on > 1)
+            return FTLS_EINVAL;
+        ctx->idle_io = on;
+        return FTLS_OK;
+    }
+    if (strcmp(name, "pipeline") == 0)
+        return set_pipeline_when(ctx, value) ? FTLS_OK : FTLS_EINVAL;
+    if (strcmp(name, "snapshot-read") == 0)
+        return snapshot_open(ctx, value) ? FTLS_OK : FTLS_EINVAL;
+    if (strcmp(name, "snapshot-write") == 0)
+    {
+        free(ctx->snapshot_out);
+        ctx->snapshot_out = strdup(value);
+        return ctx->snapshot_out ? FTLS_OK : FTLS_EINVAL;
+    }
+    if (strcmp(name, "checkpoint") == 0)
+    {
+        free(ctx->checkpoint_out);
+        ctx->checkpoint_out = strdup(value);
+        return ctx->checkpoint_out ? FTLS_OK : FTLS_EINVAL;
+    }
+    if (strcmp(name, "checkpoint-interval") == 0)
+        return parse_count(value, &ctx->checkpoint_interval) ? FTLS_OK : FTLS_EINVAL;
+    if (strcmp(name, "resume") == 0)
+        return checkpoint_load(ctx, value) ? FTLS_OK : FTLS_EINVAL;
+    if (strcmp(name, "files0-from") == 0)
+    {
+        free(ctx->files_from);
+        ctx->files_from = strdup(value);
+        return ctx->files_from ? FTLS_OK : FTLS_EINVAL;
+    }
+    if (strcmp(name, "max-memory") == 0)
+    {
+        off_t bytes;
+        if (!parse_size(value, &bytes))
+            return FTLS_EINVAL;
+        ctx->max_memory = bytes;
+        return FTLS_OK;
+    }
+    if (filter_set_option(&ctx->filter, name, value, &status))
+        return status;
+    return FTLS_EUNKNOWN;
+}
+
+/* Writes to out_fd, retrying short writes, and returns how much got
+ * through. This calls the real write(): the write macro stores its result
+ * in ignore_write, which every thread shares. */
+static size_t output_write(ftls_ctx *ctx, const char *data, size_t len)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < len)
+    {
+        n = (write)(ctx->out_fd, data + done, len - done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            ctx->output_failed = true;
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+/* output_offset counts what got through. */
+void flush_output(ftls_ctx *ctx)
+{
+    ctx->output_offset += output_write(ctx, ctx->output_buffer, ctx->output_index);
+    ctx->output_index = 0;
+}
+
+void ftls_flush(ftls_ctx *ctx)
+{
+    flush_output(ctx);
+}
+
+#ifndef UNBUFFERED_OUTPUT
+void buffered_write(ftls_ctx *ctx, const char *data, size_t len)
+{
+    size_t chunk;
+
+    while (len > 0)
+    {
+        if (ctx->output_index == OUTPUT_BUFFER_SIZE)
+            flush_output(ctx);
+        chunk = OUTPUT_BUFFER_SIZE - ctx->output_index;
+        if (chunk > len)
+            chunk = len;
+        memcpy(ctx->output_buffer + ctx->output_index, data, chunk);
+        ctx->output_index += (int)chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+#else
+void buffered_write(ftls_ctx *ctx, const char *data, size_t len)
+{
+    ctx->output_offset += output_write(ctx, data, len);
+}
+#endif
+
+/* "ft_ls: <what> '<path>': <strerror>" on the context's error fd. */
+void report_error(ftls_ctx *ctx, const char *what, const char *path, int err)
+{
+    char buffer[128];
+    const char *reason = strerror_r(err, buffer, sizeof(buffer));
+
+    if (ctx->err_fd < 0)
+        return;
+    write(ctx->err_fd, "ft_ls: ", 7);
+    write(ctx->err_fd, what, strlen(what));
+    write(ctx->err_fd, " '", 2);
+    write(ctx->err_fd, path, strlen(path));
+    write(ctx->err_fd, "': ", 3);
+    write(ctx->err_fd, reason, strlen(reason));
+    write(ctx->err_fd, "\n", 1);
+}
+
+/* After the deadline nothing is opened, and that is reported only once,
+ * by whoever returns FTLS_TIMEDOUT. */
+bool open_directory(ftls_ctx *ctx, const char *path, DIR **dir)
+{
+    bool accessible = true;
+    int fd;
+
+    if (ctx->snapshot != NULL)
+    {
+        *dir = NULL;
+        return snapshot_open_directory(ctx, path);
+    }
+    if (ctx->throttle != NULL)
+        throttle_wait(ctx->throttle, true);
+    if (ctx->deadline_ms > 0)
+        fd = deadline_open(ctx, path, &accessible);
+    else if ((accessible = faccessat(ctx->cwd_fd, path, F_OK, 0) == 0))
+        fd = openat(ctx->cwd_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    else
+        fd = -1;
+    if (fd == -1 && errno == ETIMEDOUT && ctx->deadline_hit)
+        return false;
+    if (!accessible)
+    {
+        report_error(ctx, "Cannot access", path, errno);
+        return false;
+    }
+
+    *dir = fd == -1 ? NULL : fdopendir(fd);
+    if (*dir == NULL)
+    {
+        report_error(ctx, "Cannot open directory", path, errno);
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+    return true;
+}
+
+/* The descriptor --checksum and -@ read a directory's files through:
+ * none for a snapshot, nor after the deadline, when the stream may belong
+ * to the helper. checksum_start then marks the files unreadable. */
+static int checksum_dup(ftls_ctx *ctx, DIR *dir)
+{
+    if (dir == NULL || ctx->deadline_hit)
+        return -1;
+    return fcntl(dirfd(dir), F_DUPFD_CLOEXEC, 0);
+}
+
+static void slot_keys_reserve(t_listing *listing, int count)
+{
+    t_slot_key *grown;
+
+    if (listing->slot_key_count >= count)
+        return;
+    grown = realloc(listing->slot_keys, count * sizeof(t_slot_key));
+    if (grown == NULL)
+        return;
+    memset(grown + listing->slot_key_count, 0, (count - listing->slot_key_count) * sizeof(t_slot_key));
+    listing->slot_keys = grown;
+    listing->slot_key_count = count;
+}
+
+static bool listing_reserve(t_listing *listing, int capacity)
+{
+    t_file *grown;
+
+    if (listing->capacity >= capacity)
+        return true;
+    grown = realloc(listing->files, capacity * sizeof(t_file));
+    if (grown == NULL)
+        return false;
+    listing->files = grown;
+    listing->capacity = capacity;
+    return true;
+}
+
+/* Keeps a directory the filters leave out of an -R listing in its hidden
+ * listing, which only the walk reads. false when out of memory. */
+static bool listing_hide(ftls_ctx *ctx, t_listing *listing, const char *name, size_t name_len,
+                         const struct stat *st)
+{
+    t_listing *hidden = listing->hidden;
+    t_file *file;
+
+    if (hidden == NULL && (hidden = listing->hidden = calloc(1, sizeof(t_listing))) == NULL)
+        return false;
+    if (hidden->count == hidden->capacity &&
+        !listing_reserve(hidden, hidden->capacity > 0 ? hidden->capacity * 2 : 16))
+        return false;
+    file = &hidden->files[hidden->count++];
+    memcpy(file->name, name, name_len + 1);
+    file->name_len = name_len;
+    file->info = *st;
+    file->link_target[0] = '\0';
+    file->link_len = 0;
+    file->unresolved = false;
+    collate_prepare(ctx, hidden, file, -1);
+    return true;
+}
+
+# define TOPK_INITIAL 256
+
+/* Makes room for files[slot]. Without a limit the array grows 10000
+ * entries at a time. Under --head/--tail it doubles from TOPK_INITIAL up
+ * to the limit + 1 slots the heap uses, so a large N costs nothing in a
+ * small directory; heap[] and the per-slot keys follow it. false, with
+ * the entries so far kept, when out of memory. */
+static bool listing_grow(t_listing *listing, int **heap, int slot, int limit)
+{
+    int capacity = listing->capacity;
+    int *grown;
+
+    while (capacity <= slot)
+    {
+        if (limit == 0)
+            capacity += 10000;
+        else if (capacity >= (limit + 1) / 2)
+            capacity = limit + 1;
+        else
+            capacity = capacity < TOPK_INITIAL ? TOPK_INITIAL : capacity * 2;
+    }
+    if (limit > 0 && capacity > limit + 1)
+        capacity = limit + 1;
+    if (!listing_reserve(listing, capacity))
+        return false;
+    if (heap != NULL)
+    {
+        grown = realloc(*heap, capacity * sizeof(int));
+        if (grown == NULL)
+            return false;
+        *heap = grown;
+        slot_keys_reserve(listing, capacity);
+    }
+    return true;
+}
+
+/* Reads, filters and sorts one directory into `listing` and closes `dir`.
+ * With -l the owner/group names and column widths are filled in as well.
+ * With --deadline the reading and stat'ing is done by deadline_collect;
+ * entries it could not stat in time are kept, marked unresolved. With
+ * --snapshot-read `dir` is NULL and the entries come from the snapshot.
+ * Otherwise, when every entry is stat'ed, prestat.c stats them in inode
+ * order on filesystems where that saves seeks. */
+void scan_directory(ftls_ctx *ctx, t_listing *listing, const char *path, DIR *dir, int options)
+{
+    struct dirent *entry;
+    struct stat file_stat;
+    const t_filter *filter = &ctx->filter;
+    bool need_stat = (options & (FLAG_l | FLAG_t | FLAG_S | FLAG_R | FLAG_STAT)) ||
+                     ctx->color || filter_needs_stat(filter);
+    bool name_filter = filter_active(filter);
+    bool type_filter = filter->include.count || filter->type_mask;
+    bool stat_filter = name_filter || filter_needs_stat(filter);
+    bool stat_this;
+    int limit = ctx->limit;
+    bool use_heap = limit > 0 && !(options & FLAG_f);
+    int *heap = NULL;
+    int spill_at = spill_threshold(ctx, options);
+    bool xattrs = (options & (FLAG_l | FLAG_XATTR)) == (FLAG_l | FLAG_XATTR);
+    bool checksum = (ctx->checksum != CHECKSUM_NONE && (options & (FLAG_l | FLAG_CHECKSUM))) || xattrs;
+    int checksum_fd = -1;
+    t_collected *collected = NULL;
+    t_throttle *throttle = NULL;
+    t_prestat *prestat = NULL;
+    t_snapshot_cursor snapshot;
+    bool unresolved;
+    int stat_result;
+    t_file *files;
+
+    if (limit == 0)
+        listing_reserve(listing, spill_at > 0 && spill_at < 10000 ? spill_at + 1 : 10000);
+    else if (use_heap)
+        listing_grow(listing, &heap, 0, limit);
+    files = listing->files;
+    arena_reset(&listing->keys);
+    if (listing->hidden != NULL)
+    {
+        listing->hidden->count = 0;
+        arena_reset(&listing->hidden->keys);
+    }
+    
+    int index = 0;
+    int seen = 0;
+    int slot;
+    int scratch = limit;
+    char full_path[PATH_MAX];
+    size_t path_len;
+    size_t name_len;
+    size_t max_len = 0;
+    t_widths widths = {0, 0, 0, 0};
+
+    path_len = strlen(path);
+
+    memcpy(full_path, path, path_len);
+
+    if (full_path[path_len - 1] != '/')
+    {
+        full_path[path_len] = '/';
+        path_len++;
+    }
+
+    if (dir == NULL)
+        snapshot_cursor(ctx, path, &snapshot);
+    else if (ctx->deadline_ms > 0)
+        collected = deadline_collect(ctx, dir, options, need_stat, type_filter);
+    else if (need_stat || ctx->throttle != NULL)
+    {
+        const t_fs_type *fs = fs_type_of(ctx, dirfd(dir));
+
+        if (ctx->throttle != NULL && !fs->diskless)
+            throttle = ctx->throttle;
+        /* Not when the -f head stops reading early: the read-ahead would
+         * stat entries that are never listed. */
+        if (need_stat && !(limit > 0 && (options & FLAG_f) && !ctx->limit_tail))
+            prestat = prestat_begin(ctx, dir, options, fs, throttle);
+    }
+
+    while ((entry = dir == NULL ? snapshot_next(&snapshot) :
+                    collected ? collected_next(collected) :
+                    prestat ? prestat_next(prestat) : readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.' && !(options & FLAG_a))
+            continue;
+
+        name_len = strlen(entry->d_name);
+
+        if (name_filter && !filter_name(filter, entry->d_name, name_len, entry->d_type, options))
+            continue;
+
+        if (use_heap)
+            slot = index < limit ? index : scratch;
+        else if (limit > 0 && ctx->limit_tail)
+            slot = seen % limit;
+        else if (limit > 0 && index >= limit)
+            break;
+        else
+            slot = index;
+        if (slot >= listing->capacity || (use_heap && heap == NULL))
+        {
+            if (!listing_grow(listing, use_heap ? &heap : NULL, slot, limit))
+            {
+                report_error(ctx, "Cannot read directory", path, ENOMEM);
+                break;
+            }
+            files = listing->files;
+        }
+
+        memcpy(full_path + path_len, entry->d_name, name_len + 1);
+        full_path[path_len + name_len] = '\0';
+        stat_this = need_stat || (type_filter && entry->d_type == DT_UNKNOWN);
+        unresolved = false;
+        if (stat_this)
+        {
+            stat_result = 0;
+            if (dir == NULL)
+                snapshot_stat(&snapshot, &file_stat);
+            else if (collected)
+                stat_result = collected_stat(collected, &file_stat);
+            else if (prestat)
+                stat_result = prestat_stat(prestat, &file_stat);
+            else if (throttle != NULL)
+                stat_result = throttled_fstatat(throttle, dirfd(dir), entry->d_name, &file_stat);
+            else
+                stat_result = fstatat(dirfd(dir), entry->d_name, &file_stat, AT_SYMLINK_NOFOLLOW);
+            if (stat_result == -1)
+            {
+                report_error(ctx, "Cannot stat file", full_path, errno);
+                continue;
+            }
+            unresolved = stat_result == 1;
+
+            if (!unresolved && stat_filter &&
+                !filter_stat(filter, entry->d_name, name_len, entry->d_type, &file_stat, options))
+                continue;
+            if (!unresolved && stat_filter && (options & FLAG_R) && S_ISDIR(file_stat.st_mode) &&
+                !filter_shown(filter, entry->d_name, name_len, &file_stat))
+            {
+                if (!listing_hide(ctx, listing, entry->d_name, name_len, &file_stat))
+                    report_error(ctx, "Cannot open directory", full_path, ENOMEM);
+                continue;
+            }
+
+            if (!unresolved && S_ISLNK(file_stat.st_mode))
+            {
+                if (throttle != NULL)
+                    throttle_wait(throttle, false);
+                ssize_t link_len = dir == NULL ?
+                    snapshot_readlink(&snapshot, files[slot].link_target, PATH_MAX - 1) : collected ?
+                    collected_readlink(collected, files[slot].link_target, PATH_MAX - 1) :
+                    readlinkat(dirfd(dir), entry->d_name, files[slot].link_target, PATH_MAX - 1);
+                if (link_len == -1)
+                {
+                    report_error(ctx, "Cannot read link", full_path, errno);
+                    continue;
+                }
+                files[slot].link_target[link_len] = '\0';
+                files[slot].link_len = link_len;
+            }
+            else
+            {
+                files[slot].link_target[0] = '\0';
+                files[slot].link_len = 0;
+            }
+        }
+
+        memcpy(files[slot].name, entry->d_name, name_len + 1);
+        files[slot].name_len = name_len;
+        files[slot].unresolved = unresolved;
+        if (!(options & FLAG_f))
+            collate_prepare(ctx, listing, &files[slot],
+                            use_heap && slot < listing->slot_key_count ? slot : -1);
+        if (limit == 0 && !(options & FLAG_l))
+        {
+            size_t width = quote_width(ctx, entry->d_name, name_len);
+            if (width > max_len)
+                max_len = width;
+        }
+        
+        if (stat_this)
+            files[slot].info = file_stat;
+
+        if ((options & FLAG_l) && limit == 0)
+            widths_add(ctx, &widths, &files[slot], options);
+
+        if (use_heap)
+        {
+            if (index < limit)
+            {
+                heap[index] = slot;
+                topk_sift_up(ctx, files, heap, index, options);
+                index++;
+            }
+            else if (topk_above(ctx, files, heap[0], slot, options))
+            {
+                scratch = heap[0];
+                heap[0] = slot;
+                topk_sift_down(ctx, files, heap, limit, options);
+            }
+            continue;
+        }
+
+        seen++;
+        if (limit > 0)
+        {
+            index = seen < limit ? seen : limit;
+            continue;
+        }
+
+        index++;
+        if (index == spill_at)
+        {
+            sort_listing(files, index, options);
+            if (checksum)
+            {
+                /* Runs are written with their checksums and marks. */
+                checksum_start(ctx, listing, checksum_dup(ctx, dir), index, xattrs);
+                checksum_wait(listing);
+            }
+            if (spill_run(ctx, listing, index))
+            {
+                index = 0;
+                arena_reset(&listing->keys);
+                continue;
+            }
+            /* No temp file: finish in memory, over budget. */
+            spill_at = 0;
+        }
+    }
+
+    /* Hashing starts once the entries have their final places, after
+     * the stream is closed, so it gets a descriptor of its own. */
+    if (checksum)
+        checksum_fd = checksum_dup(ctx, dir);
+    if (collected)
+        collected_free(collected);
+    else if (dir != NULL)
+        closedir(dir);
+
+    if (use_heap)
+    {
+        if (index == limit && scratch != limit)
+            files[scratch] = files[limit];
+        free(heap);
+    }
+    else if (limit > 0 && seen > limit)
+    {
+        rotate_files(files, limit, seen % limit);
+    }
+
+    if (limit > 0)
+    {
+        for (int i = 0; i < index; i++)
+        {
+            if (options & FLAG_l)
+                widths_add(ctx, &widths, &files[i], options);
+            else
+            {
+                size_t width = quote_width(ctx, files[i].name, files[i].name_len);
+                if (width > max_len)
+                    max_len = width;
+            }
+        }
+    }
+
+    sort_listing(files, index, options);
+    if (listing->hidden != NULL)
+        sort_listing(listing->hidden->files, listing->hidden->count, options);
+
+    if (checksum)
+    {
+        checksum_start(ctx, listing, checksum_fd, index, xattrs);
+        if (listing->spill != NULL)
+            checksum_wait(listing);
+    }
+
+    if (listing->spill != NULL)
+    {
+        if (index > 0)
+            spill_run(ctx, listing, index);
+        index = 0;
+    }
+
+    listing->count = index;
+    listing->max_len = max_len;
+    listing->widths = widths;
+}
+
+/* Starts a walk of the operand root. Under -x its filesystem is looked up
+ * for walk_descends; a snapshot records no devices, so there -x never cuts. */
+void walk_begin(ftls_ctx *ctx, const char *root)
+{
+    struct stat st;
+
+    ctx->root_dev = 0;
+    ctx->block_shown = false;
+    if ((ctx->flags & FLAG_x) && ctx->snapshot == NULL && fstatat(ctx->cwd_fd, root, &st, 0) == 0)
+        ctx->root_dev = st.st_dev;
+}
+
+/* Whether -R goes into file from a directory depth levels below the
+ * operand: a directory but "." and "..", not pruned, within --max-depth
+ * and, under -x, on the operand's filesystem. -R stats every entry, so
+ * st_dev is at hand and a pruned directory is never opened. */
+bool walk_descends(const ftls_ctx *ctx, int depth, const t_file *file)
+{
+    return S_ISDIR(file->info.st_mode) &&
+           strcmp(file->name, ".") != 0 &&
+           strcmp(file->name, "..") != 0 &&
+           (ctx->max_depth < 0 || depth < ctx->max_depth) &&
+           (!(ctx->flags & FLAG_x) || file->info.st_dev == ctx->root_dev) &&
+           !filter_pruned(&ctx->filter, file->name, file->name_len);
+}
+
+/* Queues file as a subdirectory of path, depth levels below the operand,
+ * if walk_descends says -R goes there. */
+void dirs_add(ftls_ctx *ctx, t_dirs *dirs, const char *path, size_t path_len, int depth, const t_file *file)
+{
+    dirs_todo *entry;
+
+    if (!walk_descends(ctx, depth, file))
+        return;
+
+    if (path_len + file->name_len + 2 > PATH_MAX)
+    {
+        report_error(ctx, "Cannot open directory", file->name, ENAMETOOLONG);
+        return;
+    }
+
+    entry = ft_list_add_last_slot(dirs);
+    if (entry == NULL)
+    {
+        report_error(ctx, "Cannot open directory", file->name, ENOMEM);
+        return;
+    }
+    memcpy(entry->path, path, path_len);
+    entry->path[path_len] = '/';
+    memcpy(entry->path + path_len + 1, file->name, file->name_len + 1);
+    entry->path_len = path_len + file->name_len + 1;
+    entry->depth = depth + 1;
+}
+
+/* Queues the directories of listing->hidden from *next on that sort
+ * before file, or all of them when file is NULL. Under -f neither list is
+ * sorted, and the hidden ones come last. */
+void dirs_add_hidden(ftls_ctx *ctx, t_dirs *dirs, const char *path, size_t path_len, int depth,
+                     const t_listing *listing, int *next, const t_file *file, int options)
+{
+    const t_listing *hidden = listing->hidden;
+
+    while (hidden != NULL && *next < hidden->count &&
+           (file == NULL || (!(options & FLAG_f) && compare_files(&hidden->files[*next], file, options) < 0)))
+        dirs_add(ctx, dirs, path, path_len, depth, &hidden->files[(*next)++]);
+}
+
+/* Queues the subdirectories of a listing for -R, listed or hidden, in the
+ * order they sort. */
+void dirs_add_listing(ftls_ctx *ctx, t_dirs *dirs, const char *path, size_t path_len, int depth,
+                      const t_listing *listing, int options)
+{
+    int next = 0;
+
+    for (int i = 0; i < listing->count; i++)
+    {
+        dirs_add_hidden(ctx, dirs, path, path_len, depth, listing, &next, &listing->files[i], options);
+        dirs_add(ctx, dirs, path, path_len, depth, &listing->files[i]);
+    }
+    dirs_add_hidden(ctx, dirs, path, path_len, depth, listing, &next, NULL, options);
+}
+
+/* Whether the -R block of a directory depth levels down is printed. */
+bool walk_shown(const ftls_ctx *ctx, int options, int depth)
+{
+    return !(options & FLAG_R) || depth >= ctx->min_depth;
+}
+
+/* "path:" before the block of a directory below the operand, after a blank
+ * line unless it is the first block shown. */
+void walk_header(ftls_ctx *ctx, const char *path, size_t path_len, int depth)
+{
+    if (depth > 0)
+    {
+        if (ctx->block_shown)
+            buffered_write(ctx, "\n", 1);
+        quote_write(ctx, path, path_len);
+        buffered_write(ctx, ":\n", 2);
+    }
+    ctx->block_shown = true;
+}
+
+static void list_directory(ftls_ctx *ctx, const char *path, int options, DIR* dir, int depth)
+{
+    t_listing *listing = &ctx->listing;
+    t_walk_level level;
+    size_t path_len = strlen(path);
+    bool shown = walk_shown(ctx, options, depth);
+
+    ft_list_init(&level.dirs, sizeof(dirs_todo));
+    if (shown)
+        walk_header(ctx, path, path_len, depth);
+    /* Levels above --min-depth are only walked: no owners, no spilling. */
+    scan_directory(ctx, listing, path, dir, shown ? options | FLAG_SPILL : options & ~FLAG_l);
+    checksum_wait(listing);
+
+    if (listing->spill != NULL)
+        spill_display(ctx, listing, path, options, (options & FLAG_R) ? &level.dirs : NULL, depth);
+    else
+    {
+        if (shown)
+            display_files(ctx, listing->files, listing->count, options, listing->max_len, &listing->widths);
+        if (options & FLAG_R)
+            dirs_add_listing(ctx, &level.dirs, path, path_len, depth, listing, options);
+    }
+    walk_queued(ctx, &level, options);
+    ft_list_destroy(&level.dirs);
+}
+
+/* Lists the directories queued in level, each with everything below it.
+ * Entries are popped once their subtree is done, so the queue of every
+ * level shrinks as the walk goes deeper; between two directories,
+ * --checkpoint may save the queues of all the levels. */
+void walk_queued(ftls_ctx *ctx, t_walk_level *level, int options)
+{
+    dirs_todo *entry;
+
+    level->up = ctx->walk_top;
+    ctx->walk_top = level;
+    while ((entry = ft_list_get_first(&level->dirs)) != NULL)
+    {
+        DIR* subdir;
+        if (ctx->checkpoint_out != NULL)
+            checkpoint_tick(ctx);
+        if (open_directory(ctx, entry->path, &subdir))
+            list_directory(ctx, entry->path, options, subdir, entry->depth);
+        ft_list_pop_first(&level->dirs, NULL);
+    }
+    ctx->walk_top = level->up;
+}
+
+/* -R runs as a scan/render pipeline unless --max-memory is set: spilled
+ * listings are merged at display time, after the walk would need them.
+ * Nor with --deadline, whose helper serves one scan at a time, nor with
+ * --checkpoint, which saves the frontier of the sequential walk. */
+static void list_tree(ftls_ctx *ctx, const char *path, int options, DIR *dir)
+{
+    walk_begin(ctx, path);
+    if ((options & FLAG_R) && ctx->max_memory == 0 && ctx->deadline_ms == 0 &&
+        ctx->checkpoint_out == NULL && list_pipelined(ctx, path, options, dir))
+        return;
+    list_directory(ctx, path, options, dir, 0);
+}
+
+static void init_ws_cols(ftls_ctx *ctx)
+{
+    if (ctx->ws_cols > 0)
+    {
+        return;
+    }
+    struct winsize ws;
+    if (ioctl(ctx->out_fd, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+    {
+        ws.ws_col = 80;
+    }
+    ctx->ws_cols = ws.ws_col;
+}
+
+/* Lists one operand, after a "path:" header when there are several, and
+ * with "estimate" sizes it instead. *first is cleared once something is
+ * shown: the blocks of later operands are set off by a blank line. */
+static int list_operand(ftls_ctx *ctx, const char *path, bool header, bool *first)
+{
+    DIR *dir;
+
+    if (ctx->estimate_budget > 0)
+    {
+        if (!*first)
+            buffered_write(ctx, "\n", 1);
+        *first = false;
+        return estimate_tree(ctx, path);
+    }
+    if (!open_directory(ctx, path, &dir))
+        return 1;
+    /* Under --min-depth every block shown has its own header. */
+    if (header && walk_shown(ctx, ctx->flags, 0))
+    {
+        if (!*first)
+            buffered_write(ctx, "\n", 1);
+        quote_write(ctx, path, strlen(path));
+        buffered_write(ctx, ":\n", 2);
+        *first = false;
+    }
+    list_tree(ctx, path, ctx->flags, dir);
+    if (ctx->block_shown)
+        *first = false;
+    return 0;
+}
+
+# define FILES_FROM_READ_SIZE 65536
+
+/* --files0-from: the operands are NUL-terminated paths read from fd, each
+ * listed as soon as it is complete, so memory stays at one read and one
+ * path however long the input. Output is flushed before every read, which
+ * may block, so a consumer down the pipe gets each path's block without
+ * waiting for the next. A path longer than PATH_MAX is reported and
+ * skipped; an unterminated last one is listed. */
+static int list_paths_from(ftls_ctx *ctx, int fd)
+{
+    char *chunk = malloc(FILES_FROM_READ_SIZE);
+    char path[PATH_MAX];
+    size_t path_len = 0;
+    bool too_long = false;
+    bool pending = false;
+    bool first = true;
+    int status = 0;
+    ssize_t n = 0;
+
+    if (chunk == NULL)
+        return 1;
+    while (!ctx->deadline_hit)
+    {
+        flush_output(ctx);
+        n = read(fd, chunk, FILES_FROM_READ_SIZE);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        for (char *p = chunk, *end = chunk + n; p < end; )
+        {
+            char *nul = memchr(p, '\0', end - p);
+            size_t len = (nul ? nul : end) - p;
+
+            /* What fits is kept for the error message. */
+            if (path_len + len >= PATH_MAX)
+            {
+                too_long = true;
+                len = PATH_MAX - 1 - path_len;
+            }
+            memcpy(path + path_len, p, len);
+            path_len += len;
+            pending = true;
+            if (nul == NULL)
+                break;
+            p = nul + 1;
+            path[path_len] = '\0';
+            if (too_long)
+                report_error(ctx, "Cannot access", path, ENAMETOOLONG);
+            status |= too_long ? 1 : list_operand(ctx, path, true, &first);
+            path_len = 0;
+            too_long = false;
+            pending = false;
+        }
+    }
+    if (n == -1)
+    {
+        report_error(ctx, "Cannot read file list", ctx->files_from, errno);
+        status = 1;
+    }
+    else if (pending && !ctx->deadline_hit)
+    {
+        path[path_len] = '\0';
+        if (too_long)
+            report_error(ctx, "Cannot access", path, ENAMETOOLONG);
+        status |= too_long ? 1 : list_operand(ctx, path, true, &first);
+    }
+    free(chunk);
+    return status;
+}
+
+static int list_files_from(ftls_ctx *ctx)
+{
+    bool standard_input = strcmp(ctx->files_from, "-") == 0;
+    int fd = standard_input ? STDIN_FILENO : openat(ctx->cwd_fd, ctx->files_from, O_RDONLY | O_CLOEXEC);
+    int status;
+
+    if (fd == -1)
+    {
+        report_error(ctx, "Cannot open file list", ctx->files_from, errno);
+        return 1;
+    }
+    status = list_paths_from(ctx, fd);
+    if (!standard_input)
+        close(fd);
+    return status;
+}
+
+static int list_operands(ftls_ctx *ctx, const char *const *paths, int count)
+{
+    int status = 0;
+    int start = 0;
+    bool first = true;
+
+    if (ctx->files_from != NULL && count > 0)
+    {
+        if (ctx->err_fd >= 0)
+            write(ctx->err_fd, "ft_ls: --files0-from takes no operands\n", 39);
+        return 1;
+    }
+    if (ctx->files_from != NULL && (ctx->checkpoint_out != NULL || ctx->resume != NULL))
+    {
+        if (ctx->err_fd >= 0)
+            write(ctx->err_fd, "ft_ls: --checkpoint and --resume need operands, not --files0-from\n", 66);
+        return 1;
+    }
+    if (ctx->snapshot_out != NULL)
+    {
+        if (count <= 1 && ctx->files_from == NULL)
+            return snapshot_write(ctx, count == 1 ? paths[0] : ".", ctx->snapshot_out);
+        if (ctx->err_fd >= 0)
+            write(ctx->err_fd, "ft_ls: --snapshot-write takes a single directory\n", 49);
+        return 1;
+    }
+    if (ctx->estimate_budget == 0)
+    {
+        if (!(ctx->flags & FLAG_l))
+            init_ws_cols(ctx);
+        deadline_arm(ctx);
+    }
+
+    if (ctx->files_from != NULL)
+        status = list_files_from(ctx);
+    else if (ctx->checkpoint_out != NULL)
+        checkpoint_begin(ctx);
+    if (ctx->resume != NULL && (start = checkpoint_resume(ctx, paths, count, &first)) < 0)
+        return 1;
+    for (int i = start; i < count || (count == 0 && ctx->files_from == NULL && i == 0); i++)
+    {
+        ctx->walk_operand = i;
+        ctx->walk_root = count > 0 ? paths[i] : ".";
+        status |= list_operand(ctx, ctx->walk_root, count > 1, &first);
+    }
+    ctx->walk_root = NULL;
+
+    flush_output(ctx);
+    checkpoint_finish(ctx);
+    return ctx->estimate_budget > 0 ? status : deadline_status(ctx, status);
+}
+
+int ftls_list(ftls_ctx *ctx, const char *const *paths, int count)
+{
+    int status;
+
+    throttle_begin(ctx);
+    status = list_operands(ctx, paths, count);
+    throttle_end(ctx);
+    return status;
+}
+
+ftls_iter *ftls_opendir(ftls_ctx *ctx, const char *path)
+{
+    DIR *dir;
+    ftls_iter *iter;
+
+    deadline_arm(ctx);
+    if (!open_directory(ctx, path, &dir))
+        return NULL;
+    iter = calloc(1, sizeof(ftls_iter));
+    iter->ctx = ctx;
+    scan_directory(ctx, &iter->listing, path, dir, (ctx->flags & ~(FLAG_l | FLAG_R)) | FLAG_STAT | FLAG_CHECKSUM);
+    checksum_wait(&iter->listing);
+    return iter;
+}
+
+int ftls_next(ftls_iter *iter, ftls_entry *entry)
+{
+    const t_file *file;
+
+    if (iter->position >= iter->listing.count)
+        return 0;
+    file = &iter->listing.files[iter->position++];
+    entry->name = file->name;
+    entry->name_len = file->name_len;
+    entry->st = &file->info;
+    entry->link_target = S_ISLNK(file->info.st_mode) ? file->link_target : NULL;
+    entry->link_len = file->link_len;
+    entry->has_checksum = iter->ctx->checksum != CHECKSUM_NONE && file->checksum_state == CHECKSUM_STATE_OK;
+    entry->checksum = entry->has_checksum ? file->checksum : 0;
+    entry->unresolved = file->unresolved;
+    return 1;
+}
+
+void ftls_closedir(ftls_iter *iter)
+{
+    if (iter == NULL)
+        return;
+    free_listing(&iter->listing);
+    free(iter);
+}
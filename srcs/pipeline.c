@@ -0,0 +1,231 @@
+#include "ftls_internal.h"
+#include <pthread.h>
+
+/* Two-stage -R listing. A prefetch thread walks the tree in output order,
+ * scanning, stat'ing and sorting each directory into a listing of its
+ * own, and queues the ready listings; the calling thread only renders.
+ * The disk keeps working on the next directories while the current one
+ * is formatted and written.
+ *
+ * Only the prefetch thread scans, so it alone touches the owner/group
+ * caches (the names it hands over are stable heap copies). Only the
+ * rendering thread touches the output buffer and the time cache. */
+
+# define PIPELINE_DEPTH 8
+/* Stages keep their scan buffers warm up to this many entries; larger
+ * listings are released after rendering so a few huge directories do not
+ * pin their peak size in every stage. */
+# define STAGE_KEEP_FILES 256
+
+typedef struct
+{
+    t_listing listing;
+    char path[PATH_MAX];
+    size_t path_len;
+    int depth;                  /* levels below the operand */
+    bool shown;                 /* false above --min-depth: only walked */
+} t_stage;
+
+/* PIPELINE_DEPTH + 2 stages circulate between the free pool, the scanner,
+ * the ready queue and the renderer; the ready ring has room for all of
+ * them so pushing never blocks. A waiting renderer is woken by the first
+ * ready stage: it only waits once it has drained the queue, so holding
+ * stages back would leave it idle. A waiting scanner is woken once half
+ * of the stages are free, so a warm walk whose renderer lags does not
+ * pay two context switches per directory. */
+typedef struct
+{
+    ftls_ctx *ctx;
+    int options;
+    t_stage *ready[PIPELINE_DEPTH + 2];
+    int head;
+    int count;
+    bool done;
+    t_stage *free_stages[PIPELINE_DEPTH + 2];
+    int free_count;
+    bool scanner_waiting;
+    bool renderer_waiting;
+    pthread_mutex_t lock;
+    pthread_cond_t stage_free;
+    pthread_cond_t stage_ready;
+    const char *root;
+    DIR *root_dir;
+} t_pipeline;
+
+/* Called with the lock held. */
+static void wake_renderer(t_pipeline *pipeline)
+{
+    if (pipeline->renderer_waiting)
+    {
+        pipeline->renderer_waiting = false;
+        pthread_cond_signal(&pipeline->stage_ready);
+    }
+}
+
+static t_stage *stage_get(t_pipeline *pipeline)
+{
+    t_stage *stage;
+
+    pthread_mutex_lock(&pipeline->lock);
+    while (pipeline->free_count == 0)
+    {
+        wake_renderer(pipeline);
+        pipeline->scanner_waiting = true;
+        pthread_cond_wait(&pipeline->stage_free, &pipeline->lock);
+    }
+    stage = pipeline->free_stages[--pipeline->free_count];
+    pthread_mutex_unlock(&pipeline->lock);
+    return stage;
+}
+
+static void stage_put(t_pipeline *pipeline, t_stage *stage)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->free_stages[pipeline->free_count++] = stage;
+    if (pipeline->scanner_waiting && pipeline->free_count >= (PIPELINE_DEPTH + 2) / 2)
+    {
+        pipeline->scanner_waiting = false;
+        pthread_cond_signal(&pipeline->stage_free);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+static void stage_push(t_pipeline *pipeline, t_stage *stage)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->ready[(pipeline->head + pipeline->count) % (PIPELINE_DEPTH + 2)] = stage;
+    pipeline->count++;
+    wake_renderer(pipeline);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+/* NULL once the walk is over and everything has been rendered. */
+static t_stage *stage_pop(t_pipeline *pipeline)
+{
+    t_stage *stage = NULL;
+
+    pthread_mutex_lock(&pipeline->lock);
+    while (pipeline->count == 0 && !pipeline->done)
+    {
+        pipeline->renderer_waiting = true;
+        pthread_cond_wait(&pipeline->stage_ready, &pipeline->lock);
+    }
+    if (pipeline->count > 0)
+    {
+        stage = pipeline->ready[pipeline->head];
+        pipeline->head = (pipeline->head + 1) % (PIPELINE_DEPTH + 2);
+        pipeline->count--;
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return stage;
+}
+
+static void prefetch_directory(t_pipeline *pipeline, const char *path, size_t path_len, DIR *dir, int depth)
+{
+    t_stage *stage = stage_get(pipeline);
+    t_dirs dirs;
+    dirs_todo *entry;
+    int options = pipeline->options;
+
+    memcpy(stage->path, path, path_len + 1);
+    stage->path_len = path_len;
+    stage->depth = depth;
+    stage->shown = walk_shown(pipeline->ctx, options, depth);
+    scan_directory(pipeline->ctx, &stage->listing, path, dir, stage->shown ? options : options & ~FLAG_l);
+    ft_list_init(&dirs, sizeof(dirs_todo));
+
+    /* Queue the subdirectories before handing the listing over. */
+    dirs_add_listing(pipeline->ctx, &dirs, path, path_len, depth, &stage->listing, options);
+    stage_push(pipeline, stage);
+
+    while ((entry = ft_list_get_first(&dirs)) != NULL)
+    {
+        DIR *subdir;
+        if (open_directory(pipeline->ctx, entry->path, &subdir))
+            prefetch_directory(pipeline, entry->path, entry->path_len, subdir, entry->depth);
+        ft_list_pop_first(&dirs, NULL);
+    }
+    ft_list_destroy(&dirs);
+}
+
+static void *prefetch_main(void *arg)
+{
+    t_pipeline *pipeline = arg;
+
+    prefetch_directory(pipeline, pipeline->root, strlen(pipeline->root), pipeline->root_dir, 0);
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->done = true;
+    wake_renderer(pipeline);
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+/* Lists path and everything below it like list_directory with -R. Returns
+ * false, having done nothing, under --pipeline=never, if the prefetch
+ * thread cannot start, or under the default --pipeline=auto on a single
+ * CPU when path is on a memory-backed filesystem or in a snapshot: with no
+ * I/O to overlap the thread only adds handoffs. --pipeline=always takes it
+ * anywhere, so the tests can compare the two walks on any host. */
+bool list_pipelined(ftls_ctx *ctx, const char *path, int options, DIR *dir)
+{
+    t_pipeline pipeline;
+    t_stage *stages;
+    t_stage *stage;
+    pthread_t thread;
+
+    if (strlen(path) >= PATH_MAX || ctx->pipeline == PIPELINE_NEVER)
+        return false;
+    if (ctx->pipeline == PIPELINE_AUTO && sysconf(_SC_NPROCESSORS_ONLN) < 2 &&
+        (dir == NULL || fs_type_of(ctx, dirfd(dir))->diskless))
+        return false;
+    stages = calloc(PIPELINE_DEPTH + 2, sizeof(t_stage));
+    if (stages == NULL)
+        return false;
+
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.ctx = ctx;
+    pipeline.options = options;
+    pipeline.root = path;
+    pipeline.root_dir = dir;
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.stage_free, NULL);
+    pthread_cond_init(&pipeline.stage_ready, NULL);
+    for (int i = 0; i < PIPELINE_DEPTH + 2; i++)
+        pipeline.free_stages[pipeline.free_count++] = &stages[i];
+
+    if (pthread_create(&thread, NULL, prefetch_main, &pipeline) != 0)
+    {
+        pthread_cond_destroy(&pipeline.stage_free);
+        pthread_cond_destroy(&pipeline.stage_ready);
+        pthread_mutex_destroy(&pipeline.lock);
+        free(stages);
+        return false;
+    }
+
+    while ((stage = stage_pop(&pipeline)) != NULL)
+    {
+        checksum_wait(&stage->listing);
+        if (stage->shown)
+        {
+            walk_header(ctx, stage->path, stage->path_len, stage->depth);
+            display_files(ctx, stage->listing.files, stage->listing.count, options,
+                          stage->listing.max_len, &stage->listing.widths);
+        }
+        if (stage->listing.count > STAGE_KEEP_FILES)
+        {
+            free_listing(&stage->listing);
+            memset(&stage->listing, 0, sizeof(stage->listing));
+        }
+        stage_put(&pipeline, stage);
+    }
+
+    pthread_join(thread, NULL);
+    for (int i = 0; i < PIPELINE_DEPTH + 2; i++)
+        free_listing(&stages[i].listing);
+    free(stages);
+    pthread_cond_destroy(&pipeline.stage_free);
+    pthread_cond_destroy(&pipeline.stage_ready);
+    pthread_mutex_destroy(&pipeline.lock);
+    return true;
+}
@@ -0,0 +1,196 @@
+#include "ftls_internal.h"
+#include <fcntl.h>
+
+/* Inode-ordered stat pass. ext4 and the other btree directories return
+ * entries in hash order, so stat'ing them as readdir hands them out
+ * visits the inode tables at random: on a cold rotating disk, a seek per
+ * entry. scan_directory instead reads up to PRESTAT_CHUNK entries ahead,
+ * stats them by ascending inode number, and then hands them out in
+ * readdir order with their stat ready: -f order and everything
+ * downstream is unchanged. Only filesystems whose inode numbers follow
+ * the disk layout get the pass (t_fs_type.inode_order). The buffers
+ * belong to the context and are reused by every directory. */
+
+# define PRESTAT_CHUNK 4096
+/* Fewer entries are stat'ed in readdir order: nothing to gain. */
+# define PRESTAT_SORT_MIN 32
+
+typedef struct
+{
+    uint32_t name;              /* offset into names */
+    unsigned char d_type;
+    ino_t ino;
+    int error;                  /* errno of the stat, 0 once it worked */
+    struct stat st;
+} t_prestat_entry;
+
+typedef struct
+{
+    ino_t ino;
+    uint32_t index;
+} t_prestat_order;
+
+struct t_prestat
+{
+    DIR *dir;
+    int options;
+    const t_filter *filter;
+    t_throttle *throttle;
+    t_prestat_entry *entries;
+    t_prestat_order *order;
+    char *names;
+    size_t names_size;
+    int count;
+    int next;
+    bool end;
+    struct dirent current;
+};
+
+static int compare_ino(const void *a, const void *b)
+{
+    ino_t x = ((const t_prestat_order *)a)->ino;
+    ino_t y = ((const t_prestat_order *)b)->ino;
+
+    return (x > y) - (x < y);
+}
+
+/* Reads the next chunk, skipping what scan_directory would drop before a
+ * stat, and stats it in inode order. */
+static void prestat_fill(t_prestat *prestat)
+{
+    struct dirent *entry;
+    size_t used = 0;
+    int sorted = 0;
+
+    prestat->count = 0;
+    prestat->next = 0;
+    while (prestat->count < PRESTAT_CHUNK)
+    {
+        /* Room for the longest name before readdir: an entry it has
+         * handed out cannot be put back. Out of memory, the chunk ends
+         * here and the next one starts with that entry. */
+        if (used + NAME_MAX + 1 > prestat->names_size)
+        {
+            char *grown = realloc(prestat->names, prestat->names_size * 2);
+            if (grown == NULL)
+                break;
+            prestat->names = grown;
+            prestat->names_size *= 2;
+        }
+        if ((entry = readdir(prestat->dir)) == NULL)
+        {
+            prestat->end = true;
+            break;
+        }
+
+        size_t name_len = strlen(entry->d_name);
+        t_prestat_entry *slot = &prestat->entries[prestat->count];
+
+        if (entry->d_name[0] == '.' && !(prestat->options & FLAG_a))
+            continue;
+        if (filter_active(prestat->filter) &&
+            !filter_name(prestat->filter, entry->d_name, name_len, entry->d_type, prestat->options))
+            continue;
+        slot->name = used;
+        slot->d_type = entry->d_type;
+        slot->ino = entry->d_ino;
+        memcpy(prestat->names + used, entry->d_name, name_len + 1);
+        used += name_len + 1;
+        prestat->order[sorted].ino = entry->d_ino;
+        prestat->order[sorted].index = prestat->count;
+        sorted++;
+        prestat->count++;
+    }
+
+    if (sorted >= PRESTAT_SORT_MIN)
+        qsort(prestat->order, sorted, sizeof(t_prestat_order), compare_ino);
+    for (int i = 0; i < sorted; i++)
+    {
+        t_prestat_entry *slot = &prestat->entries[prestat->order[i].index];
+        const char *name = prestat->names + slot->name;
+        int result = prestat->throttle ?
+                     throttled_fstatat(prestat->throttle, dirfd(prestat->dir), name, &slot->st) :
+                     fstatat(dirfd(prestat->dir), name, &slot->st, AT_SYMLINK_NOFOLLOW);
+
+        slot->error = result == -1 ? errno : 0;
+    }
+}
+
+/* Starts the pass over dir, whose every entry scan_directory stats. NULL
+ * if its filesystem does not benefit or out of memory: then the entries
+ * are read and stat'ed one by one as before. */
+t_prestat *prestat_begin(ftls_ctx *ctx, DIR *dir, int options, const t_fs_type *fs, t_throttle *throttle)
+{
+    t_prestat *prestat = ctx->prestat;
+
+    if (!fs->inode_order)
+        return NULL;
+    if (prestat == NULL)
+    {
+        prestat = calloc(1, sizeof(t_prestat));
+        if (prestat == NULL)
+            return NULL;
+        prestat->entries = malloc(PRESTAT_CHUNK * sizeof(t_prestat_entry));
+        prestat->order = malloc(PRESTAT_CHUNK * sizeof(t_prestat_order));
+        prestat->names_size = PRESTAT_CHUNK * 16;
+        prestat->names = malloc(prestat->names_size);
+        ctx->prestat = prestat;
+        if (prestat->entries == NULL || prestat->order == NULL || prestat->names == NULL)
+        {
+            prestat_free(ctx);
+            return NULL;
+        }
+    }
+    prestat->dir = dir;
+    prestat->options = options;
+    prestat->filter = &ctx->filter;
+    prestat->throttle = throttle;
+    prestat->count = 0;
+    prestat->next = 0;
+    prestat->end = false;
+    return prestat;
+}
+
+struct dirent *prestat_next(t_prestat *prestat)
+{
+    const t_prestat_entry *slot;
+
+    if (prestat->next == prestat->count)
+    {
+        if (prestat->end)
+            return NULL;
+        prestat_fill(prestat);
+        if (prestat->count == 0)
+            return NULL;
+    }
+    slot = &prestat->entries[prestat->next++];
+    prestat->current.d_ino = slot->ino;
+    prestat->current.d_type = slot->d_type;
+    strcpy(prestat->current.d_name, prestat->names + slot->name);
+    return &prestat->current;
+}
+
+/* The stat of the entry prestat_next returned last, like fstatat. */
+int prestat_stat(t_prestat *prestat, struct stat *st)
+{
+    const t_prestat_entry *slot = &prestat->entries[prestat->next - 1];
+
+    if (slot->error != 0)
+    {
+        errno = slot->error;
+        return -1;
+    }
+    *st = slot->st;
+    return 0;
+}
+
+void prestat_free(ftls_ctx *ctx)
+{
+    if (ctx->prestat == NULL)
+        return;
+    free(ctx->prestat->entries);
+    free(ctx->prestat->order);
+    free(ctx->prestat->names);
+    free(ctx->prestat);
+    ctx->prestat = NULL;
+}
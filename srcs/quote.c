@@ -0,0 +1,251 @@
+#include "ftls_internal.h"
+#include <wchar.h>
+#include <wctype.h>
+#ifdef __AVX2__
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+/* -b, -q and -Q: names written so that a terminal shows them as they are
+ * and a newline in one cannot pass for the start of another. Like GNU ls:
+ *
+ *   escape  (-b) C escapes (\n, \t, \ooo) for nonprintable bytes, and a
+ *                backslash before backslashes and spaces
+ *   c       (-Q) the same inside double quotes, escaping '"' rather than
+ *                spaces
+ *   literal      names as they are, or with -q every nonprintable
+ *                character as '?'
+ *
+ * Characters printable in the locale's multibyte encoding are kept.
+ * Almost every name is printable ASCII with nothing to escape, so
+ * quote_plain measures the span of a name that is written as it is, 32 or
+ * 16 bytes per compare where the CPU has vectors, and only the bytes it
+ * stops at go through quote_special one character at a time. The column
+ * widths are those of the quoted names. */
+
+bool quote_parse(const char *value, quoting_style *style)
+{
+    if (strcmp(value, "literal") == 0)
+        *style = QUOTE_LITERAL;
+    else if (strcmp(value, "escape") == 0)
+        *style = QUOTE_ESCAPE;
+    else if (strcmp(value, "c") == 0)
+        *style = QUOTE_C;
+    else
+        return false;
+    return true;
+}
+
+/* False when names are written as they are. */
+bool quote_active(const ftls_ctx *ctx)
+{
+    return ctx->quoting != QUOTE_LITERAL || ctx->hide_control;
+}
+
+/* The printable ASCII characters the style escapes in a name or, in a
+ * "path:" header, where GNU ls leaves spaces alone but escapes ':'.
+ * Unused slots are DEL, which is never written as it is anyway. */
+static void escaped_chars(quoting_style style, bool path, unsigned char chars[3])
+{
+    chars[0] = style == QUOTE_LITERAL ? 0x7f : '\\';
+    chars[1] = style == QUOTE_C ? '"' : 0x7f;
+    chars[2] = style == QUOTE_LITERAL ? 0x7f : path ? ':' : style == QUOTE_ESCAPE ? ' ' : 0x7f;
+}
+
+/* How many bytes at the start of name are written as they are. Signed
+ * compares put the bytes from 0x80 up below ' ' with the control
+ * characters: anything outside ASCII takes the slow path. */
+static size_t plain_span(const ftls_ctx *ctx, const char *name, size_t len, bool path)
+{
+    unsigned char chars[3];
+    size_t i = 0;
+
+    escaped_chars(ctx->quoting, path, chars);
+#ifdef __AVX2__
+    {
+        const __m256i space = _mm256_set1_epi8(' ');
+        const __m256i del = _mm256_set1_epi8(0x7f);
+        const __m256i a = _mm256_set1_epi8((char)chars[0]);
+        const __m256i b = _mm256_set1_epi8((char)chars[1]);
+        const __m256i c = _mm256_set1_epi8((char)chars[2]);
+
+        for (; i + 32 <= len; i += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(name + i));
+            __m256i special = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpgt_epi8(space, v), _mm256_cmpeq_epi8(v, del)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, a),
+                                _mm256_or_si256(_mm256_cmpeq_epi8(v, b), _mm256_cmpeq_epi8(v, c))));
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(special);
+
+            if (mask != 0)
+                return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+    {
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i del = _mm_set1_epi8(0x7f);
+        const __m128i a = _mm_set1_epi8((char)chars[0]);
+        const __m128i b = _mm_set1_epi8((char)chars[1]);
+        const __m128i c = _mm_set1_epi8((char)chars[2]);
+
+        for (; i + 16 <= len; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(name + i));
+            __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, a),
+                             _mm_or_si128(_mm_cmpeq_epi8(v, b), _mm_cmpeq_epi8(v, c))));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(special);
+
+            if (mask != 0)
+                return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < len; i++)
+    {
+        unsigned char byte = (unsigned char)name[i];
+
+        if (byte < 0x20 || byte >= 0x7f || byte == chars[0] || byte == chars[1] || byte == chars[2])
+            break;
+    }
+    return i;
+}
+
+size_t quote_plain(const ftls_ctx *ctx, const char *name, size_t len)
+{
+    return plain_span(ctx, name, len, false);
+}
+
+/* Writes to out what stands for the character at the start of name, which
+ * quote_plain stopped at, and returns how many bytes of name it took.
+ * *width, when asked for, is how many columns out takes on a terminal:
+ * wcwidth for a multibyte character kept as it is, else its length. */
+size_t quote_special(const ftls_ctx *ctx, const char *name, size_t len, char *out, size_t *out_len,
+                     size_t *width)
+{
+    /* Control characters and their letters: only the former can match. */
+    static const char escapes[] = "\aa\bb\ff\nn\rr\tt\vv";
+    unsigned char c = (unsigned char)name[0];
+    const char *escape;
+
+    if (c >= 0x80 && MB_CUR_MAX > 1)
+    {
+        mbstate_t state;
+        wchar_t wc;
+        size_t n;
+
+        memset(&state, 0, sizeof(state));
+        n = mbrtowc(&wc, name, len, &state);
+        if (n != (size_t)-1 && n != (size_t)-2 && n > 0 && iswprint(wc))
+        {
+            memcpy(out, name, n);
+            *out_len = n;
+            if (width != NULL)
+                *width = wcwidth(wc) < 0 ? 1 : (size_t)wcwidth(wc);
+            return n;
+        }
+        /* -q shows a whole nonprintable character as one '?'. */
+        if (ctx->quoting == QUOTE_LITERAL && n != (size_t)-1 && n != (size_t)-2 && n > 0)
+        {
+            out[0] = '?';
+            *out_len = 1;
+            if (width != NULL)
+                *width = 1;
+            return n;
+        }
+    }
+    if (c >= 0x20 && c < 0x7f)
+    {
+        out[0] = '\\';
+        out[1] = (char)c;
+        *out_len = 2;
+    }
+    else if (ctx->quoting == QUOTE_LITERAL)
+    {
+        out[0] = ctx->hide_control ? '?' : (char)c;
+        *out_len = 1;
+    }
+    else if ((escape = memchr(escapes, c, sizeof(escapes) - 1)) != NULL)
+    {
+        out[0] = '\\';
+        out[1] = escape[1];
+        *out_len = 2;
+    }
+    else
+    {
+        out[0] = '\\';
+        out[1] = (char)('0' + (c >> 6));
+        out[2] = (char)('0' + ((c >> 3) & 7));
+        out[3] = (char)('0' + (c & 7));
+        *out_len = 4;
+    }
+    if (width != NULL)
+        *width = *out_len;
+    return 1;
+}
+
+/* The columns name takes as written: a byte each for what quote_plain
+ * passes, the display width of the rest. */
+size_t quote_width(const ftls_ctx *ctx, const char *name, size_t len)
+{
+    char out[QUOTE_SPECIAL_MAX];
+    size_t width = ctx->quoting == QUOTE_C ? 2 : 0;
+    size_t plain;
+    size_t used;
+    size_t out_len;
+    size_t special;
+
+    if (!quote_active(ctx))
+        return len;
+    while (len > 0)
+    {
+        plain = quote_plain(ctx, name, len);
+        width += plain;
+        name += plain;
+        len -= plain;
+        if (len == 0)
+            break;
+        used = quote_special(ctx, name, len, out, &out_len, &special);
+        width += special;
+        name += used;
+        len -= used;
+    }
+    return width;
+}
+
+/* Writes a path quoted, for the headers and --diff lines. */
+void quote_write(ftls_ctx *ctx, const char *name, size_t len)
+{
+    char out[QUOTE_SPECIAL_MAX];
+    size_t plain;
+    size_t used;
+    size_t out_len;
+
+    if (!quote_active(ctx))
+    {
+        buffered_write(ctx, name, len);
+        return;
+    }
+    if (ctx->quoting == QUOTE_C)
+        buffered_write(ctx, "\"", 1);
+    while (len > 0)
+    {
+        plain = plain_span(ctx, name, len, true);
+        buffered_write(ctx, name, plain);
+        name += plain;
+        len -= plain;
+        if (len == 0)
+            break;
+        used = quote_special(ctx, name, len, out, &out_len, NULL);
+        buffered_write(ctx, out, out_len);
+        name += used;
+        len -= used;
+    }
+    if (ctx->quoting == QUOTE_C)
+        buffered_write(ctx, "\"", 1);
+}
@@ -0,0 +1,779 @@
+#include "ftls_internal.h"
+#include <pwd.h>
+#include <grp.h>
+#include <time.h>
+#include <ctype.h>
+#include <strings.h>
+#include <pthread.h>
+
+static const uint64_t g_pow10[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static const char g_digit_pairs[201] =
+    "00010203040506070809" "10111213141516171819" "20212223242526272829"
+    "30313233343536373839" "40414243444546474849" "50515253545556575859"
+    "60616263646566676869" "70717273747576777879" "80818283848586878889"
+    "90919293949596979899";
+
+/* Decimal digits of n: log10 estimated from the bit length, corrected
+ * with one table compare. */
+static inline int count_digits(uint64_t n)
+{
+    int t = ((64 - __builtin_clzll(n | 1)) * 1233) >> 12;
+    /* n | 1 so that 0 has one digit; powers of ten past 1 are even. */
+    return t - ((n | 1) < g_pow10[t]) + 1;
+}
+
+/* Writes the `digits` decimal digits of n ending at out + digits. */
+static inline void write_digits(char *out, uint64_t n, int digits)
+{
+    char *pos = out + digits;
+
+    while (n >= 100)
+    {
+        pos -= 2;
+        memcpy(pos, g_digit_pairs + (n % 100) * 2, 2);
+        n /= 100;
+    }
+    if (n >= 10)
+    {
+        pos -= 2;
+        memcpy(pos, g_digit_pairs + n * 2, 2);
+    }
+    else
+        *--pos = '0' + n;
+}
+
+static char g_perm_table[512][9];
+static const char g_type_chars[16] = "?pc?d?b?-?l?s???";
+
+static void init_perm_table(void)
+{
+    static const char rwx[] = "rwx";
+
+    for (int mode = 0; mode < 512; mode++)
+        for (int bit = 0; bit < 9; bit++)
+            g_perm_table[mode][bit] = (mode & (0400 >> bit)) ? rwx[bit % 3] : '-';
+}
+
+static void get_permissions(mode_t mode, char *buffer)
+{
+    buffer[0] = g_type_chars[(mode & S_IFMT) >> 12];
+    memcpy(buffer + 1, g_perm_table[mode & 0777], 9);
+    if (mode & (S_ISUID | S_ISGID | S_ISVTX))
+    {
+        if (mode & S_ISUID)
+            buffer[3] = (mode & S_IXUSR) ? 's' : 'S';
+        if (mode & S_ISGID)
+            buffer[6] = (mode & S_IXGRP) ? 's' : 'S';
+        if (mode & S_ISVTX)
+            buffer[9] = (mode & S_IXOTH) ? 't' : 'T';
+    }
+    buffer[10] = '\0';
+}
+
+static pthread_once_t g_render_once = PTHREAD_ONCE_INIT;
+
+/* The lookup tables are shared by every context and built once. */
+void render_init(void)
+{
+    pthread_once(&g_render_once, init_perm_table);
+}
+
+/* Entries in one listing mostly share a minute, so the broken-down time
+ * of the last call is reused instead of running localtime per row. */
+static void format_time(ftls_ctx *ctx, time_t file_time, char *buffer, size_t size)
+{
+    char *cached = ctx->cached_time;
+    static const char *months[] = {
+        "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+    };
+
+    if (size < 13)
+    {
+        if (size > 0) buffer[0] = '\0';
+        return;
+    }
+
+    time_t minute = file_time - (file_time % 60 + 60) % 60;
+    if (minute != ctx->cached_minute)
+    {
+        struct tm time_info;
+        /* Out of range for struct tm: shown as the epoch's day rather
+         * than read uninitialized. */
+        if (localtime_r(&file_time, &time_info) == NULL)
+            time_info = (struct tm){ .tm_mday = 1 };
+
+        const char *month = months[time_info.tm_mon];
+        cached[0] = month[0];
+        cached[1] = month[1];
+        cached[2] = month[2];
+        cached[3] = ' ';
+        memcpy(cached + 4, g_digit_pairs + time_info.tm_mday * 2, 2);
+        cached[6] = ' ';
+        memcpy(cached + 7, g_digit_pairs + time_info.tm_hour * 2, 2);
+        cached[9] = ':';
+        memcpy(cached + 10, g_digit_pairs + time_info.tm_min * 2, 2);
+        cached[12] = '\0';
+        ctx->cached_minute = minute;
+    }
+    memcpy(buffer, cached, 13);
+}
+
+static const uid_cache_entry* cache_uid_name(ftls_ctx *ctx, uid_t uid, const char *name)
+{
+    if (ctx->uid_cache_count == ctx->uid_cache_capacity)
+    {
+        ctx->uid_cache_capacity = ctx->uid_cache_capacity == 0 ? 64 : ctx->uid_cache_capacity * 2;
+        ctx->uid_cache = realloc(ctx->uid_cache, ctx->uid_cache_capacity * sizeof(uid_cache_entry));
+    }
+    ctx->uid_cache[ctx->uid_cache_count].uid = uid;
+    ctx->uid_cache[ctx->uid_cache_count].name = strdup(name);
+    ctx->uid_cache[ctx->uid_cache_count].len = strlen(name);
+    return &ctx->uid_cache[ctx->uid_cache_count++];
+}
+
+static const uid_cache_entry* get_uid_entry(ftls_ctx *ctx, uid_t uid)
+{
+    size_t last = ctx->uid_cache_last;
+
+    if (last < ctx->uid_cache_count && ctx->uid_cache[last].uid == uid)
+        return &ctx->uid_cache[last];
+    for (size_t i = 0; i < ctx->uid_cache_count; i++)
+        if (ctx->uid_cache[i].uid == uid)
+            return &ctx->uid_cache[ctx->uid_cache_last = i];
+
+    struct passwd pw_buf;
+    struct passwd *pw = NULL;
+    char buffer[NSS_BUFFER_SIZE];
+    getpwuid_r(uid, &pw_buf, buffer, sizeof(buffer), &pw);
+    ctx->uid_cache_last = ctx->uid_cache_count;
+    return cache_uid_name(ctx, uid, pw ? pw->pw_name : "");
+}
+
+static const gid_cache_entry* cache_gid_name(ftls_ctx *ctx, gid_t gid, const char *name)
+{
+    if (ctx->gid_cache_count == ctx->gid_cache_capacity)
+    {
+        ctx->gid_cache_capacity = ctx->gid_cache_capacity == 0 ? 64 : ctx->gid_cache_capacity * 2;
+        ctx->gid_cache = realloc(ctx->gid_cache, ctx->gid_cache_capacity * sizeof(gid_cache_entry));
+    }
+    ctx->gid_cache[ctx->gid_cache_count].gid = gid;
+    ctx->gid_cache[ctx->gid_cache_count].name = strdup(name);
+    ctx->gid_cache[ctx->gid_cache_count].len = strlen(name);
+    return &ctx->gid_cache[ctx->gid_cache_count++];
+}
+
+static const gid_cache_entry* get_gid_entry(ftls_ctx *ctx, gid_t gid)
+{
+    size_t last = ctx->gid_cache_last;
+
+    if (last < ctx->gid_cache_count && ctx->gid_cache[last].gid == gid)
+        return &ctx->gid_cache[last];
+    for (size_t i = 0; i < ctx->gid_cache_count; i++)
+        if (ctx->gid_cache[i].gid == gid)
+            return &ctx->gid_cache[ctx->gid_cache_last = i];
+
+    struct group gr_buf;
+    struct group *gr = NULL;
+    char buffer[NSS_BUFFER_SIZE];
+    getgrgid_r(gid, &gr_buf, buffer, sizeof(buffer), &gr);
+    ctx->gid_cache_last = ctx->gid_cache_count;
+    return cache_gid_name(ctx, gid, gr ? gr->gr_name : "UNKNOWN");
+}
+
+void free_caches(ftls_ctx *ctx)
+{
+    for (size_t i = 0; i < ctx->uid_cache_count; i++)
+        free((char *)ctx->uid_cache[i].name);
+    for (size_t i = 0; i < ctx->gid_cache_count; i++)
+        free((char *)ctx->gid_cache[i].name);
+    free(ctx->uid_cache);
+    free(ctx->gid_cache);
+}
+
+/* Resolves owner and group of a scanned entry and widens the -l columns
+ * to fit it, so display_files needs no second pass. An entry left
+ * unresolved by --deadline shows "?" for both. */
+void widths_add(ftls_ctx *ctx, t_widths *widths, t_file *file, int flags)
+{
+    int digits;
+
+    if (file->unresolved)
+    {
+        file->owner = "?";
+        file->group = "?";
+        file->owner_len = 1;
+        file->group_len = 1;
+        widths->link = widths->link > 1 ? widths->link : 1;
+        widths->size = widths->size > 1 ? widths->size : 1;
+        widths->owner = widths->owner > 1 ? widths->owner : 1;
+        widths->group = widths->group > 1 ? widths->group : 1;
+        return;
+    }
+
+    digits = count_digits(file->info.st_nlink);
+    if (digits > widths->link)
+        widths->link = digits;
+    digits = count_digits(file->info.st_size);
+    if (digits > widths->size)
+        widths->size = digits;
+
+    if (!(flags & FLAG_g))
+    {
+        const uid_cache_entry *user = get_uid_entry(ctx, file->info.st_uid);
+        file->owner = user->name;
+        file->owner_len = user->len;
+        if ((int)user->len > widths->owner)
+            widths->owner = user->len;
+    }
+
+    const gid_cache_entry *group = get_gid_entry(ctx, file->info.st_gid);
+    file->group = group->name;
+    file->group_len = group->len;
+    if ((int)group->len > widths->group)
+        widths->group = group->len;
+}
+
+/* --color. LS_COLORS is compiled once per context: two-letter type keys go
+ * into colors->types and "*.ext" keys into an open-addressed table whose
+ * hash seed and size are searched until no two extensions collide, so
+ * picking an entry's color is one hash and one compare. Multi-dot and
+ * other suffix patterns are rare and scanned linearly. Like GNU ls, when
+ * several patterns match, say "*.gz" and "*.tar.gz", the one set last in
+ * LS_COLORS wins, and case is ignored. */
+static const char g_color_keys[COLOR_COUNT][3] = {
+    "fi", "di", "ln", "pi", "so", "bd", "cd", "ex", "su", "sg", "tw", "ow", "st"
+};
+
+/* GNU ls built-in defaults, applied before LS_COLORS. */
+#define DEFAULT_LS_COLORS "di=01;34:ln=01;36:pi=33:so=01;35:bd=01;33:cd=01;33:ex=01;32:" \
+                          "su=37;41:sg=30;43:tw=30;42:ow=34;42:st=37;44"
+
+#define EXT_MAX_LEN 32
+
+static inline uint32_t ext_hash(const char *ext, size_t len, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)ext[i];
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+static bool ext_table_try(t_colors *colors, const t_suffix_color *exts, int count, uint32_t size, uint32_t seed)
+{
+    memset(colors->ext_table, 0, size * sizeof(t_suffix_color));
+    for (int i = 0; i < count; i++)
+    {
+        t_suffix_color *slot = &colors->ext_table[ext_hash(exts[i].suffix, exts[i].suffix_len, seed) & (size - 1)];
+        if (slot->suffix)
+            return false;
+        *slot = exts[i];
+    }
+    return true;
+}
+
+static void build_ext_table(t_colors *colors, const t_suffix_color *exts, int count)
+{
+    uint32_t size = 8;
+
+    while (size < (uint32_t)count * 2)
+        size *= 2;
+    for (;;)
+    {
+        colors->ext_table = realloc(colors->ext_table, size * sizeof(t_suffix_color));
+        for (uint32_t seed = 1; seed <= 64; seed++)
+        {
+            if (ext_table_try(colors, exts, count, size, seed))
+            {
+                colors->ext_mask = size - 1;
+                colors->ext_seed = seed;
+                return;
+            }
+        }
+        size *= 2;
+    }
+}
+
+static void add_suffix_color(t_suffix_color **list, int *count, int *capacity,
+                             const char *suffix, size_t suffix_len, t_color color, int order)
+{
+    for (int i = 0; i < *count; i++)
+    {
+        if ((*list)[i].suffix_len == suffix_len && memcmp((*list)[i].suffix, suffix, suffix_len) == 0)
+        {
+            (*list)[i].color = color;
+            (*list)[i].order = order;
+            return;
+        }
+    }
+    if (*count == *capacity)
+    {
+        *capacity = *capacity == 0 ? 32 : *capacity * 2;
+        *list = realloc(*list, *capacity * sizeof(t_suffix_color));
+    }
+    (*list)[*count].suffix = suffix;
+    (*list)[*count].suffix_len = suffix_len;
+    (*list)[*count].color = color;
+    (*list)[*count].order = order;
+    (*count)++;
+}
+
+bool init_colors(t_colors *colors)
+{
+    const char *env = getenv("LS_COLORS");
+    t_suffix_color *exts = NULL;
+    int ext_count = 0;
+    int ext_capacity = 0;
+    int suffix_capacity = 0;
+    int order = 0;
+
+    size_t env_len = env ? strlen(env) : 0;
+
+    /* LS_COLORS overrides the built-in defaults key by key. */
+    colors->spec = malloc(sizeof(DEFAULT_LS_COLORS) + 1 + env_len);
+    memcpy(colors->spec, DEFAULT_LS_COLORS, sizeof(DEFAULT_LS_COLORS) - 1);
+    colors->spec[sizeof(DEFAULT_LS_COLORS) - 1] = ':';
+    memcpy(colors->spec + sizeof(DEFAULT_LS_COLORS), env ? env : "", env_len + 1);
+
+    for (char *token = colors->spec; *token; )
+    {
+        char *end = strchr(token, ':');
+        char *next = end ? end + 1 : token + strlen(token);
+        char *eq;
+
+        if (end)
+            *end = '\0';
+        eq = strchr(token, '=');
+        /* "ow=" clears a type key; an empty suffix color is ignored. */
+        if (eq && (eq[1] != '\0' || eq - token == 2))
+        {
+            t_color color = { eq + 1, strlen(eq + 1) };
+            size_t key_len = eq - token;
+
+            *eq = '\0';
+            if (token[0] == '*' && token[1] == '.' && key_len > 2 && key_len - 2 <= EXT_MAX_LEN &&
+                !memchr(token + 2, '.', key_len - 2))
+            {
+                for (char *c = token + 2; *c; c++)
+                    *c = (char)tolower((unsigned char)*c);
+                add_suffix_color(&exts, &ext_count, &ext_capacity, token + 2, key_len - 2, color, order);
+            }
+            else if (token[0] == '*' && key_len > 1)
+                add_suffix_color(&colors->suffixes, &colors->suffix_count, &suffix_capacity, token + 1, key_len - 1,
+                                 color, order);
+            else if (key_len == 2)
+            {
+                for (int i = 0; i < COLOR_COUNT; i++)
+                    if (token[0] == g_color_keys[i][0] && token[1] == g_color_keys[i][1])
+                        colors->types[i] = color;
+            }
+        }
+        token = next;
+        order++;
+    }
+
+    if (ext_count > 0)
+        build_ext_table(colors, exts, ext_count);
+    free(exts);
+    return true;
+}
+
+void free_colors(t_colors *colors)
+{
+    free(colors->ext_table);
+    free(colors->suffixes);
+    free(colors->spec);
+}
+
+static const t_color *suffix_color(const t_colors *colors, const char *name, size_t name_len)
+{
+    const char *dot = memrchr(name, '.', name_len);
+    const t_suffix_color *found = NULL;
+
+    if (colors->ext_table && dot)
+    {
+        size_t len = name + name_len - dot - 1;
+        if (len > 0 && len <= EXT_MAX_LEN)
+        {
+            char lower[EXT_MAX_LEN];
+            for (size_t i = 0; i < len; i++)
+                lower[i] = (char)tolower((unsigned char)dot[1 + i]);
+            const t_suffix_color *slot = &colors->ext_table[ext_hash(lower, len, colors->ext_seed) & colors->ext_mask];
+            if (slot->suffix_len == len && memcmp(slot->suffix, lower, len) == 0)
+                found = slot;
+        }
+    }
+    for (int i = 0; i < colors->suffix_count; i++)
+    {
+        const t_suffix_color *s = &colors->suffixes[i];
+        if (name_len >= s->suffix_len && (found == NULL || s->order > found->order) &&
+            strncasecmp(name + name_len - s->suffix_len, s->suffix, s->suffix_len) == 0)
+            found = s;
+    }
+    return found ? &found->color : NULL;
+}
+
+/* Like GNU ls, a special key set to "", "0" or "00" is off and leaves
+ * the entry to its plain type. */
+static bool color_set(const t_color *color)
+{
+    return color->code != NULL && color->len != 0 &&
+           !(color->len == 1 && color->code[0] == '0') &&
+           !(color->len == 2 && color->code[0] == '0' && color->code[1] == '0');
+}
+
+static const t_color *file_color(const t_colors *colors, const t_file *file)
+{
+    mode_t mode = file->info.st_mode;
+    const t_color *color;
+
+    switch (mode & S_IFMT)
+    {
+        case S_IFDIR:
+            if ((mode & S_ISVTX) && (mode & S_IWOTH) && color_set(&colors->types[COLOR_STICKY_OTHER_WRITABLE]))
+                return &colors->types[COLOR_STICKY_OTHER_WRITABLE];
+            if ((mode & S_IWOTH) && color_set(&colors->types[COLOR_OTHER_WRITABLE]))
+                return &colors->types[COLOR_OTHER_WRITABLE];
+            if ((mode & S_ISVTX) && color_set(&colors->types[COLOR_STICKY]))
+                return &colors->types[COLOR_STICKY];
+            return &colors->types[COLOR_DIR];
+        case S_IFLNK:
+            return &colors->types[COLOR_LINK];
+        case S_IFIFO:
+            return &colors->types[COLOR_FIFO];
+        case S_IFSOCK:
+            return &colors->types[COLOR_SOCK];
+        case S_IFBLK:
+            return &colors->types[COLOR_BLK];
+        case S_IFCHR:
+            return &colors->types[COLOR_CHR];
+        default:
+            break;
+    }
+    if ((mode & S_ISUID) && color_set(&colors->types[COLOR_SETUID]))
+        return &colors->types[COLOR_SETUID];
+    if ((mode & S_ISGID) && color_set(&colors->types[COLOR_SETGID]))
+        return &colors->types[COLOR_SETGID];
+    if ((mode & (S_IXUSR | S_IXGRP | S_IXOTH)) && color_set(&colors->types[COLOR_EXEC]))
+        return &colors->types[COLOR_EXEC];
+    if ((color = suffix_color(colors, file->name, file->name_len)) != NULL)
+        return color;
+    return &colors->types[COLOR_FILE];
+}
+
+/* Appends to a row buffer, flushing it first when `len` would not fit.
+ * Names and link targets can each be up to PATH_MAX long. */
+static void row_append(ftls_ctx *ctx, char *row, int *row_index, const char *data, size_t len)
+{
+    if (*row_index + len > BUFFER_SIZE)
+    {
+        buffered_write(ctx, row, *row_index);
+        *row_index = 0;
+        if (len > BUFFER_SIZE)
+        {
+            buffered_write(ctx, data, len);
+            return;
+        }
+    }
+    memcpy(row + *row_index, data, len);
+    *row_index += len;
+}
+
+static void row_pad(ftls_ctx *ctx, char *row, int *row_index, int count)
+{
+    static const char spaces[] = "                                ";
+
+    while (count > 0)
+    {
+        int chunk = count < (int)sizeof(spaces) - 1 ? count : (int)sizeof(spaces) - 1;
+        row_append(ctx, row, row_index, spaces, chunk);
+        count -= chunk;
+    }
+}
+
+/* The --checksum column: lowercase hex for hashed files, "-" for entries
+ * that are not regular files and "?" for files that could not be read,
+ * padded to the digest width. */
+static char *format_checksum(const t_file *file, int width, char *out)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint64_t sum = file->checksum;
+
+    if (file->checksum_state != CHECKSUM_STATE_OK)
+    {
+        out[0] = file->checksum_state == CHECKSUM_STATE_NONE ? '-' : '?';
+        memset(out + 1, ' ', width - 1);
+    }
+    else
+        for (int i = width - 1; i >= 0; i--, sum >>= 4)
+            out[i] = hex[sum & 0xf];
+    out[width] = ' ';
+    return out + width + 1;
+}
+
+/* A name or link target under -b, -q or -Q, see quote.c. */
+static void row_append_quoted(ftls_ctx *ctx, char *row, int *row_index, const char *name, size_t len)
+{
+    char out[QUOTE_SPECIAL_MAX];
+    size_t plain;
+    size_t used;
+    size_t out_len;
+
+    if (!quote_active(ctx))
+    {
+        row_append(ctx, row, row_index, name, len);
+        return;
+    }
+    if (ctx->quoting == QUOTE_C)
+        row_append(ctx, row, row_index, "\"", 1);
+    while (len > 0)
+    {
+        plain = quote_plain(ctx, name, len);
+        row_append(ctx, row, row_index, name, plain);
+        name += plain;
+        len -= plain;
+        if (len == 0)
+            break;
+        used = quote_special(ctx, name, len, out, &out_len, NULL);
+        row_append(ctx, row, row_index, out, out_len);
+        name += used;
+        len -= used;
+    }
+    if (ctx->quoting == QUOTE_C)
+        row_append(ctx, row, row_index, "\"", 1);
+}
+
+/* Escape sequences are emitted around the name but never counted in the
+ * column widths, which only see the name as quoted. */
+static void row_append_name(ftls_ctx *ctx, char *row, int *row_index, const t_file *file)
+{
+    const t_color *color = ctx->color ? file_color(&ctx->colors, file) : NULL;
+
+    if (color == NULL || color->code == NULL)
+    {
+        row_append_quoted(ctx, row, row_index, file->name, file->name_len);
+        return;
+    }
+    row_append(ctx, row, row_index, "\033[", 2);
+    row_append(ctx, row, row_index, color->code, color->len);
+    row_append(ctx, row, row_index, "m", 1);
+    row_append_quoted(ctx, row, row_index, file->name, file->name_len);
+    row_append(ctx, row, row_index, "\033[0m", 4);
+}
+
+/* The time -l shows: -u and -c pick it like they pick the sort key. */
+static inline time_t shown_time(const t_file *file, int time_field)
+{
+    return time_field == FLAG_u ? file->info.st_atime :
+           time_field == FLAG_c ? file->info.st_ctime : file->info.st_mtime;
+}
+
+/* Kernels. display_files picks, once per listing, a -l row writer
+ * specialized on whether the owner and checksum columns are shown and on
+ * which time is, and a column writer specialized on whether names are
+ * copied as they are or go through --color and quoting: the
+ * parameters below are constants in every instantiation, so the loops
+ * carry no flag tests. */
+static inline __attribute__((always_inline))
+void display_long(ftls_ctx *ctx, const t_file *files, int count, const t_widths *widths,
+                  bool owner, bool checksum, bool xattr, int time_field)
+{
+    char buffer[BUFFER_SIZE];
+    int buffer_index = 0;
+    int checksum_len = checksum ? checksum_width(ctx->checksum) : 0;
+    /* permissions, time, separators and the padded numeric/name columns */
+    int fixed_len = 30 + widths->link + widths->owner + widths->group + widths->size +
+                    (checksum ? checksum_len + 1 : 0) + xattr;
+
+    for (int i = 0; i < count; i++)
+    {
+        const t_file *file = &files[i];
+        char *out;
+        int digits;
+
+        if (buffer_index + fixed_len > BUFFER_SIZE)
+        {
+            buffered_write(ctx, buffer, buffer_index);
+            buffer_index = 0;
+        }
+        out = buffer + buffer_index;
+
+        get_permissions(file->info.st_mode, out);
+        if (file->unresolved)
+            memset(out + 1, '?', 9);
+        out += 10;
+        if (xattr)
+            *out++ = file->unresolved ? ' ' : file->xattr;
+        *out++ = ' ';
+
+        digits = count_digits(file->info.st_nlink);
+        memset(out, ' ', widths->link - digits);
+        out += widths->link - digits;
+        if (file->unresolved)
+            *out = '?';
+        else
+            write_digits(out, file->info.st_nlink, digits);
+        out += digits;
+        *out++ = ' ';
+
+        if (owner)
+        {
+            memcpy(out, file->owner, file->owner_len);
+            out += file->owner_len;
+            memset(out, ' ', widths->owner - file->owner_len + 1);
+            out += widths->owner - file->owner_len + 1;
+        }
+
+        memcpy(out, file->group, file->group_len);
+        out += file->group_len;
+        memset(out, ' ', widths->group - file->group_len + 1);
+        out += widths->group - file->group_len + 1;
+
+        digits = count_digits(file->info.st_size);
+        memset(out, ' ', widths->size - digits);
+        out += widths->size - digits;
+        if (file->unresolved)
+            *out = '?';
+        else
+            write_digits(out, file->info.st_size, digits);
+        out += digits;
+        *out++ = ' ';
+
+        if (file->unresolved)
+        {
+            memset(out, ' ', 11);
+            out[11] = '?';
+        }
+        else
+            format_time(ctx, shown_time(file, time_field), out, 13);
+        out += 12;
+        *out++ = ' ';
+        if (checksum)
+            out = format_checksum(file, checksum_len, out);
+        buffer_index = out - buffer;
+
+        row_append_name(ctx, buffer, &buffer_index, file);
+        if (file->link_target[0] != '\0')
+        {
+            row_append(ctx, buffer, &buffer_index, " -> ", 4);
+            row_append_quoted(ctx, buffer, &buffer_index, file->link_target, file->link_len);
+        }
+        row_append(ctx, buffer, &buffer_index, "\n", 1);
+    }
+
+    if (buffer_index > 0)
+        buffered_write(ctx, buffer, buffer_index);
+}
+
+static inline __attribute__((always_inline))
+void display_columns(ftls_ctx *ctx, const t_file *files, int count, size_t max_name_length, bool plain)
+{
+    size_t column_width = max_name_length + 2;
+    int columns = ctx->ws_cols / column_width;
+    if (columns == 0) columns = 1;
+
+    int rows = (count + columns - 1) / columns;
+
+    char buffer[BUFFER_SIZE];
+    int buffer_index = 0;
+
+    for (int row = 0; row < rows; row++)
+    {
+        for (int col = 0; col < columns; col++)
+        {
+            int index = col * rows + row;
+            if (index >= count) break;
+
+            if (!plain)
+            {
+                size_t width = quote_width(ctx, files[index].name, files[index].name_len);
+
+                row_append_name(ctx, buffer, &buffer_index, &files[index]);
+                row_pad(ctx, buffer, &buffer_index, column_width - width);
+                continue;
+            }
+
+            int padding = column_width - files[index].name_len;
+
+            if (buffer_index + column_width + 1 > BUFFER_SIZE)
+            {
+                buffered_write(ctx, buffer, buffer_index);
+                buffer_index = 0;
+            }
+
+            memcpy(buffer + buffer_index, files[index].name, files[index].name_len);
+            buffer_index += files[index].name_len;
+            memset(buffer + buffer_index, ' ', padding);
+            buffer_index += padding;
+        }
+
+        row_append(ctx, buffer, &buffer_index, "\n", 1);
+
+        if ((unsigned long)buffer_index >= BUFFER_SIZE - column_width)
+        {
+            buffered_write(ctx, buffer, buffer_index);
+            buffer_index = 0;
+        }
+    }
+
+    if (buffer_index > 0)
+    {
+        buffered_write(ctx, buffer, buffer_index);
+    }
+}
+
+# define DEFINE_DISPLAY_LONG(suffix, owner, checksum, time_field) \
+static void display_long_##suffix(ftls_ctx *ctx, const t_file *files, int count, \
+                                  const t_widths *widths) \
+{ \
+    display_long(ctx, files, count, widths, owner, checksum, false, time_field); \
+}
+
+DEFINE_DISPLAY_LONG(owner, true, false, 0)
+DEFINE_DISPLAY_LONG(group, false, false, 0)
+DEFINE_DISPLAY_LONG(owner_checksum, true, true, 0)
+DEFINE_DISPLAY_LONG(group_checksum, false, true, 0)
+
+/* -lu, -lc, -@ and anything else rare enough to test its flags per row. */
+static void display_long_generic(ftls_ctx *ctx, const t_file *files, int count,
+                                 const t_widths *widths, int flags)
+{
+    display_long(ctx, files, count, widths, !(flags & FLAG_g), checksum_width(ctx->checksum) > 0,
+                 (flags & FLAG_XATTR) != 0, flags & FLAG_u ? FLAG_u : flags & FLAG_c ? FLAG_c : 0);
+}
+
+static void display_columns_plain(ftls_ctx *ctx, const t_file *files, int count, size_t max_name_length)
+{
+    display_columns(ctx, files, count, max_name_length, true);
+}
+
+static void display_columns_named(ftls_ctx *ctx, const t_file *files, int count, size_t max_name_length)
+{
+    display_columns(ctx, files, count, max_name_length, false);
+}
+
+void display_files(ftls_ctx *ctx, t_file *files, int count, int flags, size_t max_name_length,
+                   const t_widths *widths)
+{
+    bool checksum = checksum_width(ctx->checksum) > 0;
+
+    if (!(flags & FLAG_l))
+        (ctx->color || quote_active(ctx) ? display_columns_named :
+         display_columns_plain)(ctx, files, count, max_name_length);
+    else if (flags & (FLAG_u | FLAG_c | FLAG_XATTR))
+        display_long_generic(ctx, files, count, widths, flags);
+    else if (flags & FLAG_g)
+        (checksum ? display_long_group_checksum : display_long_group)(ctx, files, count, widths);
+    else
+        (checksum ? display_long_owner_checksum : display_long_owner)(ctx, files, count, widths);
+}
@@ -0,0 +1,623 @@
+#include "ftls_internal.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+/* --snapshot-write FILE records a walk of one directory tree, every entry
+ * with its stat and link target; --snapshot-read FILE then answers
+ * listings from the file instead of the filesystem. open_directory and
+ * scan_directory take their entries from the snapshot, so -l, -R, sorting,
+ * filters, --head/--tail and --diff all work on it unchanged, without a
+ * single system call per entry.
+ *
+ * Layout, native byte order:
+ *   header
+ *   entries   t_snapshot_entry[entry_count], each directory's contiguous
+ *   dirs      t_snapshot_dir[dir_count], in walk (breadth-first) order
+ *   index     uint32_t[dir_count], dir numbers sorted by path
+ *   strings   names, link targets and paths, NUL-terminated
+ *
+ * Paths are relative to the walked root, which is "". The reader maps the
+ * file and checks the header and table bounds, so opening it costs the
+ * same for any tree; entries are only touched when listed. */
+
+# define SNAPSHOT_MAGIC "FTLSSNP1"
+# define SNAPSHOT_BUFFER_SIZE (256 * 1024)
+
+typedef struct
+{
+    char magic[8];
+    uint32_t entry_size;        /* format check: sizeof(t_snapshot_entry) */
+    uint32_t dir_count;
+    uint64_t entry_count;
+    uint64_t entries_off;
+    uint64_t dirs_off;
+    uint64_t index_off;
+    uint64_t strings_off;
+    uint64_t strings_size;
+} t_snapshot_header;
+
+struct t_snapshot_entry
+{
+    uint64_t name;              /* offsets into the string table */
+    uint64_t link;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime;
+    int64_t atime;
+    int64_t ctime;
+    uint32_t mtime_nsec;
+    uint32_t atime_nsec;
+    uint32_t ctime_nsec;
+    uint32_t mode;
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    uint16_t name_len;
+    uint16_t link_len;
+};
+
+typedef struct
+{
+    uint64_t path;
+    uint64_t first;             /* index of its first entry */
+    uint32_t count;
+    uint16_t path_len;
+    uint16_t error;             /* errno from opening it while writing, or 0 */
+} t_snapshot_dir;
+
+struct t_snapshot
+{
+    void *base;
+    size_t size;
+    const t_snapshot_header *header;
+    const t_snapshot_entry *entries;
+    const t_snapshot_dir *dirs;
+    const uint32_t *index;
+    const char *strings;
+};
+
+static bool snapshot_valid(const t_snapshot *snapshot)
+{
+    const t_snapshot_header *h = snapshot->header;
+    uint64_t size = snapshot->size;
+
+    if (size < sizeof(*h) || memcmp(h->magic, SNAPSHOT_MAGIC, 8) != 0 ||
+        h->entry_size != sizeof(t_snapshot_entry))
+        return false;
+    return h->entries_off <= size && h->entry_count <= (size - h->entries_off) / sizeof(t_snapshot_entry) &&
+           h->dirs_off <= size && h->dir_count <= (size - h->dirs_off) / sizeof(t_snapshot_dir) &&
+           h->index_off <= size && h->dir_count <= (size - h->index_off) / sizeof(uint32_t) &&
+           h->strings_off <= size && h->strings_size <= size - h->strings_off &&
+           h->entries_off % 8 == 0 && h->dirs_off % 8 == 0 && h->index_off % 4 == 0;
+}
+
+/* The "snapshot-read" option. Reports why on the error fd and returns
+ * false if the file is not a snapshot. */
+bool snapshot_open(ftls_ctx *ctx, const char *file)
+{
+    t_snapshot *snapshot;
+    struct stat st;
+    void *base;
+    int fd;
+
+    snapshot_close(ctx);
+    fd = openat(ctx->cwd_fd, file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        report_error(ctx, "Cannot open snapshot", file, errno);
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+    base = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    snapshot = malloc(sizeof(t_snapshot));
+    if (base == MAP_FAILED || snapshot == NULL)
+    {
+        report_error(ctx, "Cannot open snapshot", file, st.st_size > 0 ? errno : EINVAL);
+        if (base != MAP_FAILED)
+            munmap(base, st.st_size);
+        free(snapshot);
+        return false;
+    }
+
+    snapshot->base = base;
+    snapshot->size = st.st_size;
+    snapshot->header = base;
+    if (!snapshot_valid(snapshot))
+    {
+        report_error(ctx, "Cannot open snapshot", file, EINVAL);
+        munmap(base, st.st_size);
+        free(snapshot);
+        return false;
+    }
+    snapshot->entries = (const void *)((const char *)base + snapshot->header->entries_off);
+    snapshot->dirs = (const void *)((const char *)base + snapshot->header->dirs_off);
+    snapshot->index = (const void *)((const char *)base + snapshot->header->index_off);
+    snapshot->strings = (const char *)base + snapshot->header->strings_off;
+    ctx->snapshot = snapshot;
+    return true;
+}
+
+void snapshot_close(ftls_ctx *ctx)
+{
+    if (ctx->snapshot == NULL)
+        return;
+    munmap(ctx->snapshot->base, ctx->snapshot->size);
+    free(ctx->snapshot);
+    ctx->snapshot = NULL;
+}
+
+/* A string of the table, NULL if it does not fit in it. */
+static const char *snapshot_string(const t_snapshot *snapshot, uint64_t offset, size_t len)
+{
+    if (offset > snapshot->header->strings_size || len >= snapshot->header->strings_size - offset)
+        return NULL;
+    return snapshot->strings + offset;
+}
+
+/* Drops empty and "." components, so "./a//b/" is "a/b" and "." is the
+ * root, "". */
+static size_t normalize_path(const char *path, char *out)
+{
+    size_t len = 0;
+
+    while (*path)
+    {
+        const char *end = strchr(path, '/');
+        size_t part = end ? (size_t)(end - path) : strlen(path);
+
+        if (part > 0 && !(part == 1 && path[0] == '.'))
+        {
+            if (len > 0)
+                out[len++] = '/';
+            memcpy(out + len, path, part);
+            len += part;
+        }
+        path += part;
+        while (*path == '/')
+            path++;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+static const t_snapshot_dir *snapshot_find(const t_snapshot *snapshot, const char *path)
+{
+    char key[PATH_MAX];
+    size_t key_len;
+    uint32_t low = 0;
+    uint32_t high = snapshot->header->dir_count;
+
+    if (strlen(path) >= PATH_MAX)
+        return NULL;
+    key_len = normalize_path(path, key);
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        uint32_t number = snapshot->index[middle];
+        const t_snapshot_dir *dir;
+        const char *dir_path;
+        int cmp;
+
+        if (number >= snapshot->header->dir_count)
+            return NULL;
+        dir = &snapshot->dirs[number];
+        if ((dir_path = snapshot_string(snapshot, dir->path, dir->path_len)) == NULL)
+            return NULL;
+        cmp = memcmp(dir_path, key, dir->path_len < key_len ? dir->path_len : key_len);
+        if (cmp == 0)
+            cmp = (dir->path_len > key_len) - (dir->path_len < key_len);
+        if (cmp == 0)
+            return dir->first <= snapshot->header->entry_count &&
+                   dir->count <= snapshot->header->entry_count - dir->first ? dir : NULL;
+        if (cmp < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return NULL;
+}
+
+/* open_directory on a snapshot: reports what the live call would have. */
+bool snapshot_open_directory(ftls_ctx *ctx, const char *path)
+{
+    const t_snapshot_dir *dir = snapshot_find(ctx->snapshot, path);
+
+    if (dir == NULL)
+    {
+        report_error(ctx, "Cannot access", path, ENOENT);
+        return false;
+    }
+    if (dir->error != 0)
+    {
+        report_error(ctx, "Cannot open directory", path, dir->error);
+        return false;
+    }
+    return true;
+}
+
+void snapshot_cursor(ftls_ctx *ctx, const char *path, t_snapshot_cursor *cursor)
+{
+    const t_snapshot_dir *dir = snapshot_find(ctx->snapshot, path);
+
+    cursor->snapshot = ctx->snapshot;
+    cursor->next = dir ? dir->first : 0;
+    cursor->end = dir ? dir->first + dir->count : 0;
+    cursor->current = NULL;
+}
+
+/* Entries whose strings do not fit in the table, or whose name could not
+ * be a file name and would let -R loop, are skipped. */
+struct dirent *snapshot_next(t_snapshot_cursor *cursor)
+{
+    const t_snapshot_entry *entry;
+    const char *name;
+
+    while (cursor->next < cursor->end)
+    {
+        entry = &cursor->snapshot->entries[cursor->next++];
+        name = snapshot_string(cursor->snapshot, entry->name, entry->name_len);
+        if (name == NULL || entry->name_len == 0 || entry->name_len >= sizeof(cursor->entry.d_name) ||
+            memchr(name, '/', entry->name_len) != NULL || memchr(name, '\0', entry->name_len) != NULL ||
+            (entry->link_len > 0 && snapshot_string(cursor->snapshot, entry->link, entry->link_len) == NULL))
+            continue;
+        cursor->current = entry;
+        cursor->entry.d_type = IFTODT(entry->mode);
+        memcpy(cursor->entry.d_name, name, entry->name_len);
+        cursor->entry.d_name[entry->name_len] = '\0';
+        return &cursor->entry;
+    }
+    return NULL;
+}
+
+void snapshot_stat(const t_snapshot_cursor *cursor, struct stat *st)
+{
+    const t_snapshot_entry *entry = cursor->current;
+
+    memset(st, 0, sizeof(*st));
+    st->st_ino = entry->ino;
+    st->st_mode = entry->mode;
+    st->st_nlink = entry->nlink;
+    st->st_uid = entry->uid;
+    st->st_gid = entry->gid;
+    st->st_size = entry->size;
+    st->st_mtim.tv_sec = entry->mtime;
+    st->st_mtim.tv_nsec = entry->mtime_nsec;
+    st->st_atim.tv_sec = entry->atime;
+    st->st_atim.tv_nsec = entry->atime_nsec;
+    st->st_ctim.tv_sec = entry->ctime;
+    st->st_ctim.tv_nsec = entry->ctime_nsec;
+}
+
+ssize_t snapshot_readlink(const t_snapshot_cursor *cursor, char *buffer, size_t size)
+{
+    const t_snapshot_entry *entry = cursor->current;
+    size_t len = entry->link_len < size ? entry->link_len : size;
+
+    memcpy(buffer, cursor->snapshot->strings + entry->link, len);
+    return len;
+}
+
+/* Writing. Entries stream to the file through a buffer; the directory
+ * table and the strings are kept in memory until the walk is done. */
+typedef struct
+{
+    int fd;
+    bool failed;
+    int error;
+    char *buffer;
+    size_t used;
+    off_t offset;               /* where the buffer goes */
+
+    t_snapshot_dir *dirs;
+    uint32_t dir_count;
+    uint32_t dir_capacity;
+    uint64_t entry_count;
+    char *strings;
+    uint64_t strings_size;
+    uint64_t strings_capacity;
+} t_writer;
+
+static void writer_flush(t_writer *writer)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (!writer->failed && done < writer->used)
+    {
+        n = pwrite(writer->fd, writer->buffer + done, writer->used - done, writer->offset + done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+        {
+            writer->failed = true;
+            writer->error = errno;
+        }
+        else
+            done += n;
+    }
+    writer->offset += writer->used;
+    writer->used = 0;
+}
+
+static void writer_append(t_writer *writer, const void *data, size_t len)
+{
+    size_t chunk;
+
+    while (len > 0)
+    {
+        if (writer->used == SNAPSHOT_BUFFER_SIZE)
+            writer_flush(writer);
+        chunk = SNAPSHOT_BUFFER_SIZE - writer->used;
+        if (chunk > len)
+            chunk = len;
+        memcpy(writer->buffer + writer->used, data, chunk);
+        writer->used += chunk;
+        data = (const char *)data + chunk;
+        len -= chunk;
+    }
+}
+
+static uint64_t writer_string(t_writer *writer, const char *s, size_t len)
+{
+    uint64_t offset = writer->strings_size;
+
+    if (writer->strings_size + len + 1 > writer->strings_capacity)
+    {
+        uint64_t capacity = writer->strings_capacity ? writer->strings_capacity * 2 : 1 << 20;
+        char *grown;
+
+        while (capacity < writer->strings_size + len + 1)
+            capacity *= 2;
+        if ((grown = realloc(writer->strings, capacity)) == NULL)
+        {
+            writer->failed = true;
+            writer->error = ENOMEM;
+            return 0;
+        }
+        writer->strings = grown;
+        writer->strings_capacity = capacity;
+    }
+    memcpy(writer->strings + offset, s, len);
+    writer->strings[offset + len] = '\0';
+    writer->strings_size += len + 1;
+    return offset;
+}
+
+static t_snapshot_dir *writer_dir(t_writer *writer, const char *path, size_t path_len)
+{
+    t_snapshot_dir *dir;
+
+    if (writer->dir_count == writer->dir_capacity)
+    {
+        uint32_t capacity = writer->dir_capacity ? writer->dir_capacity * 2 : 1024;
+        t_snapshot_dir *grown = capacity > writer->dir_capacity ?
+                                realloc(writer->dirs, capacity * sizeof(t_snapshot_dir)) : NULL;
+
+        if (grown == NULL)
+        {
+            writer->failed = true;
+            writer->error = ENOMEM;
+            return NULL;
+        }
+        writer->dirs = grown;
+        writer->dir_capacity = capacity;
+    }
+    dir = &writer->dirs[writer->dir_count++];
+    dir->path = writer_string(writer, path, path_len);
+    dir->path_len = path_len;
+    dir->first = writer->entry_count;
+    dir->count = 0;
+    dir->error = 0;
+    return dir;
+}
+
+static void writer_entry(t_writer *writer, const t_file *file)
+{
+    t_snapshot_entry entry;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.name = writer_string(writer, file->name, file->name_len);
+    entry.name_len = file->name_len;
+    if (file->link_len > 0)
+    {
+        entry.link = writer_string(writer, file->link_target, file->link_len);
+        entry.link_len = file->link_len;
+    }
+    entry.ino = file->info.st_ino;
+    entry.size = file->info.st_size;
+    entry.mtime = file->info.st_mtim.tv_sec;
+    entry.mtime_nsec = file->info.st_mtim.tv_nsec;
+    entry.atime = file->info.st_atim.tv_sec;
+    entry.atime_nsec = file->info.st_atim.tv_nsec;
+    entry.ctime = file->info.st_ctim.tv_sec;
+    entry.ctime_nsec = file->info.st_ctim.tv_nsec;
+    entry.mode = file->info.st_mode;
+    entry.nlink = file->info.st_nlink;
+    entry.uid = file->info.st_uid;
+    entry.gid = file->info.st_gid;
+    writer_append(writer, &entry, sizeof(entry));
+    writer->entry_count++;
+}
+
+typedef struct
+{
+    const char *path;
+    uint16_t path_len;
+    uint32_t number;
+} t_index_entry;
+
+static int compare_index(const void *a, const void *b)
+{
+    const t_index_entry *x = a;
+    const t_index_entry *y = b;
+    int cmp = memcmp(x->path, y->path, x->path_len < y->path_len ? x->path_len : y->path_len);
+
+    return cmp != 0 ? cmp : (x->path_len > y->path_len) - (x->path_len < y->path_len);
+}
+
+/* Appends the directory table, the index and the strings, then the
+ * header, which makes the file valid. */
+static void writer_finish(t_writer *writer)
+{
+    t_snapshot_header header;
+    t_index_entry *sorted;
+    uint32_t *index;
+    static const char zeros[8];
+
+    memset(&header, 0, sizeof(header));
+    header.entries_off = sizeof(header);
+    header.entry_count = writer->entry_count;
+    header.entry_size = sizeof(t_snapshot_entry);
+    header.dir_count = writer->dir_count;
+    header.dirs_off = writer->offset + writer->used;
+    writer_append(writer, zeros, (8 - header.dirs_off % 8) % 8);
+    header.dirs_off = writer->offset + writer->used;
+    writer_append(writer, writer->dirs, writer->dir_count * sizeof(t_snapshot_dir));
+
+    sorted = malloc(writer->dir_count * sizeof(t_index_entry) + 1);
+    index = malloc(writer->dir_count * sizeof(uint32_t) + 1);
+    if (sorted == NULL || index == NULL)
+    {
+        writer->failed = true;
+        writer->error = ENOMEM;
+    }
+    else
+    {
+        for (uint32_t i = 0; i < writer->dir_count; i++)
+        {
+            sorted[i].path = writer->strings + writer->dirs[i].path;
+            sorted[i].path_len = writer->dirs[i].path_len;
+            sorted[i].number = i;
+        }
+        qsort(sorted, writer->dir_count, sizeof(t_index_entry), compare_index);
+        for (uint32_t i = 0; i < writer->dir_count; i++)
+            index[i] = sorted[i].number;
+        header.index_off = writer->offset + writer->used;
+        writer_append(writer, index, writer->dir_count * sizeof(uint32_t));
+    }
+    free(sorted);
+    free(index);
+
+    header.strings_off = writer->offset + writer->used;
+    header.strings_size = writer->strings_size;
+    writer_append(writer, writer->strings, writer->strings_size);
+    writer_flush(writer);
+
+    memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+    writer->used = 0;
+    writer->offset = 0;
+    writer_append(writer, &header, sizeof(header));
+    writer_flush(writer);
+}
+
+/* Walks root breadth-first, so every directory's entries are written in
+ * one piece, into a temporary file that is renamed over `file` once it is
+ * complete: a reader of the old snapshot keeps a valid mapping. Every
+ * entry is recorded, hidden ones included; --exclude, --prune, -x and
+ * --max-depth still apply. Returns 0, or 1 if root or the file could not be handled. */
+int snapshot_write(ftls_ctx *ctx, const char *root, const char *file)
+{
+    t_writer writer;
+    t_listing listing;
+    t_dirs queue;
+    dirs_todo *todo;
+    t_snapshot_dir *dir;
+    DIR *stream;
+    char tmp[PATH_MAX];
+    size_t root_len = strlen(root);
+    int limit = ctx->limit;
+    int status = 0;
+
+    if ((size_t)snprintf(tmp, sizeof(tmp), "%s.%d.tmp", file, (int)getpid()) >= sizeof(tmp))
+    {
+        report_error(ctx, "Cannot write snapshot", file, ENAMETOOLONG);
+        return 1;
+    }
+    if (root_len >= PATH_MAX)
+    {
+        report_error(ctx, "Cannot open directory", root, ENAMETOOLONG);
+        return 1;
+    }
+    if (!open_directory(ctx, root, &stream))
+        return 1;
+
+    memset(&writer, 0, sizeof(writer));
+    memset(&listing, 0, sizeof(listing));
+    writer.fd = openat(ctx->cwd_fd, tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    writer.buffer = malloc(SNAPSHOT_BUFFER_SIZE);
+    writer.offset = sizeof(t_snapshot_header);
+    if (writer.fd == -1 || writer.buffer == NULL)
+    {
+        report_error(ctx, "Cannot write snapshot", file, writer.fd == -1 ? errno : ENOMEM);
+        if (stream != NULL)
+            closedir(stream);
+        if (writer.fd != -1)
+            close(writer.fd);
+        free(writer.buffer);
+        return 1;
+    }
+
+    ctx->limit = 0;
+    ft_list_init(&queue, sizeof(dirs_todo));
+    todo = ft_list_add_last_slot(&queue);
+    if (todo != NULL)
+    {
+        memcpy(todo->path, root, root_len + 1);
+        todo->path_len = root_len;
+        todo->depth = 0;
+    }
+    walk_begin(ctx, root);
+    while ((todo = ft_list_get_first(&queue)) != NULL && !writer.failed)
+    {
+        const char *relative = todo->path + root_len;
+
+        while (*relative == '/')
+            relative++;
+        dir = writer_dir(&writer, relative, todo->path_len - (relative - todo->path));
+        if (dir == NULL)
+            break;
+        /* The root was opened above. */
+        if (writer.dir_count > 1 && !open_directory(ctx, todo->path, &stream))
+        {
+            dir->error = errno;
+            ft_list_pop_first(&queue, NULL);
+            continue;
+        }
+        scan_directory(ctx, &listing, todo->path, stream, FLAG_a | FLAG_f | FLAG_STAT);
+        for (int i = 0; i < listing.count; i++)
+        {
+            writer_entry(&writer, &listing.files[i]);
+            dirs_add(ctx, &queue, todo->path, todo->path_len, todo->depth, &listing.files[i]);
+        }
+        dir->count = listing.count;
+        ft_list_pop_first(&queue, NULL);
+    }
+    ctx->limit = limit;
+    ft_list_destroy(&queue);
+    free_listing(&listing);
+
+    if (!writer.failed)
+        writer_finish(&writer);
+    if (close(writer.fd) == -1 && !writer.failed)
+    {
+        writer.failed = true;
+        writer.error = errno;
+    }
+    if (!writer.failed && renameat(ctx->cwd_fd, tmp, ctx->cwd_fd, file) == -1)
+    {
+        writer.failed = true;
+        writer.error = errno;
+    }
+    if (writer.failed)
+    {
+        report_error(ctx, "Cannot write snapshot", file, writer.error);
+        unlinkat(ctx->cwd_fd, tmp, 0);
+        status = 1;
+    }
+    free(writer.buffer);
+    free(writer.dirs);
+    free(writer.strings);
+    return status;
+}
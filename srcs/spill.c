@@ -0,0 +1,620 @@
+#include "ftls_internal.h"
+#include <fcntl.h>
+
+/* External sort behind --max-memory. When a directory would outgrow the
+ * budget, the scan sorts what it holds and appends it as a run of compact
+ * records to an unlinked temp file in $TMPDIR. Display then merges the
+ * runs, comparing records in place in the read buffers. A merge reads as
+ * many runs as the budget has read buffers for; with more runs than that,
+ * groups of them are first merged into longer runs appended to the file.
+ * -l rows are rendered as they come out of the final merge. Column output
+ * needs entries i, i + rows, i + 2 * rows... side by side, so the merged
+ * order is appended to the file once and read back through one cursor per
+ * column. */
+
+/* Rough per-entry cost in memory: the t_file plus its collation key. */
+# define SPILL_ENTRY_COST (sizeof(t_file) + 256)
+# define SPILL_WRITE_SIZE (64 * 1024)
+# define SPILL_READ_MIN (16 * 1024)
+# define SPILL_READ_MAX (1024 * 1024)
+
+/* On-disk entry, followed by the NUL-terminated name and link target and
+ * then the collation key bytes. owner/group point into the context's name caches, which outlive the
+ * temp file. */
+typedef struct
+{
+    uint64_t sort_prefix;
+    struct stat info;
+    const char *owner;
+    const char *group;
+    uint16_t owner_len;
+    uint16_t group_len;
+    uint32_t name_len;
+    uint32_t link_len;
+    uint32_t key_len;
+    uint64_t checksum;
+    uint8_t checksum_state;
+    char xattr;
+    uint8_t unresolved;
+} t_record;
+
+struct t_spill
+{
+    int fd;
+    off_t end;
+    off_t *runs;                /* run i is [runs[i], runs[i + 1]) */
+    int run_count;
+    int run_capacity;
+    long total;
+    char *buffer;               /* pending writes at offset `end` */
+    size_t used;
+};
+
+/* A record as the merge sees it: a copy of the t_record, with the name,
+ * link target and key left in the reader's buffer. */
+typedef struct
+{
+    t_record record;
+    t_sort_view view;           /* info points at record.info */
+    const char *link;
+    size_t size;                /* of the encoded record */
+} t_spilled;
+
+typedef struct
+{
+    int fd;
+    off_t pos;                  /* file offset of the next record */
+    off_t end;
+    char *buffer;               /* file bytes from pos - off */
+    size_t off;
+    size_t len;
+    size_t capacity;
+    t_spilled entry;            /* the current record, valid until the next read */
+} t_reader;
+
+/* What one merge input holds: a read buffer and its decoded record. */
+# define SPILL_READER_COST (SPILL_READ_MIN + sizeof(t_reader))
+
+int spill_threshold(const ftls_ctx *ctx, int options)
+{
+    size_t entries;
+
+    if (!(options & FLAG_SPILL) || ctx->max_memory == 0 || ctx->limit > 0)
+        return 0;
+    entries = ctx->max_memory / SPILL_ENTRY_COST;
+    if (entries < 16)
+        return 16;
+    return entries > INT_MAX ? INT_MAX : (int)entries;
+}
+
+static bool spill_flush(t_spill *spill)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < spill->used)
+    {
+        n = pwrite(spill->fd, spill->buffer + done, spill->used - done, spill->end);
+        if (n <= 0)
+            return false;
+        done += n;
+        spill->end += n;
+    }
+    spill->used = 0;
+    return true;
+}
+
+static bool spill_append(t_spill *spill, const void *data, size_t len)
+{
+    size_t chunk;
+
+    while (len > 0)
+    {
+        if (spill->used == SPILL_WRITE_SIZE && !spill_flush(spill))
+            return false;
+        chunk = SPILL_WRITE_SIZE - spill->used;
+        if (chunk > len)
+            chunk = len;
+        memcpy(spill->buffer + spill->used, data, chunk);
+        spill->used += chunk;
+        data = (const char *)data + chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+static bool spill_encode(t_spill *spill, const t_file *file)
+{
+    t_record record;
+
+    memset(&record, 0, sizeof(record));
+    record.sort_prefix = file->sort_prefix;
+    record.info = file->info;
+    record.owner = file->owner;
+    record.group = file->group;
+    record.owner_len = file->owner_len;
+    record.group_len = file->group_len;
+    record.name_len = file->name_len;
+    record.link_len = file->link_len;
+    record.key_len = file->sort_key ? file->sort_key_len : 0;
+    record.checksum = file->checksum;
+    record.checksum_state = file->checksum_state;
+    record.xattr = file->xattr;
+    record.unresolved = file->unresolved;
+
+    return spill_append(spill, &record, sizeof(record)) &&
+           spill_append(spill, file->name, record.name_len) &&
+           spill_append(spill, "", 1) &&
+           spill_append(spill, file->link_target, record.link_len) &&
+           spill_append(spill, "", 1) &&
+           spill_append(spill, file->sort_key, record.key_len);
+}
+
+static t_spill *spill_create(ftls_ctx *ctx)
+{
+    const char *dir = getenv("TMPDIR");
+    char template[PATH_MAX];
+    t_spill *spill;
+    int fd;
+
+    if (dir == NULL || *dir == '\0')
+        dir = "/tmp";
+    if ((size_t)snprintf(template, sizeof(template), "%s/ft_ls.XXXXXX", dir) >= sizeof(template))
+    {
+        report_error(ctx, "Cannot create temp file in", dir, ENAMETOOLONG);
+        return NULL;
+    }
+    fd = mkostemp(template, O_CLOEXEC);
+    if (fd == -1)
+    {
+        report_error(ctx, "Cannot create temp file in", dir, errno);
+        return NULL;
+    }
+    unlink(template);
+
+    spill = calloc(1, sizeof(t_spill));
+    if (spill)
+        spill->buffer = malloc(SPILL_WRITE_SIZE);
+    if (spill == NULL || spill->buffer == NULL)
+    {
+        free(spill);
+        close(fd);
+        return NULL;
+    }
+    spill->fd = fd;
+    return spill;
+}
+
+/* Appends files[0..count), already sorted, as one run. */
+bool spill_run(ftls_ctx *ctx, t_listing *listing, int count)
+{
+    t_spill *spill = listing->spill;
+
+    if (spill == NULL && (spill = listing->spill = spill_create(ctx)) == NULL)
+        return false;
+
+    if (spill->run_count + 1 >= spill->run_capacity)
+    {
+        spill->run_capacity = spill->run_capacity == 0 ? 16 : spill->run_capacity * 2;
+        spill->runs = realloc(spill->runs, spill->run_capacity * sizeof(off_t));
+    }
+    spill->runs[spill->run_count] = spill->end + spill->used;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!spill_encode(spill, &listing->files[i]))
+        {
+            report_error(ctx, "Cannot write temp file for", "--max-memory", errno);
+            return false;
+        }
+    }
+    spill->run_count++;
+    spill->runs[spill->run_count] = spill->end + spill->used;
+    spill->total += count;
+    return true;
+}
+
+void spill_free(t_listing *listing)
+{
+    t_spill *spill = listing->spill;
+
+    if (spill == NULL)
+        return;
+    close(spill->fd);
+    free(spill->runs);
+    free(spill->buffer);
+    free(spill);
+    listing->spill = NULL;
+}
+
+static bool reader_init(t_reader *reader, int fd, off_t start, off_t end, size_t capacity)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+    reader->pos = start;
+    reader->end = end;
+    reader->capacity = capacity;
+    reader->buffer = malloc(capacity);
+    return reader->buffer != NULL;
+}
+
+static void reader_free(t_reader *reader)
+{
+    free(reader->buffer);
+}
+
+/* Makes at least `need` bytes from pos available in the buffer. */
+static bool reader_fill(t_reader *reader, size_t need)
+{
+    ssize_t n;
+
+    if (reader->len - reader->off >= need)
+        return true;
+    memmove(reader->buffer, reader->buffer + reader->off, reader->len - reader->off);
+    reader->len -= reader->off;
+    reader->off = 0;
+    if (need > reader->capacity)
+    {
+        char *grown = realloc(reader->buffer, need);
+        if (grown == NULL)
+            return false;
+        reader->buffer = grown;
+        reader->capacity = need;
+    }
+    while (reader->len < need)
+    {
+        off_t at = reader->pos + reader->len;
+        size_t want = reader->capacity - reader->len;
+
+        if ((off_t)want > reader->end - at)
+            want = reader->end - at;
+        n = want ? pread(reader->fd, reader->buffer + reader->len, want, at) : 0;
+        if (n <= 0)
+            return false;
+        reader->len += n;
+    }
+    return true;
+}
+
+/* Decodes the next record of the run into reader->entry. Its bytes stay
+ * in the buffer until the following call moves them out. */
+static bool reader_next(t_reader *reader)
+{
+    t_spilled *entry = &reader->entry;
+    t_record *record = &entry->record;
+    const char *data;
+
+    if (reader->pos >= reader->end || !reader_fill(reader, sizeof(*record)))
+        return false;
+    memcpy(record, reader->buffer + reader->off, sizeof(*record));
+    if (record->name_len >= PATH_MAX || record->link_len >= PATH_MAX)
+        return false;
+    entry->size = sizeof(*record) + record->name_len + 1 + record->link_len + 1 + record->key_len;
+    if (!reader_fill(reader, entry->size))
+        return false;
+    data = reader->buffer + reader->off + sizeof(*record);
+    if (data[record->name_len] != '\0' || data[record->name_len + 1 + record->link_len] != '\0')
+        return false;
+
+    entry->view.info = &record->info;
+    entry->view.sort_prefix = record->sort_prefix;
+    entry->view.name = data;
+    entry->view.name_len = record->name_len;
+    entry->link = data + record->name_len + 1;
+    entry->view.sort_key = record->key_len ? entry->link + record->link_len + 1 : NULL;
+    entry->view.sort_key_len = record->key_len ? record->key_len : record->name_len;
+
+    reader->off += entry->size;
+    reader->pos += entry->size;
+    return true;
+}
+
+/* Appends a decoded record unchanged: its bytes after the t_record are
+ * still contiguous in the reader's buffer. */
+static bool spill_copy(t_spill *spill, const t_spilled *entry)
+{
+    return spill_append(spill, &entry->record, sizeof(entry->record)) &&
+           spill_append(spill, entry->view.name, entry->size - sizeof(entry->record));
+}
+
+/* The t_file display_files and dirs_add take, for one entry at a time. */
+static void spilled_file(const t_spilled *entry, t_file *file)
+{
+    const t_record *record = &entry->record;
+
+    memcpy(file->name, entry->view.name, record->name_len + 1);
+    file->name_len = record->name_len;
+    memcpy(file->link_target, entry->link, record->link_len + 1);
+    file->link_len = record->link_len;
+    file->sort_key = entry->view.sort_key;
+    file->sort_key_len = entry->view.sort_key_len;
+    file->sort_prefix = record->sort_prefix;
+    file->info = record->info;
+    file->owner = record->owner;
+    file->group = record->group;
+    file->owner_len = record->owner_len;
+    file->group_len = record->group_len;
+    file->checksum = record->checksum;
+    file->checksum_state = record->checksum_state;
+    file->xattr = record->xattr;
+    file->unresolved = record->unresolved;
+}
+
+typedef struct
+{
+    t_reader *readers;
+    int *heap;                  /* reader indices, smallest current entry first */
+    int count;
+    int runs;
+    int options;
+} t_merge;
+
+/* Ties go to the earlier run, which keeps -f in scan order. */
+static bool merge_before(const t_merge *merge, int a, int b)
+{
+    int cmp = (merge->options & FLAG_f) ? 0 :
+              compare_views(&merge->readers[a].entry.view, &merge->readers[b].entry.view,
+                            merge->options);
+    return cmp < 0 || (cmp == 0 && a < b);
+}
+
+static void merge_sift_down(t_merge *merge, int pos)
+{
+    int *heap = merge->heap;
+
+    for (;;)
+    {
+        int child = 2 * pos + 1;
+        if (child >= merge->count)
+            break;
+        if (child + 1 < merge->count && merge_before(merge, heap[child + 1], heap[child]))
+            child++;
+        if (!merge_before(merge, heap[child], heap[pos]))
+            break;
+        int tmp = heap[pos];
+        heap[pos] = heap[child];
+        heap[child] = tmp;
+        pos = child;
+    }
+}
+
+/* How many runs one merge reads at once: as many read buffers as fit in
+ * the budget, which the scan has handed back by now. */
+static int merge_fan_in(const ftls_ctx *ctx)
+{
+    size_t fan_in = ctx->max_memory / SPILL_READER_COST;
+
+    if (fan_in < 2)
+        return 2;
+    return fan_in > INT_MAX ? INT_MAX : (int)fan_in;
+}
+
+/* Merges runs [first, first + runs) of the spill file. */
+static bool merge_init(t_merge *merge, const ftls_ctx *ctx, const t_spill *spill, int first, int runs,
+                       int options)
+{
+    size_t capacity = ctx->max_memory / runs;
+
+    capacity = capacity > sizeof(t_reader) ? capacity - sizeof(t_reader) : 0;
+    if (capacity < SPILL_READ_MIN)
+        capacity = SPILL_READ_MIN;
+    if (capacity > SPILL_READ_MAX)
+        capacity = SPILL_READ_MAX;
+
+    memset(merge, 0, sizeof(*merge));
+    merge->options = options;
+    merge->readers = calloc(runs, sizeof(t_reader));
+    merge->heap = malloc(runs * sizeof(int));
+    if (!merge->readers || !merge->heap)
+        return false;
+    merge->runs = runs;
+
+    for (int i = 0; i < runs; i++)
+    {
+        if (!reader_init(&merge->readers[i], spill->fd, spill->runs[first + i],
+                         spill->runs[first + i + 1], capacity))
+            return false;
+        if (reader_next(&merge->readers[i]))
+            merge->heap[merge->count++] = i;
+    }
+    for (int i = merge->count / 2 - 1; i >= 0; i--)
+        merge_sift_down(merge, i);
+    return true;
+}
+
+/* The smallest remaining entry, valid until the next merge_pop. */
+static const t_spilled *merge_peek(const t_merge *merge)
+{
+    return merge->count > 0 ? &merge->readers[merge->heap[0]].entry : NULL;
+}
+
+static void merge_pop(t_merge *merge)
+{
+    if (!reader_next(&merge->readers[merge->heap[0]]))
+        merge->heap[0] = merge->heap[--merge->count];
+    merge_sift_down(merge, 0);
+}
+
+static void merge_free(t_merge *merge)
+{
+    for (int i = 0; merge->readers && i < merge->runs; i++)
+        reader_free(&merge->readers[i]);
+    free(merge->readers);
+    free(merge->heap);
+    memset(merge, 0, sizeof(*merge));
+}
+
+/* Appends the merge of runs [first, first + runs) as one run. */
+static bool merge_into(ftls_ctx *ctx, t_spill *spill, int first, int runs, int options)
+{
+    const t_spilled *entry;
+    t_merge merge;
+    bool ok = merge_init(&merge, ctx, spill, first, runs, options);
+
+    while (ok && (entry = merge_peek(&merge)) != NULL)
+    {
+        ok = spill_copy(spill, entry);
+        merge_pop(&merge);
+    }
+    merge_free(&merge);
+    return ok;
+}
+
+/* Intermediate passes: while there are more runs than one merge reads,
+ * each group of fan_in consecutive runs is merged into a run appended to
+ * the file. Groups keep the run order, so ties still go to the earlier
+ * scan. What a pass has merged away is punched out of the file. */
+static bool spill_reduce(ftls_ctx *ctx, t_spill *spill, int options)
+{
+    int fan_in = merge_fan_in(ctx);
+
+    while (spill->run_count > fan_in)
+    {
+        off_t start = spill->runs[0];
+        off_t end = spill->runs[spill->run_count];
+        int merged = 0;
+
+        for (int first = 0; first < spill->run_count; first += fan_in)
+        {
+            int runs = spill->run_count - first < fan_in ? spill->run_count - first : fan_in;
+            off_t at = spill->end + spill->used;
+
+            if (!merge_into(ctx, spill, first, runs, options))
+                return false;
+            /* runs[merged] is behind every run still to be read. */
+            spill->runs[merged++] = at;
+        }
+        spill->runs[merged] = spill->end + spill->used;
+        spill->run_count = merged;
+        if (!spill_flush(spill))
+            return false;
+        fallocate(spill->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, end - start);
+    }
+    return true;
+}
+
+/* Column output: writes the merged order after the runs, remembering where
+ * every column starts, then renders row by row from one cursor per column
+ * once the merge's buffers are released. */
+static void spill_columns(ftls_ctx *ctx, t_listing *listing, t_merge *merge, t_file *file,
+                          const char *path, size_t path_len, int options, t_dirs *dirs, int depth)
+{
+    t_spill *spill = listing->spill;
+    size_t column_width = listing->max_len + 2;
+    long columns = ctx->ws_cols / column_width;
+    long rows;
+    long used;
+    off_t *starts;
+    t_reader *cursors;
+    t_file *row;
+    const t_spilled *entry;
+    long index = 0;
+    int hidden = 0;
+
+    if (columns == 0)
+        columns = 1;
+    rows = (spill->total + columns - 1) / columns;
+    used = rows > 0 ? (spill->total + rows - 1) / rows : 0;
+    starts = malloc((used + 1) * sizeof(off_t));
+    if (starts == NULL)
+        return;
+
+    while ((entry = merge_peek(merge)) != NULL)
+    {
+        if (index % rows == 0)
+            starts[index / rows] = spill->end + spill->used;
+        if (!spill_copy(spill, entry))
+        {
+            report_error(ctx, "Cannot write temp file for", path, errno);
+            free(starts);
+            return;
+        }
+        if (dirs)
+        {
+            spilled_file(entry, file);
+            dirs_add_hidden(ctx, dirs, path, path_len, depth, listing, &hidden, file, options);
+            dirs_add(ctx, dirs, path, path_len, depth, file);
+        }
+        merge_pop(merge);
+        index++;
+    }
+    merge_free(merge);
+    if (dirs)
+        dirs_add_hidden(ctx, dirs, path, path_len, depth, listing, &hidden, NULL, options);
+    if (!spill_flush(spill))
+    {
+        report_error(ctx, "Cannot write temp file for", path, errno);
+        free(starts);
+        return;
+    }
+    starts[used] = spill->end;
+
+    cursors = calloc(used, sizeof(t_reader));
+    row = malloc(used * sizeof(t_file));
+    for (long c = 0; cursors && row && c < used; c++)
+        reader_init(&cursors[c], spill->fd, starts[c], starts[c + 1], SPILL_READ_MIN);
+
+    for (long r = 0; cursors && row && r < rows; r++)
+    {
+        int count = 0;
+        while (count < used && cursors[count].buffer && reader_next(&cursors[count]))
+        {
+            spilled_file(&cursors[count].entry, &row[count]);
+            count++;
+        }
+        /* At most `columns` entries: display_files lays them out as one row. */
+        display_files(ctx, row, count, options, listing->max_len, &listing->widths);
+    }
+
+    for (long c = 0; cursors && c < used; c++)
+        reader_free(&cursors[c]);
+    free(cursors);
+    free(row);
+    free(starts);
+}
+
+/* The scan is over: its file array goes back before the merge takes the
+ * budget, and the next directory allocates one again. */
+void spill_display(ftls_ctx *ctx, t_listing *listing, const char *path, int options, t_dirs *dirs, int depth)
+{
+    t_spill *spill = listing->spill;
+    size_t path_len = strlen(path);
+    t_file *file = malloc(sizeof(t_file));
+    const t_spilled *entry;
+    t_merge merge;
+    int hidden = 0;
+
+    free(listing->files);
+    listing->files = NULL;
+    listing->capacity = 0;
+
+    memset(&merge, 0, sizeof(merge));
+    if (file == NULL)
+        report_error(ctx, "Cannot merge sorted runs for", path, ENOMEM);
+    else if (!spill_flush(spill) || !spill_reduce(ctx, spill, options))
+        report_error(ctx, "Cannot write temp file for", path, errno ? errno : ENOMEM);
+    else if (!merge_init(&merge, ctx, spill, 0, spill->run_count, options))
+        report_error(ctx, "Cannot merge sorted runs for", path, ENOMEM);
+    else if (options & FLAG_l)
+    {
+        while ((entry = merge_peek(&merge)) != NULL)
+        {
+            spilled_file(entry, file);
+            display_files(ctx, file, 1, options, 0, &listing->widths);
+            if (dirs)
+            {
+                dirs_add_hidden(ctx, dirs, path, path_len, depth, listing, &hidden, file, options);
+                dirs_add(ctx, dirs, path, path_len, depth, file);
+            }
+            merge_pop(&merge);
+        }
+        if (dirs)
+            dirs_add_hidden(ctx, dirs, path, path_len, depth, listing, &hidden, NULL, options);
+    }
+    else
+        spill_columns(ctx, listing, &merge, file, path, path_len, options, dirs, depth);
+
+    merge_free(&merge);
+    free(file);
+    spill_free(listing);
+}
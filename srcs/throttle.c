@@ -0,0 +1,220 @@
+#include "ftls_internal.h"
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+/* --max-iops and --max-dirs-per-sec: token buckets in front of the calls
+ * that reach the disk. Opening a directory, which also reads it, costs a
+ * token of both; every stat and readlink one of --max-iops. A call that
+ * finds its bucket empty takes the token on credit and sleeps until it
+ * would have been there, so the rate holds on average with bursts of a
+ * tenth of a second.
+ *
+ * --throttle-latency=US makes the operation rate adaptive: stats are
+ * timed, and every THROTTLE_WINDOW_NS the rate is halved, down to
+ * THROTTLE_MIN_RATE, while their moving average is above US, and
+ * otherwise grows back by an eighth
+ * towards --max-iops, or until it no longer binds without one. A crawl
+ * then runs at full speed on an idle disk and yields to a busy one.
+ *
+ * --idle-io puts the listing thread, and the threads it starts, in the
+ * idle I/O scheduling class for the duration of ftls_list or ftls_diff.
+ *
+ * The scanning thread of a pipelined -R and the calling thread both take
+ * tokens, hence the lock. Under --deadline the stats run on the deadline
+ * helper and only the directory opens are throttled. */
+
+# define THROTTLE_WINDOW_NS 100000000LL
+# define THROTTLE_BURST_SECONDS 0.1
+/* The adaptive rate never drops below this, so a disk that is slow
+ * for reasons of its own still gets walked. */
+# define THROTTLE_MIN_RATE 10.0
+
+/* From linux/ioprio.h, which not every libc ships. */
+# define IOPRIO_CLASS_SHIFT 13
+# define IOPRIO_CLASS_IDLE 3
+# define IOPRIO_WHO_PROCESS 1
+
+typedef struct
+{
+    double rate;                /* tokens per second, 0 = unlimited */
+    double tokens;              /* negative while on credit */
+    int64_t last;               /* when tokens was last refilled */
+} t_bucket;
+
+struct t_throttle
+{
+    pthread_mutex_t lock;
+    t_bucket ops;
+    t_bucket dirs;
+    double ceiling;             /* --max-iops, 0 = none */
+    int64_t latency_ns;         /* --throttle-latency, 0 = not adaptive */
+    double average_ns;          /* moving average of the stat latency */
+    int64_t window_start;
+    long window_ops;
+    int saved_ioprio;           /* -1 if --idle-io did not change it */
+};
+
+static int64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void bucket_init(t_bucket *bucket, double rate, int64_t now)
+{
+    bucket->rate = rate;
+    bucket->tokens = rate > 0 ? fmax(1, rate * THROTTLE_BURST_SECONDS) : 0;
+    bucket->last = now;
+}
+
+/* Takes a token and returns how long to sleep for it, in nanoseconds. */
+static int64_t bucket_take(t_bucket *bucket, int64_t now)
+{
+    double burst = fmax(1, bucket->rate * THROTTLE_BURST_SECONDS);
+
+    if (bucket->rate <= 0)
+        return 0;
+    bucket->tokens = fmin(burst, bucket->tokens + (now - bucket->last) * bucket->rate / 1e9);
+    bucket->last = now;
+    bucket->tokens -= 1;
+    return bucket->tokens >= 0 ? 0 : (int64_t)(-bucket->tokens / bucket->rate * 1e9);
+}
+
+static void sleep_ns(int64_t ns)
+{
+    struct timespec delay = { ns / 1000000000LL, ns % 1000000000LL };
+
+    while (ns > 0 && nanosleep(&delay, &delay) == -1 && errno == EINTR)
+        ;
+}
+
+/* Called with the lock held after a stat that took latency_ns. */
+static void throttle_adapt(t_throttle *throttle, int64_t latency_ns, int64_t now)
+{
+    double observed;
+    double rate = throttle->ops.rate;
+
+    throttle->average_ns = throttle->average_ns == 0 ? latency_ns :
+                           throttle->average_ns * 0.875 + latency_ns * 0.125;
+    throttle->window_ops++;
+    if (now - throttle->window_start < THROTTLE_WINDOW_NS)
+        return;
+
+    observed = throttle->window_ops * 1e9 / (now - throttle->window_start);
+    if (throttle->average_ns > throttle->latency_ns)
+        rate = fmax(THROTTLE_MIN_RATE, fmin(rate > 0 ? rate : observed, observed) / 2);
+    else if (rate > 0)
+    {
+        rate += fmax(1, rate / 8);
+        if (throttle->ceiling > 0 && rate >= throttle->ceiling)
+            rate = throttle->ceiling;
+        else if (throttle->ceiling == 0 && rate > 2 * observed)
+            rate = 0;
+    }
+    if (rate != throttle->ops.rate)
+    {
+        throttle->ops.rate = rate;
+        throttle->ops.tokens = fmin(throttle->ops.tokens, fmax(1, rate * THROTTLE_BURST_SECONDS));
+    }
+    throttle->window_start = now;
+    throttle->window_ops = 0;
+}
+
+void throttle_free(ftls_ctx *ctx)
+{
+    if (ctx->throttle == NULL)
+        return;
+    throttle_end(ctx);
+    pthread_mutex_destroy(&ctx->throttle->lock);
+    free(ctx->throttle);
+    ctx->throttle = NULL;
+}
+
+/* Sets up ctx->throttle for a listing, or drops it if no throttling
+ * option is on any more. */
+void throttle_begin(ftls_ctx *ctx)
+{
+    t_throttle *throttle = ctx->throttle;
+    int64_t now = now_ns();
+
+    if (ctx->max_iops == 0 && ctx->max_dirs_per_sec == 0 && ctx->throttle_latency_us == 0 &&
+        !ctx->idle_io)
+    {
+        throttle_free(ctx);
+        return;
+    }
+    if (throttle == NULL)
+    {
+        throttle = calloc(1, sizeof(t_throttle));
+        if (throttle == NULL)
+            return;
+        pthread_mutex_init(&throttle->lock, NULL);
+        ctx->throttle = throttle;
+    }
+    bucket_init(&throttle->ops, ctx->max_iops, now);
+    bucket_init(&throttle->dirs, ctx->max_dirs_per_sec, now);
+    throttle->ceiling = ctx->max_iops;
+    throttle->latency_ns = (int64_t)ctx->throttle_latency_us * 1000;
+    throttle->average_ns = 0;
+    throttle->window_start = now;
+    throttle->window_ops = 0;
+    throttle->saved_ioprio = -1;
+    if (ctx->idle_io)
+    {
+        int saved = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+
+        if (saved != -1 &&
+            syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) == 0)
+            throttle->saved_ioprio = saved;
+    }
+}
+
+/* Restores what throttle_begin changed about the calling thread. */
+void throttle_end(ftls_ctx *ctx)
+{
+    if (ctx->throttle == NULL || ctx->throttle->saved_ioprio == -1)
+        return;
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ctx->throttle->saved_ioprio);
+    ctx->throttle->saved_ioprio = -1;
+}
+
+/* Waits for the tokens of one directory open, or one stat or readlink. */
+void throttle_wait(t_throttle *throttle, bool directory)
+{
+    int64_t now = now_ns();
+    int64_t delay;
+
+    pthread_mutex_lock(&throttle->lock);
+    delay = bucket_take(&throttle->ops, now);
+    if (directory)
+    {
+        int64_t dirs_delay = bucket_take(&throttle->dirs, now);
+        if (dirs_delay > delay)
+            delay = dirs_delay;
+    }
+    pthread_mutex_unlock(&throttle->lock);
+    sleep_ns(delay);
+}
+
+/* fstatat after a token, timed for --throttle-latency. */
+int throttled_fstatat(t_throttle *throttle, int dir_fd, const char *name, struct stat *st)
+{
+    int64_t start;
+    int64_t end;
+    int result;
+
+    throttle_wait(throttle, false);
+    if (throttle->latency_ns == 0)
+        return fstatat(dir_fd, name, st, AT_SYMLINK_NOFOLLOW);
+    start = now_ns();
+    result = fstatat(dir_fd, name, st, AT_SYMLINK_NOFOLLOW);
+    end = now_ns();
+    pthread_mutex_lock(&throttle->lock);
+    throttle_adapt(throttle, end - start, end);
+    pthread_mutex_unlock(&throttle->lock);
+    return result;
+}
@@ -0,0 +1,129 @@
+#include "ftls_internal.h"
+#include <sys/xattr.h>
+
+/* -@: the mark -l prints after the permissions. '+' for a POSIX ACL, '@'
+ * for any other extended attribute (SELinux labels, file capabilities,
+ * user.*), ' ' for none. The lookups run on the --checksum pool, which
+ * also keeps their results: by (dev, ino, ctime), since setting an
+ * attribute changes the ctime, and by device for filesystems found to
+ * have no extended attributes at all, whose files are not asked again.
+ * The cache is an open-addressed table, emptied when half full so its
+ * size stays fixed; it is only touched under the pool's lock. */
+
+# define XATTR_CACHE_SIZE 4096
+# define XATTR_LIST_SIZE 4096
+
+typedef struct
+{
+    dev_t dev;
+    ino_t ino;
+    struct timespec ctime;
+    char mark;                  /* 0 for an empty slot */
+} t_xattr_cache_entry;
+
+struct t_xattr_cache
+{
+    t_xattr_cache_entry entries[XATTR_CACHE_SIZE];
+    int used;
+    dev_t unsupported[FS_CACHE_SIZE];
+    int unsupported_count;
+};
+
+t_xattr_cache *xattr_cache_new(void)
+{
+    return calloc(1, sizeof(t_xattr_cache));
+}
+
+/* The slot of the file st describes, or the empty one it would take. */
+static t_xattr_cache_entry *cache_slot(t_xattr_cache *cache, const struct stat *st)
+{
+    uint64_t hash = ((uint64_t)st->st_ino ^ ((uint64_t)st->st_dev << 32)) * 0x9E3779B97F4A7C15ULL;
+    size_t i = hash >> 52;
+
+    while (cache->entries[i].mark != 0 &&
+           (cache->entries[i].dev != st->st_dev || cache->entries[i].ino != st->st_ino))
+        i = (i + 1) & (XATTR_CACHE_SIZE - 1);
+    return &cache->entries[i];
+}
+
+/* True, with *mark set, if the mark of the file st describes is known. */
+bool xattr_cached(t_xattr_cache *cache, const struct stat *st, char *mark)
+{
+    const t_xattr_cache_entry *entry = cache_slot(cache, st);
+
+    for (int i = 0; i < cache->unsupported_count; i++)
+        if (cache->unsupported[i] == st->st_dev)
+        {
+            *mark = ' ';
+            return true;
+        }
+    if (entry->mark == 0 || entry->dev != st->st_dev || entry->ino != st->st_ino ||
+        entry->ctime.tv_sec != st->st_ctim.tv_sec || entry->ctime.tv_nsec != st->st_ctim.tv_nsec)
+        return false;
+    *mark = entry->mark;
+    return true;
+}
+
+void xattr_remember(t_xattr_cache *cache, const struct stat *st, char mark, bool unsupported)
+{
+    t_xattr_cache_entry *entry;
+
+    if (unsupported)
+    {
+        for (int i = 0; i < cache->unsupported_count; i++)
+            if (cache->unsupported[i] == st->st_dev)
+                return;
+        if (cache->unsupported_count < FS_CACHE_SIZE)
+            cache->unsupported[cache->unsupported_count++] = st->st_dev;
+        return;
+    }
+    entry = cache_slot(cache, st);
+    if (entry->mark == 0 && ++cache->used * 2 > XATTR_CACHE_SIZE)
+    {
+        memset(cache->entries, 0, sizeof(cache->entries));
+        cache->used = 1;
+        entry = cache_slot(cache, st);
+    }
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->ctime = st->st_ctim;
+    entry->mark = mark;
+}
+
+static bool is_acl(const char *name)
+{
+    return strcmp(name, "system.posix_acl_access") == 0 || strcmp(name, "system.posix_acl_default") == 0;
+}
+
+/* The mark of name in the directory open as dir_fd. There is no
+ * llistxattrat: the name is reached through /proc/self/fd, which works
+ * whatever the working directory and, with the l- calls, does not follow
+ * a final symlink. *unsupported is set if the filesystem has no extended
+ * attributes. */
+char xattr_mark(int dir_fd, const char *name, bool *unsupported)
+{
+    char path[PATH_MAX + 32];
+    char list[XATTR_LIST_SIZE];
+    ssize_t len;
+    char mark = ' ';
+
+    *unsupported = false;
+    if (snprintf(path, sizeof(path), "/proc/self/fd/%d/%s", dir_fd, name) >= (int)sizeof(path))
+        return ' ';
+    len = llistxattr(path, list, sizeof(list));
+    if (len == -1 && errno == ERANGE)
+        return lgetxattr(path, "system.posix_acl_access", NULL, 0) >= 0 ||
+               lgetxattr(path, "system.posix_acl_default", NULL, 0) >= 0 ? '+' : '@';
+    if (len == -1)
+    {
+        *unsupported = errno == ENOTSUP;
+        return ' ';
+    }
+    for (ssize_t i = 0; i < len; i += strlen(list + i) + 1)
+    {
+        if (is_acl(list + i))
+            return '+';
+        mark = '@';
+    }
+    return mark;
+}
@@ -0,0 +1,299 @@
+#include "ft_list.h"
+#include "error_codes.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Benchmarks for inc/ft_list.c, run with `make bench`.
+ *
+ * FIFO: N pushes at the back, then pops from the front until empty, as the
+ * -R queue does. Compared against the intrusive circular list ft_list used
+ * to be (kept below with the same algorithms: O(n) first/size walks) and
+ * against the realloc'd array of dirs_todo that -R used instead.
+ *
+ * SPMC: one producer, K consumers, against a mutex + condition variable
+ * ring like the one in front of the daemon workers. */
+
+typedef struct old_item_s
+{
+    struct old_item_s* next;
+    struct old_item_s* prev;
+    unsigned int value;
+} old_item_t;
+
+static void old_add_last(old_item_t** head, old_item_t* node)
+{
+    if (!*head)
+    {
+        *head = node;
+        node->next = node;
+        node->prev = node;
+        return;
+    }
+    node->prev = (*head)->prev;
+    node->next = *head;
+    (*head)->prev->next = node;
+    (*head)->prev = node;
+}
+
+static old_item_t* old_get_first(old_item_t** head)
+{
+    old_item_t* first = *head;
+
+    if (!first)
+        return NULL;
+    while (first->prev != *head)
+        first = first->prev;
+    return first;
+}
+
+static int old_get_size(old_item_t** head)
+{
+    old_item_t* current = *head;
+    int size = 0;
+
+    if (!current)
+        return 0;
+    do
+    {
+        size++;
+        current = current->next;
+    } while (current != *head);
+    return size;
+}
+
+static void old_pop(old_item_t** head, old_item_t* node)
+{
+    if (node->next == node)
+        *head = NULL;
+    else
+    {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        if (*head == node)
+            *head = node->next;
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile unsigned long g_sink;
+
+static double bench_old(unsigned int n)
+{
+    old_item_t* nodes = calloc(n, sizeof(old_item_t));
+    old_item_t* head = NULL;
+    double start = now();
+
+    for (unsigned int i = 0; i < n; i++)
+    {
+        nodes[i].value = i;
+        old_add_last(&head, &nodes[i]);
+    }
+    while (old_get_size(&head) > 0)
+    {
+        old_item_t* first = old_get_first(&head);
+        g_sink += first->value;
+        old_pop(&head, first);
+    }
+    start = now() - start;
+    free(nodes);
+    return start;
+}
+
+typedef struct
+{
+    char path[4096];
+    size_t path_len;
+} t_path;
+
+static double bench_array(unsigned int n, size_t elem_size)
+{
+    char* entries = NULL;
+    size_t capacity = 0;
+    double start = now();
+
+    for (unsigned int i = 0; i < n; i++)
+    {
+        if (i >= capacity)
+        {
+            capacity = capacity == 0 ? 100 : capacity + 1000;
+            entries = realloc(entries, capacity * elem_size);
+        }
+        memcpy(entries + i * elem_size, &i, sizeof(i));
+    }
+    for (unsigned int i = 0; i < n; i++)
+        g_sink += *(unsigned int*)(entries + i * elem_size);
+    free(entries);
+    return now() - start;
+}
+
+static double bench_deque(unsigned int n, size_t elem_size)
+{
+    ft_list_t list;
+    double start = now();
+    void* slot;
+
+    ft_list_init(&list, elem_size);
+    for (unsigned int i = 0; i < n; i++)
+    {
+        slot = ft_list_add_last_slot(&list);
+        memcpy(slot, &i, sizeof(i));
+    }
+    while ((slot = ft_list_get_first(&list)) != NULL)
+    {
+        g_sink += *(unsigned int*)slot;
+        ft_list_pop_first(&list, NULL);
+    }
+    ft_list_destroy(&list);
+    return now() - start;
+}
+
+#define RING_SIZE 1024
+#define SPMC_ITEMS 4000000
+
+typedef struct
+{
+    unsigned int items[RING_SIZE];
+    int head;
+    int count;
+    int done;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} t_ring;
+
+static void* ring_consumer(void* arg)
+{
+    t_ring* ring = arg;
+    unsigned long sum = 0;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&ring->lock);
+        while (ring->count == 0 && !ring->done)
+            pthread_cond_wait(&ring->not_empty, &ring->lock);
+        if (ring->count == 0)
+        {
+            pthread_mutex_unlock(&ring->lock);
+            break;
+        }
+        sum += ring->items[ring->head];
+        ring->head = (ring->head + 1) % RING_SIZE;
+        ring->count--;
+        pthread_cond_signal(&ring->not_full);
+        pthread_mutex_unlock(&ring->lock);
+    }
+    g_sink += sum;
+    return NULL;
+}
+
+static double bench_ring(int consumers)
+{
+    t_ring ring = { .lock = PTHREAD_MUTEX_INITIALIZER,
+                    .not_empty = PTHREAD_COND_INITIALIZER,
+                    .not_full = PTHREAD_COND_INITIALIZER };
+    pthread_t threads[consumers];
+    double start = now();
+
+    for (int i = 0; i < consumers; i++)
+        pthread_create(&threads[i], NULL, ring_consumer, &ring);
+    for (unsigned int i = 0; i < SPMC_ITEMS; i++)
+    {
+        pthread_mutex_lock(&ring.lock);
+        while (ring.count == RING_SIZE)
+            pthread_cond_wait(&ring.not_full, &ring.lock);
+        ring.items[(ring.head + ring.count) % RING_SIZE] = i;
+        ring.count++;
+        pthread_cond_signal(&ring.not_empty);
+        pthread_mutex_unlock(&ring.lock);
+    }
+    pthread_mutex_lock(&ring.lock);
+    ring.done = 1;
+    pthread_cond_broadcast(&ring.not_empty);
+    pthread_mutex_unlock(&ring.lock);
+    for (int i = 0; i < consumers; i++)
+        pthread_join(threads[i], NULL);
+    return now() - start;
+}
+
+typedef struct
+{
+    ft_spmc_t* queue;
+    volatile int* done;
+} t_spmc_consumer;
+
+static void* spmc_consumer(void* arg)
+{
+    t_spmc_consumer* consumer = arg;
+    unsigned long sum = 0;
+    unsigned int value;
+
+    for (;;)
+    {
+        if (ft_spmc_pop(consumer->queue, &value) == OK)
+            sum += value;
+        else if (__atomic_load_n(consumer->done, __ATOMIC_ACQUIRE))
+        {
+            if (ft_spmc_pop(consumer->queue, &value) != OK)
+                break;
+            sum += value;
+        }
+        else
+            sched_yield();
+    }
+    g_sink += sum;
+    return NULL;
+}
+
+static double bench_spmc(int consumers)
+{
+    ft_spmc_t* queue = ft_spmc_create(sizeof(unsigned int), RING_SIZE);
+    t_spmc_consumer consumer = { queue, NULL };
+    volatile int done = 0;
+    pthread_t threads[consumers];
+    double start = now();
+
+    consumer.done = &done;
+    for (int i = 0; i < consumers; i++)
+        pthread_create(&threads[i], NULL, spmc_consumer, &consumer);
+    for (unsigned int i = 0; i < SPMC_ITEMS; i++)
+        while (ft_spmc_push(queue, &i) != OK)
+            sched_yield();
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < consumers; i++)
+        pthread_join(threads[i], NULL);
+    start = now() - start;
+    ft_spmc_destroy(queue);
+    return start;
+}
+
+int main(void)
+{
+    static const unsigned int sizes[] = { 1000, 10000, 50000 };
+
+    printf("%-28s %10s %12s %12s\n", "FIFO push+drain", "n", "old list", "deque");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++)
+        printf("%-28s %10u %10.2fms %10.2fms\n", "4-byte items", sizes[i],
+               bench_old(sizes[i]) * 1e3, bench_deque(sizes[i], sizeof(unsigned int)) * 1e3);
+
+    printf("\n%-28s %10s %12s %12s\n", "-R queue (dirs_todo)", "n", "realloc", "deque");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++)
+        printf("%-28s %10u %10.2fms %10.2fms\n", "4104-byte items", sizes[i],
+               bench_array(sizes[i], sizeof(t_path)) * 1e3, bench_deque(sizes[i], sizeof(t_path)) * 1e3);
+
+    printf("\n%-28s %10s %12s %12s\n", "1 producer, K consumers", "K", "mutex ring", "spmc");
+    for (int consumers = 1; consumers <= 4; consumers *= 2)
+        printf("%-28s %10d %10.2fms %10.2fms\n", "4M 4-byte items", consumers,
+               bench_ring(consumers) * 1e3, bench_spmc(consumers) * 1e3);
+    return 0;
+}
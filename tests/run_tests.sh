@@ -0,0 +1,595 @@
+#!/bin/sh
+# Syscall-budget and output regression tests.
+#
+#   tests/run_tests.sh FT_LS SYSCOUNT_SO
+#
+# Builds the fixture trees, runs every line of tests/budgets under the
+# syscount shim and fails if a counted call goes over its budget, then
+# checks the -l output against GNU ls.
+
+FT_LS=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+SHIM=$(cd "$(dirname "$2")" && pwd)/$(basename "$2")
+TESTS=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/ft_ls_tests.XXXXXX")
+FAILED=0
+
+trap 'rm -rf "$WORK"' EXIT
+export LC_ALL=C TZ=UTC
+
+fail()
+{
+    echo "FAIL: $*"
+    FAILED=1
+}
+
+# Files get distinct mtimes a few hours old, so -t has a total order and
+# GNU ls prints HH:MM like ft_ls.
+stamp()
+{
+    touch -h -d "@$(( $(date +%s) - 3600 * 3 + $2 ))" "$1"
+}
+
+make_fixtures()
+{
+    # flat: 300 files of varied sizes, 20 symlinks, 10 empty directories
+    mkdir -p "$WORK/flat"
+    i=0
+    while [ $i -lt 300 ]; do
+        head -c $(( (i * 37) % 5000 )) /dev/zero > "$WORK/flat/file$i"
+        stamp "$WORK/flat/file$i" $i
+        i=$((i + 1))
+    done
+    i=0
+    while [ $i -lt 20 ]; do
+        ln -s "file$i" "$WORK/flat/link$i"
+        stamp "$WORK/flat/link$i" $((400 + i))
+        mkdir -p "$WORK/flat/dir$(( i % 10 ))"
+        stamp "$WORK/flat/dir$(( i % 10 ))" $((500 + i % 10))
+        i=$((i + 1))
+    done
+    touch "$WORK/flat/.hidden"
+
+    # empty: only empty files, so the -l size column is one digit wide
+    mkdir -p "$WORK/empty"
+    for f in a b c; do
+        touch "$WORK/empty/$f"
+        stamp "$WORK/empty/$f" 0
+    done
+
+    # hostile: names and a link target that need quoting, some past the
+    # 16 and 32 bytes compared at once
+    mkdir -p "$WORK/hostile"
+    for f in plain "a b" 'back\slash' 'dq"x' "$(printf 'nl\nx')" "$(printf 'tab\tx\177')" \
+             "$(printf 'bell\a\351')" "$(printf 'long_name_with_a_newline_at_40__\n_')" \
+             "long_name_that_is_printable_from_start_to_end"; do
+        touch "$WORK/hostile/$f"
+        stamp "$WORK/hostile/$f" 0
+    done
+    ln -s "$(printf 'tar\nget')" "$WORK/hostile/$(printf 'ln\tk')"
+    stamp "$WORK/hostile/$(printf 'ln\tk')" 0
+    d="$WORK/hostile/$(printf 'sub: dir\n_')"
+    mkdir -p "$d"
+    touch "$d/f"
+    stamp "$d/f" 0
+    stamp "$d" 0
+
+    # filter: one entry of each type, fixed sizes and mtimes, and a small
+    # tree for the -R rules
+    mkdir -p "$WORK/filter/src/deep" "$WORK/filter/tmp"
+    head -c 10 /dev/zero > "$WORK/filter/a.log"
+    head -c 2000 /dev/zero > "$WORK/filter/b.log"
+    : > "$WORK/filter/c.txt"
+    : > "$WORK/filter/core"
+    touch -d @1000000000 "$WORK/filter/a.log"
+    touch -d @1100000000 "$WORK/filter/b.log"
+    touch -d @1200000000 "$WORK/filter/c.txt" "$WORK/filter/core"
+    ln -s a.log "$WORK/filter/ln"
+    mkfifo "$WORK/filter/fifo"
+    : > "$WORK/filter/src/main.c"
+    : > "$WORK/filter/src/deep/util.log"
+    : > "$WORK/filter/tmp/junk.log"
+
+    # color: an entry for each LS_COLORS type key and names for the
+    # extension, multi-dot and plain suffix patterns of check_color
+    mkdir -p "$WORK/color/dir" "$WORK/color/other" "$WORK/color/sticky"
+    for f in a.TAR b.tar.gz c.txt d.jpg e README exe setuid; do
+        : > "$WORK/color/$f"
+    done
+    chmod 755 "$WORK/color/exe"
+    chmod 4644 "$WORK/color/setuid"
+    chmod 777 "$WORK/color/other"
+    chmod 1777 "$WORK/color/sticky"
+    ln -s e "$WORK/color/ln"
+    mkfifo "$WORK/color/pipe"
+    for f in "$WORK/color"/*; do
+        stamp "$f" 0
+    done
+
+    # diff: two trees differing in one field per entry, the same times
+    # except for "time"
+    for side in a b; do
+        mkdir -p "$WORK/diff/$side/sub"
+        echo same > "$WORK/diff/$side/same"
+        echo x > "$WORK/diff/$side/mode"
+        echo t > "$WORK/diff/$side/time"
+        : > "$WORK/diff/$side/sub/deep"
+    done
+    mkdir -p "$WORK/diff/a/gone" "$WORK/diff/b/kind"
+    : > "$WORK/diff/a/gone/f"
+    : > "$WORK/diff/a/kind"
+    chmod 600 "$WORK/diff/b/mode"
+    echo small > "$WORK/diff/a/size"
+    echo bigger > "$WORK/diff/b/size"
+    ln -s same "$WORK/diff/a/link"
+    ln -s mode "$WORK/diff/b/link"
+    : > "$WORK/diff/a/sub/old"
+    : > "$WORK/diff/b/sub/new"
+    for f in same mode time size link kind sub/deep; do
+        touch -h -d @1000000000 "$WORK/diff/a/$f" "$WORK/diff/b/$f"
+    done
+    touch -d @1100000000 "$WORK/diff/b/time"
+
+    # checksum: contents with published xxh64 and crc32c values
+    mkdir -p "$WORK/checksum/dir"
+    printf abc > "$WORK/checksum/abc"
+    printf 123456789 > "$WORK/checksum/digits"
+    : > "$WORK/checksum/empty"
+
+    # deep: three levels of four directories, ten files in each
+    for a in 0 1 2 3; do
+        for b in 0 1 2 3; do
+            for c in 0 1 2 3; do
+                d="$WORK/deep/a$a/b$b/c$c"
+                mkdir -p "$d"
+                for f in 0 1 2 3 4 5 6 7 8 9; do
+                    echo "$a$b$c$f" > "$d/f$f"
+                    stamp "$d/f$f" $(( a * 1000 + b * 100 + c * 10 + f ))
+                done
+                stamp "$d" $(( 5000 + a * 100 + b * 10 + c ))
+            done
+            stamp "$WORK/deep/a$a/b$b" $(( 6000 + a * 10 + b ))
+        done
+        stamp "$WORK/deep/a$a" $(( 7000 + a ))
+    done
+}
+
+# A budgets line is "fixture flags call=max...", flags "-" for none and
+# comma-separated when there are several. Every counted call that is not
+# listed has a budget of 0.
+check_budgets()
+{
+    grep -v '^#' "$TESTS/budgets" | grep -v '^$' > "$WORK/budgets"
+    while read -r fixture flags budgets; do
+        [ "$flags" = "-" ] && flags=""
+        flags=$(echo "$flags" | tr ',' ' ')
+        ( cd "$WORK/$fixture" && FTLS_SYSCOUNT="$WORK/counts" LD_PRELOAD="$SHIM" "$FT_LS" $flags > /dev/null )
+        [ -s "$WORK/counts" ] || fail "$fixture '$flags': the shim did not report"
+        while read -r call count; do
+            max=$(echo " $budgets " | sed -n "s/.* $call=\([0-9]*\) .*/\1/p")
+            [ -n "$max" ] || max=0
+            [ "$count" -le "$max" ] || fail "$fixture '$flags': $call $count > $max"
+        done < "$WORK/counts"
+        rm -f "$WORK/counts"
+    done < "$WORK/budgets"
+}
+
+# ft_ls prints no "total" lines and no header for the first -R directory.
+check_output()
+{
+    fixture=$1
+    shift
+    ( cd "$WORK/$fixture" && "$FT_LS" "$@" ) > "$WORK/ours"
+    ( cd "$WORK/$fixture" && ls "$@" --time-style='+%b %d %H:%M' ) \
+        | grep -v '^total ' | sed '1{/^\.:$/d}' > "$WORK/reference"
+    if ! cmp -s "$WORK/ours" "$WORK/reference"; then
+        fail "$fixture '$*' differs from ls"
+        diff "$WORK/reference" "$WORK/ours" | head -10
+    fi
+}
+
+# Column layouts differ from GNU ls, so -f only checks the set of names.
+check_names()
+{
+    fixture=$1
+    shift
+    ( cd "$WORK/$fixture" && "$FT_LS" "$@" ) | tr -s ' ' '\n' | grep -v '^$' | sort > "$WORK/ours"
+    ( cd "$WORK/$fixture" && ls -1 "$@" ) | sort > "$WORK/reference"
+    cmp -s "$WORK/ours" "$WORK/reference" || fail "$fixture '$*' names differ from ls"
+}
+
+# --color against GNU ls, which also starts its output with a reset. In
+# the second LS_COLORS "*.tar.gz" comes first, so "*.gz" wins, and the
+# empty ow and su=00 leave those entries to di and fi.
+# On a 40-column UTF-8 terminal a name of nine double-width characters
+# takes 18 columns, not its 27 bytes: four names of three letters fit
+# next to it in two 20-column columns.
+check_wide()
+{
+    command -v script > /dev/null || return 0
+    locale -a 2> /dev/null | grep -qix 'c\.utf-\?8' || return 0
+    mkdir -p "$WORK/wide"
+    touch "$WORK/wide/abc" "$WORK/wide/def" "$WORK/wide/ghi" "$WORK/wide/jkl" \
+          "$WORK/wide/$(printf '\344\270\200%.0s' 1 2 3 4 5 6 7 8 9)"
+    ( cd "$WORK/wide" && script -qec "stty cols 40; LC_ALL=C.UTF-8 '$FT_LS'" /dev/null ) \
+        | tr -d '\r' | sed -n 1p > "$WORK/ours"
+    printf 'abc%17sjkl%17s\n' '' '' > "$WORK/reference"
+    cmp -s "$WORK/ours" "$WORK/reference" || fail "wide: double-width name measured by its bytes"
+}
+
+check_color()
+{
+    for colors in '*.tar=01;31:*.gz=31:*.jpg=35:*.tar.gz=01;33:*README=04:fi=00:ex=32:*.TGZ=36' \
+                  '*.tar.gz=01;33:*.GZ=31:di=36:ow=:su=00:fi=01'; do
+        ( cd "$WORK/color" && LS_COLORS=$colors "$FT_LS" -l --color=always ) > "$WORK/ours"
+        ( cd "$WORK/color" && LS_COLORS=$colors ls -l --color=always --time-style='+%b %d %H:%M' ) \
+            | grep -v '^total ' | sed '0,/\x1b\[0m\x1b\[/s//\x1b[/' > "$WORK/reference"
+        if ! cmp -s "$WORK/ours" "$WORK/reference"; then
+            fail "color '-l --color' with LS_COLORS=$colors differs from ls"
+            diff "$WORK/reference" "$WORK/ours" | cat -v | head -10
+        fi
+    done
+}
+
+# --client lists like a local run. Each worker gets several requests, a
+# plain one after one with other options, so the plain ones run on a
+# context that went through ftls_reset.
+check_daemon()
+{
+    "$FT_LS" --serve "$WORK/socket" &
+    server=$!
+    tries=0
+    while [ ! -S "$WORK/socket" ] && [ $tries -lt 50 ]; do
+        sleep 0.1
+        tries=$((tries + 1))
+    done
+    ( cd "$WORK/deep" && "$FT_LS" -lR ) > "$WORK/reference"
+    workers=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 4)
+    i=0
+    while [ $i -le "$workers" ]; do
+        ( cd "$WORK/deep" && "$FT_LS" --client "$WORK/socket" -lRQ --head=2 --exclude=f1 --color=always ) \
+            > /dev/null
+        ( cd "$WORK/deep" && "$FT_LS" --client "$WORK/socket" -lR ) > "$WORK/ours" \
+            || fail "deep '--client -lR' exited with $?"
+        cmp -s "$WORK/ours" "$WORK/reference" || fail "deep '--client -lR' request $i differs from -lR"
+        i=$((i + 1))
+    done
+    # A listing cut short by its deadline exits 3 through the server too.
+    ( cd "$WORK/deep" && "$FT_LS" --client "$WORK/socket" -lR --max-iops=50 --deadline=100 ) \
+        > /dev/null 2>&1
+    status=$?
+    [ $status -eq 3 ] || fail "deep '--client --deadline' exited with $status, expected 3"
+    # A terminal gets -q through the server too; script(1) provides one.
+    if command -v script > /dev/null; then
+        ( cd "$WORK/hostile" && script -qec "'$FT_LS' -l" /dev/null ) > "$WORK/reference"
+        ( cd "$WORK/hostile" && script -qec "'$FT_LS' --client '$WORK/socket' -l" /dev/null ) > "$WORK/ours"
+        cmp -s "$WORK/ours" "$WORK/reference" || fail "hostile '--client -l' on a terminal differs from -l"
+    fi
+    kill $server
+    wait $server 2> /dev/null
+}
+
+# --diff prints each kind of line once and exits 1, 0 for a tree against
+# itself and 2 when a side cannot be read.
+check_diff()
+{
+    ( cd "$WORK/diff" && "$FT_LS" --diff a b ) > "$WORK/ours"
+    status=$?
+    printf '%s\n' "- gone" "~ kind type" "~ link target" "~ mode mode" "~ size size" "~ time mtime" \
+        "+ sub/new" "- sub/old" > "$WORK/reference"
+    [ $status -eq 1 ] || fail "diff '--diff a b' exited with $status, expected 1"
+    if ! cmp -s "$WORK/ours" "$WORK/reference"; then
+        fail "diff '--diff a b' output differs"
+        diff "$WORK/reference" "$WORK/ours" | head -10
+    fi
+    ( cd "$WORK/diff" && "$FT_LS" --diff a a ) > "$WORK/ours"
+    status=$?
+    [ $status -eq 0 ] && [ ! -s "$WORK/ours" ] || fail "diff '--diff a a' exited with $status or printed lines"
+    ( cd "$WORK/diff" && "$FT_LS" --diff a missing ) > /dev/null 2>&1
+    status=$?
+    [ $status -eq 2 ] || fail "diff '--diff a missing' exited with $status, expected 2"
+}
+
+# The filters have no GNU ls counterpart: the set of names, headers
+# included, is checked against the one expected.
+check_filter()
+{
+    expected=$1
+    shift
+    ( cd "$WORK/filter" && "$FT_LS" "$@" ) | tr -s ' ' '\n' | grep -v '^$' | sort > "$WORK/ours"
+    echo $expected | tr ' ' '\n' | grep -v '^$' | sort > "$WORK/reference"
+    cmp -s "$WORK/ours" "$WORK/reference" || fail "filter '$*' lists $(echo $(cat "$WORK/ours"))"
+}
+
+check_filters()
+{
+    uid=$(id -u)
+    gid=$(id -g)
+    check_filter "a.log b.log" --include='*.log'
+    check_filter "c.txt core fifo ln src tmp" --exclude='*.log'
+    check_filter "c.txt core" --include='c*'
+    check_filter "core" --include='*or*'
+    check_filter "a.log b.log" --include='[ab].log'
+    check_filter "a.log b.log" --include-regex='^[a-c]\.' --exclude-regex='txt$'
+    check_filter "ln" --type=l
+    check_filter "fifo src tmp" --type=p,d
+    check_filter "b.log" --type=f --min-size=1K
+    check_filter "c.txt core" --type=f --max-size=0
+    check_filter "b.log" --newer=@1050000000 --older=@1150000000
+    check_filter "c.txt core" --type=f --newer=@1150000000
+    check_filter "a.log b.log c.txt core" --type=f --user="$uid"
+    check_filter "" --user=$((uid + 1))
+    check_filter "a.log b.log" --include='*.log' --group="$gid"
+    # With -R the walk still goes into directories that --include and
+    # --type leave out, to reach what matches below them, but does not
+    # list them; --exclude and --prune cut subtrees.
+    check_filter "a.log b.log ./src: ./src/deep: util.log ./tmp: junk.log" -R --include='*.log'
+    check_filter "a.log b.log c.txt core ./src: main.c ./src/deep: util.log ./tmp: junk.log" -R --type=f
+    check_filter "src tmp ./src: deep ./src/deep: ./tmp:" -R --type=d
+    # The hidden directories are walked in their place among the listed:
+    # --include='s*' lists src but not tmp.
+    for flags in -R -Rr -Rt -Rf --max-memory=1,-R --max-memory=1,-lRr; do
+        flags=$(echo "$flags" | tr ',' ' ')
+        ( cd "$WORK/filter" && "$FT_LS" $flags ) | grep ':$' > "$WORK/reference"
+        for filter in --type=f --include='s*'; do
+            ( cd "$WORK/filter" && "$FT_LS" $flags "$filter" ) | grep ':$' > "$WORK/ours"
+            cmp -s "$WORK/ours" "$WORK/reference" || fail "filter '$flags $filter' walks in another order"
+        done
+    done
+    check_filter "a.log b.log c.txt core fifo ln src tmp ./tmp: junk.log" -R --prune=src
+    check_filter "a.log b.log c.txt core fifo ln tmp ./tmp: junk.log" -R --exclude=src
+    check_filter "a.log b.log tmp ./tmp: junk.log" -R --exclude-regex='^(src|c|f|l)'
+}
+
+# A deadline that does not pass changes neither output nor exit status.
+check_deadline()
+{
+    fixture=$1
+    shift
+    ( cd "$WORK/$fixture" && "$FT_LS" "$@" ) > "$WORK/reference"
+    ( cd "$WORK/$fixture" && "$FT_LS" --deadline=600000 "$@" ) > "$WORK/ours" \
+        || fail "$fixture '--deadline $*' exited with $?"
+    cmp -s "$WORK/ours" "$WORK/reference" || fail "$fixture '--deadline $*' output differs"
+}
+
+# A budget that spills every 16 entries lists like no budget at all, in
+# columns and with -l. flat then has 21 runs, more than one merge reads,
+# so intermediate passes run.
+check_max_memory()
+{
+    fixture=$1
+    for flags in -a -r -f -l -lt -lrS -lR; do
+        ( cd "$WORK/$fixture" && "$FT_LS" $flags ) > "$WORK/reference"
+        ( cd "$WORK/$fixture" && "$FT_LS" --max-memory=1 $flags ) > "$WORK/ours"
+        cmp -s "$WORK/ours" "$WORK/reference" || fail "$fixture '--max-memory=1 $flags' differs"
+    done
+}
+
+# --head/--tail keep what -l | head and -l | tail would, with room grown
+# from the entries read: a count past the listing costs no more memory
+# than the listing. Columns are sized for the entries kept, so spaces are
+# squeezed. INT_MAX itself is refused.
+check_limits()
+{
+    ( cd "$WORK/flat" && "$FT_LS" -l ) | tr -s ' ' > "$WORK/listing"
+    for count in 1 300 1000000 2147483646; do
+        head -n $count "$WORK/listing" > "$WORK/reference"
+        ( ulimit -v 262144 && cd "$WORK/flat" && "$FT_LS" -l --head=$count ) | tr -s ' ' > "$WORK/ours"
+        cmp -s "$WORK/ours" "$WORK/reference" || fail "flat '-l --head=$count' differs from -l | head"
+        tail -n $count "$WORK/listing" > "$WORK/reference"
+        ( ulimit -v 262144 && cd "$WORK/flat" && "$FT_LS" -l --tail=$count ) | tr -s ' ' > "$WORK/ours"
+        cmp -s "$WORK/ours" "$WORK/reference" || fail "flat '-l --tail=$count' differs from -l | tail"
+    done
+    "$FT_LS" --head=2147483647 "$WORK/flat" > /dev/null 2>&1 && fail "'--head=2147483647' accepted"
+    rm -f "$WORK/listing"
+}
+
+# The scan/render pipeline of -R, forced on even on a single CPU, lists
+# like the sequential walk.
+check_pipeline()
+{
+    fixture=$1
+    for flags in -R -lR -lRrt -lRa --min-depth=2,-R; do
+        flags=$(echo "$flags" | tr ',' ' ')
+        ( cd "$WORK/$fixture" && "$FT_LS" --pipeline=never $flags ) > "$WORK/reference"
+        ( cd "$WORK/$fixture" && "$FT_LS" --pipeline=always $flags ) > "$WORK/ours"
+        cmp -s "$WORK/ours" "$WORK/reference" || fail "$fixture '$flags' pipelined output differs"
+    done
+}
+
+# A snapshot answers like the tree it was written from, without reading
+# a single directory or stat'ing a single file.
+check_snapshot()
+{
+    fixture=$1
+    ( cd "$WORK/$fixture" && "$FT_LS" --snapshot-write="$WORK/$fixture.snap" ) \
+        || fail "$fixture: --snapshot-write failed"
+    for flags in -l -la -lt -lrS -lR -R; do
+        ( cd "$WORK/$fixture" && "$FT_LS" $flags ) > "$WORK/reference"
+        ( cd "$WORK/$fixture" && "$FT_LS" --snapshot-read="$WORK/$fixture.snap" $flags ) > "$WORK/ours"
+        cmp -s "$WORK/ours" "$WORK/reference" || fail "$fixture '--snapshot-read $flags' differs"
+    done
+    ( cd "$WORK/$fixture" && FTLS_SYSCOUNT="$WORK/counts" LD_PRELOAD="$SHIM" \
+        "$FT_LS" --snapshot-read="$WORK/$fixture.snap" -lR > /dev/null )
+    while read -r call count; do
+        case $call in
+            readdir|fstatat|lstat|stat|statx|readlink|opendir|fdopendir)
+                [ "$count" -eq 0 ] || fail "$fixture '--snapshot-read -lR': $call $count > 0" ;;
+        esac
+    done < "$WORK/counts"
+    rm -f "$WORK/counts"
+}
+
+# With room for the whole tree --estimate is exact; deep is regular, so
+# every probe agrees and a small budget finds the same totals. 10 is the
+# smallest that always allows two probes: the walk reads the root and the
+# four a*, after which a probe costs two reads.
+check_estimate()
+{
+    fixture=$1
+    budget=$2
+    expected=$(cd "$WORK/$fixture" && find . -mindepth 1 ! -path '*/.*' -printf '%s %y\n' |
+        awk '{ n++; b += $1; if ($2 == "d") d++ } END { printf "%d %d %d", n, d, b }')
+    got=$(cd "$WORK/$fixture" && "$FT_LS" --estimate="$budget" . |
+        awk 'NR > 1 { printf "%s%d", (NR > 2 ? " " : ""), $2 }')
+    [ "$got" = "$expected" ] || fail "$fixture '--estimate=$budget': $got, expected $expected"
+}
+
+# Depth limits that cut nothing change nothing; those that do keep whole
+# levels of deep, which has 4, 16 and 64 directories one to three down.
+check_depth()
+{
+    ( cd "$WORK/deep" && "$FT_LS" -lR ) > "$WORK/reference"
+    ( cd "$WORK/deep" && "$FT_LS" -lRx --min-depth=0 --max-depth=3 ) > "$WORK/ours"
+    cmp -s "$WORK/ours" "$WORK/reference" || fail "deep '-lRx --max-depth=3' differs from -lR"
+    for limits in --max-depth=1:4 --min-depth=3:64 --min-depth=2,--max-depth=2:16; do
+        flags=$(echo "${limits%:*}" | tr ',' ' ')
+        blocks=$( (cd "$WORK/deep" && "$FT_LS" -R $flags) | grep -c ':$')
+        [ "$blocks" -eq "${limits#*:}" ] || fail "deep '-R $flags': $blocks directory headers, expected ${limits#*:}"
+    done
+}
+
+# Throttling changes neither the output nor, for the better, the time:
+# deep has 85 directories, 20 of which fit the burst of a 200/s bucket.
+check_throttle()
+{
+    ( cd "$WORK/deep" && "$FT_LS" -lR ) > "$WORK/reference"
+    start=$(date +%s%N)
+    ( cd "$WORK/deep" && "$FT_LS" -lR --max-dirs-per-sec=200 --max-iops=1000000 \
+        --throttle-latency=1000000 --idle-io ) > "$WORK/ours"
+    elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+    cmp -s "$WORK/ours" "$WORK/reference" || fail "deep '-lR' throttled output differs"
+    [ "$elapsed" -ge 300 ] || fail "deep '-lR --max-dirs-per-sec=200' took $elapsed ms, under 300"
+}
+
+# The --checksum column against known digests: xxh64 (seed 0) of "abc"
+# and "", crc32c of "123456789" and "". Directories are not hashed.
+check_checksum()
+{
+    for line in 'xxh64 44bc2cf5ad770999 abc' 'xxh64 ef46db3751d8e999 empty' 'xxh64 - dir' \
+                'crc32c e3069283 digits' 'crc32c 00000000 empty' 'crc32c - dir'; do
+        algorithm=${line%% *}
+        ( cd "$WORK/checksum" && "$FT_LS" -l --checksum="$algorithm" ) | awk '{ print $9, $10 }' \
+            | grep -qxe "${line#* }" || fail "checksum '-l --checksum=$algorithm': no '${line#* }'"
+    done
+}
+
+# --checksum does not read files on synthetic filesystems like procfs.
+check_fstype()
+{
+    [ -r /proc/self/status ] || return 0
+    line=$("$FT_LS" -l --checksum --include=status /proc/self)
+    case $line in
+        *" - "*" status") ;;
+        *) fail "/proc/self/status was hashed: $line" ;;
+    esac
+}
+
+# The inode-ordered stat pass keeps readdir order: -fR stats every entry
+# and -f none, yet the first directory comes out the same.
+check_prestat()
+{
+    ( cd "$WORK/flat" && "$FT_LS" -f ) > "$WORK/reference"
+    ( cd "$WORK/flat" && "$FT_LS" -fR ) | sed '/^$/,$d' > "$WORK/ours"
+    cmp -s "$WORK/ours" "$WORK/reference" || fail "flat '-fR' order differs from '-f'"
+}
+
+# -@ adds one column after the permissions and changes nothing else. In
+# it a file with an ACL gets '+', one with a user.* attribute '@', and
+# one with neither ' ', where setfacl, setfattr and the filesystem of
+# $WORK allow setting them.
+check_xattr()
+{
+    ( cd "$WORK/deep" && "$FT_LS" -lR ) > "$WORK/reference"
+    ( cd "$WORK/deep" && "$FT_LS" -lR@ ) | sed 's/^\([-dl][-rwx]\{9\}\) /\1/' > "$WORK/ours"
+    cmp -s "$WORK/ours" "$WORK/reference" || fail "deep '-lR@' differs from -lR past the mark"
+
+    mkdir -p "$WORK/xattr"
+    touch "$WORK/xattr/acl" "$WORK/xattr/attr" "$WORK/xattr/none"
+    for f in acl attr; do
+        case $f in
+            acl) command -v setfacl > /dev/null && setfacl -m u:12345:r "$WORK/xattr/acl" 2> /dev/null ;;
+            attr) command -v setfattr > /dev/null && setfattr -n user.ftls -v 1 "$WORK/xattr/attr" 2> /dev/null ;;
+        esac || continue
+        mark=$(cd "$WORK/xattr" && "$FT_LS" -l@ | grep " $f\$" | cut -c11)
+        expected=$([ $f = acl ] && echo + || echo @)
+        [ "$mark" = "$expected" ] || fail "xattr '-l@': $f marked '$mark', expected '$expected'"
+    done
+    mark=$(cd "$WORK/xattr" && "$FT_LS" -l@ | grep ' none$' | cut -c11)
+    [ "$mark" = " " ] || fail "xattr '-l@': none marked '$mark', expected ' '"
+}
+
+# --files0-from lists like the same operands on the command line, in one
+# process: the owner of all 64 directories is looked up once.
+check_files_from()
+{
+    leaves=$(cd "$WORK/deep" && echo a*/b*/c*)
+    ( cd "$WORK/deep" && "$FT_LS" -l $leaves ) > "$WORK/reference"
+    ( cd "$WORK/deep" && printf '%s\0' $leaves | FTLS_SYSCOUNT="$WORK/counts" LD_PRELOAD="$SHIM" \
+        "$FT_LS" -l --stdin ) > "$WORK/ours"
+    cmp -s "$WORK/ours" "$WORK/reference" || fail "deep '-l --stdin' differs from the operands"
+    calls=$(sed -n 's/^getpwuid //p' "$WORK/counts")
+    [ "$calls" -le 1 ] || fail "deep '-l --stdin': getpwuid $calls > 1"
+    rm -f "$WORK/counts"
+}
+
+# A -lR cut short by the file size limit and resumed from its checkpoint
+# leaves the same output as one run, and the finished run removes it.
+check_checkpoint()
+{
+    ( cd "$WORK/deep" && "$FT_LS" -lR ) > "$WORK/reference"
+    for blocks in 8 24 40; do
+        rm -f "$WORK/checkpoint"
+        ( ( cd "$WORK/deep" && ulimit -f $blocks && exec "$FT_LS" -lR --checkpoint="$WORK/checkpoint" \
+            --checkpoint-interval=0 ) > "$WORK/ours"; : ) 2> /dev/null
+        [ -f "$WORK/checkpoint" ] || fail "deep '-lR --checkpoint' cut at $blocks blocks left no checkpoint"
+        ( cd "$WORK/deep" && "$FT_LS" -lR --checkpoint="$WORK/checkpoint" --resume="$WORK/checkpoint" ) \
+            >> "$WORK/ours"
+        cmp -s "$WORK/ours" "$WORK/reference" || fail "deep '-lR --resume' after $blocks blocks differs"
+        [ ! -f "$WORK/checkpoint" ] || fail "deep '-lR --resume' left its checkpoint"
+    done
+}
+
+make_fixtures
+check_budgets
+for fixture in flat deep; do
+    check_output $fixture -l
+    check_output $fixture -la
+    check_output $fixture -lt
+    check_output $fixture -lrS
+    check_output $fixture -lR
+    check_names $fixture -f
+    check_deadline $fixture -lR
+    check_snapshot $fixture
+    check_max_memory $fixture
+    check_pipeline $fixture
+    check_estimate $fixture 1000
+done
+check_output flat -lu
+check_output flat -lrt
+check_output empty -l
+check_output deep -l a0 a1
+check_output hostile -lb
+check_output hostile -lq
+check_output hostile -lQ
+check_output hostile -lR --quoting-style=escape
+check_estimate deep 10
+check_depth
+check_limits
+check_throttle
+check_checksum
+check_fstype
+check_prestat
+check_xattr
+check_files_from
+check_checkpoint
+check_filters
+check_color
+check_wide
+check_daemon
+check_diff
+
+if [ $FAILED -ne 0 ]; then
+    echo "tests failed"
+    exit 1
+fi
+echo "all tests passed"
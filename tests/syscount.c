@@ -0,0 +1,197 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+/* LD_PRELOAD shim counting the libc calls ft_ls performance depends on.
+ * At exit the counts are written as "name count" lines to the file named
+ * by FTLS_SYSCOUNT (stderr if unset). Only the wrappers are counted, so a
+ * call glibc makes internally (getdents64 under readdir) is not. */
+
+enum
+{
+    C_OPENDIR, C_FDOPENDIR, C_READDIR, C_OPENAT, C_ACCESS, C_FSTATAT, C_LSTAT,
+    C_STAT, C_STATX, C_READLINK, C_WRITE, C_GETPWUID, C_GETGRGID, C_LISTXATTR, C_COUNT
+};
+
+static const char *g_names[C_COUNT] = {
+    "opendir", "fdopendir", "readdir", "openat", "access", "fstatat", "lstat",
+    "stat", "statx", "readlink", "write", "getpwuid", "getgrgid", "listxattr"
+};
+
+static unsigned long g_counts[C_COUNT];
+
+#define REAL(name) \
+    static __typeof__(name) *real; \
+    if (real == NULL) \
+        real = (__typeof__(name) *)dlsym(RTLD_NEXT, #name)
+
+DIR *opendir(const char *path)
+{
+    REAL(opendir);
+    __atomic_add_fetch(&g_counts[C_OPENDIR], 1, __ATOMIC_RELAXED);
+    return real(path);
+}
+
+DIR *fdopendir(int fd)
+{
+    REAL(fdopendir);
+    __atomic_add_fetch(&g_counts[C_FDOPENDIR], 1, __ATOMIC_RELAXED);
+    return real(fd);
+}
+
+struct dirent *readdir(DIR *dir)
+{
+    REAL(readdir);
+    __atomic_add_fetch(&g_counts[C_READDIR], 1, __ATOMIC_RELAXED);
+    return real(dir);
+}
+
+struct dirent64 *readdir64(DIR *dir)
+{
+    REAL(readdir64);
+    __atomic_add_fetch(&g_counts[C_READDIR], 1, __ATOMIC_RELAXED);
+    return real(dir);
+}
+
+int openat(int dirfd, const char *path, int flags, ...)
+{
+    REAL(openat);
+    __atomic_add_fetch(&g_counts[C_OPENAT], 1, __ATOMIC_RELAXED);
+    return real(dirfd, path, flags, 0);
+}
+
+int access(const char *path, int mode)
+{
+    REAL(access);
+    __atomic_add_fetch(&g_counts[C_ACCESS], 1, __ATOMIC_RELAXED);
+    return real(path, mode);
+}
+
+int faccessat(int dirfd, const char *path, int mode, int flags)
+{
+    REAL(faccessat);
+    __atomic_add_fetch(&g_counts[C_ACCESS], 1, __ATOMIC_RELAXED);
+    return real(dirfd, path, mode, flags);
+}
+
+int fstatat(int dirfd, const char *path, struct stat *st, int flags)
+{
+    REAL(fstatat);
+    __atomic_add_fetch(&g_counts[C_FSTATAT], 1, __ATOMIC_RELAXED);
+    return real(dirfd, path, st, flags);
+}
+
+int fstatat64(int dirfd, const char *path, struct stat64 *st, int flags)
+{
+    REAL(fstatat64);
+    __atomic_add_fetch(&g_counts[C_FSTATAT], 1, __ATOMIC_RELAXED);
+    return real(dirfd, path, st, flags);
+}
+
+int lstat(const char *path, struct stat *st)
+{
+    REAL(lstat);
+    __atomic_add_fetch(&g_counts[C_LSTAT], 1, __ATOMIC_RELAXED);
+    return real(path, st);
+}
+
+int stat(const char *path, struct stat *st)
+{
+    REAL(stat);
+    __atomic_add_fetch(&g_counts[C_STAT], 1, __ATOMIC_RELAXED);
+    return real(path, st);
+}
+
+int statx(int dirfd, const char *path, int flags, unsigned int mask, struct statx *st)
+{
+    REAL(statx);
+    __atomic_add_fetch(&g_counts[C_STATX], 1, __ATOMIC_RELAXED);
+    return real(dirfd, path, flags, mask, st);
+}
+
+ssize_t readlink(const char *path, char *buffer, size_t size)
+{
+    REAL(readlink);
+    __atomic_add_fetch(&g_counts[C_READLINK], 1, __ATOMIC_RELAXED);
+    return real(path, buffer, size);
+}
+
+ssize_t readlinkat(int dirfd, const char *path, char *buffer, size_t size)
+{
+    REAL(readlinkat);
+    __atomic_add_fetch(&g_counts[C_READLINK], 1, __ATOMIC_RELAXED);
+    return real(dirfd, path, buffer, size);
+}
+
+ssize_t write(int fd, const void *buffer, size_t size)
+{
+    REAL(write);
+    __atomic_add_fetch(&g_counts[C_WRITE], 1, __ATOMIC_RELAXED);
+    return real(fd, buffer, size);
+}
+
+struct passwd *getpwuid(uid_t uid)
+{
+    REAL(getpwuid);
+    __atomic_add_fetch(&g_counts[C_GETPWUID], 1, __ATOMIC_RELAXED);
+    return real(uid);
+}
+
+int getpwuid_r(uid_t uid, struct passwd *pw, char *buffer, size_t size, struct passwd **result)
+{
+    REAL(getpwuid_r);
+    __atomic_add_fetch(&g_counts[C_GETPWUID], 1, __ATOMIC_RELAXED);
+    return real(uid, pw, buffer, size, result);
+}
+
+struct group *getgrgid(gid_t gid)
+{
+    REAL(getgrgid);
+    __atomic_add_fetch(&g_counts[C_GETGRGID], 1, __ATOMIC_RELAXED);
+    return real(gid);
+}
+
+int getgrgid_r(gid_t gid, struct group *gr, char *buffer, size_t size, struct group **result)
+{
+    REAL(getgrgid_r);
+    __atomic_add_fetch(&g_counts[C_GETGRGID], 1, __ATOMIC_RELAXED);
+    return real(gid, gr, buffer, size, result);
+}
+
+/* Every extended attribute call -@ can make counts as listxattr. */
+ssize_t llistxattr(const char *path, char *list, size_t size)
+{
+    REAL(llistxattr);
+    __atomic_add_fetch(&g_counts[C_LISTXATTR], 1, __ATOMIC_RELAXED);
+    return real(path, list, size);
+}
+
+ssize_t lgetxattr(const char *path, const char *name, void *value, size_t size)
+{
+    REAL(lgetxattr);
+    __atomic_add_fetch(&g_counts[C_LISTXATTR], 1, __ATOMIC_RELAXED);
+    return real(path, name, value, size);
+}
+
+__attribute__((destructor))
+static void report_counts(void)
+{
+    const char *path = getenv("FTLS_SYSCOUNT");
+    FILE *out = path ? fopen(path, "w") : stderr;
+
+    if (out == NULL)
+        return;
+    for (int i = 0; i < C_COUNT; i++)
+        fprintf(out, "%s %lu\n", g_names[i], g_counts[i]);
+    if (out != stderr)
+        fclose(out);
+}
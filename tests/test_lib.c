@@ -0,0 +1,211 @@
+#include "libftls.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Tests of the public libftls API: the streaming iterator, options,
+ * ftls_list into a descriptor and the reuse of one context across
+ * ftls_reset. Everything runs on a small tree made in $TMPDIR. Exit
+ * status 1 on failure. */
+
+static int g_failed;
+static char g_root[64];
+
+#define CHECK(expr) do { if (!(expr)) { \
+    printf("FAIL: %s:%d: %s\n", __FILE__, __LINE__, #expr); g_failed = 1; return; } } while (0)
+
+static const char *const g_names[] = { ".hidden", "a", "b", "link", "sub" };
+
+static void make_tree(void)
+{
+    const char *tmp = getenv("TMPDIR");
+    char path[128];
+    int fd;
+
+    snprintf(g_root, sizeof(g_root), "%s/ftls_test.XXXXXX", tmp ? tmp : "/tmp");
+    if (mkdtemp(g_root) == NULL)
+    {
+        perror("mkdtemp");
+        exit(1);
+    }
+    snprintf(path, sizeof(path), "%s/a", g_root);
+    close(open(path, O_CREAT | O_WRONLY, 0644));
+    snprintf(path, sizeof(path), "%s/.hidden", g_root);
+    close(open(path, O_CREAT | O_WRONLY, 0644));
+    snprintf(path, sizeof(path), "%s/b", g_root);
+    fd = open(path, O_CREAT | O_WRONLY, 0644);
+    if (fd == -1 || write(fd, "abc", 3) != 3)
+        exit(1);
+    close(fd);
+    snprintf(path, sizeof(path), "%s/link", g_root);
+    if (symlink("a", path) == -1)
+        exit(1);
+    snprintf(path, sizeof(path), "%s/sub", g_root);
+    mkdir(path, 0755);
+}
+
+static void remove_tree(void)
+{
+    char path[128];
+
+    for (size_t i = 0; i < sizeof(g_names) / sizeof(g_names[0]); i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", g_root, g_names[i]);
+        if (unlink(path) == -1)
+            rmdir(path);
+    }
+    rmdir(g_root);
+}
+
+/* The names ftls_opendir yields for root, space separated. */
+static void iterate(ftls_ctx *ctx, char *out, size_t size)
+{
+    ftls_iter *iter = ftls_opendir(ctx, g_root);
+    ftls_entry entry;
+    size_t used = 0;
+
+    out[0] = '\0';
+    if (iter == NULL)
+        return;
+    while (ftls_next(iter, &entry))
+        used += snprintf(out + used, size - used, "%s%s", used ? " " : "", entry.name);
+    ftls_closedir(iter);
+}
+
+/* What ftls_list writes for root, read back from a temporary file. */
+static void list(ftls_ctx *ctx, char *out, size_t size)
+{
+    char path[128];
+    const char *operand = g_root;
+    ssize_t len;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s.out", g_root);
+    fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    ftls_set_output(ctx, fd, -1);
+    ftls_list(ctx, &operand, 1);
+    ftls_flush(ctx);
+    len = pread(fd, out, size - 1, 0);
+    out[len > 0 ? len : 0] = '\0';
+    close(fd);
+    unlink(path);
+}
+
+static void test_iterator(void)
+{
+    ftls_ctx *ctx = ftls_create();
+    ftls_iter *iter;
+    ftls_entry entry;
+    char names[256];
+
+    CHECK(ctx != NULL);
+    iterate(ctx, names, sizeof(names));
+    CHECK(strcmp(names, "a b link sub") == 0);
+
+    ftls_set_flags(ctx, FTLS_ALL | FTLS_REVERSE);
+    CHECK(ftls_get_flags(ctx) == (FTLS_ALL | FTLS_REVERSE));
+    iterate(ctx, names, sizeof(names));
+    CHECK(strcmp(names, "sub link b a .hidden .. .") == 0);
+
+    /* Every entry is stat'ed, links come with their target. */
+    ftls_set_flags(ctx, 0);
+    iter = ftls_opendir(ctx, g_root);
+    CHECK(iter != NULL);
+    CHECK(ftls_next(iter, &entry) && strcmp(entry.name, "a") == 0 && entry.name_len == 1);
+    CHECK(S_ISREG(entry.st->st_mode) && entry.st->st_size == 0 && entry.link_target == NULL);
+    CHECK(ftls_next(iter, &entry) && strcmp(entry.name, "b") == 0 && entry.st->st_size == 3);
+    CHECK(!entry.has_checksum && !entry.unresolved);
+    CHECK(ftls_next(iter, &entry) && S_ISLNK(entry.st->st_mode));
+    CHECK(entry.link_len == 1 && strcmp(entry.link_target, "a") == 0);
+    CHECK(ftls_next(iter, &entry) && S_ISDIR(entry.st->st_mode));
+    CHECK(!ftls_next(iter, &entry));
+    ftls_closedir(iter);
+
+    ftls_set_output(ctx, -1, -1);
+    CHECK(ftls_opendir(ctx, "/nonexistent/ftls_test") == NULL);
+    ftls_destroy(ctx);
+}
+
+static void test_options(void)
+{
+    ftls_ctx *ctx = ftls_create();
+    ftls_iter *iter;
+    ftls_entry entry;
+    char names[256];
+
+    CHECK(ftls_set_option(ctx, "include", NULL) == FTLS_EINVAL);
+    CHECK(ftls_set_option(ctx, "checkpoint", NULL) == FTLS_EINVAL);
+    CHECK(ftls_set_option(ctx, "no-such-option", NULL) == FTLS_EUNKNOWN);
+    CHECK(ftls_set_option(ctx, "no-such-option", "1") == FTLS_EUNKNOWN);
+    CHECK(ftls_set_option(ctx, "head", "x") == FTLS_EINVAL);
+    CHECK(ftls_set_option(ctx, "checksum", "md5") == FTLS_EINVAL);
+    CHECK(ftls_set_option(ctx, "pipeline", "sometimes") == FTLS_EINVAL);
+    CHECK(ftls_set_option(ctx, "pipeline", NULL) == FTLS_EINVAL);
+
+    CHECK(ftls_set_option(ctx, "include", "?") == FTLS_OK);
+    iterate(ctx, names, sizeof(names));
+    CHECK(strcmp(names, "a b") == 0);
+    CHECK(ftls_set_option(ctx, "tail", "1") == FTLS_OK);
+    iterate(ctx, names, sizeof(names));
+    CHECK(strcmp(names, "b") == 0);
+
+    /* xxh64("abc") and crc32c("abc"). */
+    CHECK(ftls_set_option(ctx, "checksum", "xxh64") == FTLS_OK);
+    iter = ftls_opendir(ctx, g_root);
+    CHECK(iter != NULL && ftls_next(iter, &entry));
+    CHECK(entry.has_checksum && entry.checksum == 0x44bc2cf5ad770999ULL);
+    ftls_closedir(iter);
+    CHECK(ftls_set_option(ctx, "checksum", "crc32c") == FTLS_OK);
+    iter = ftls_opendir(ctx, g_root);
+    CHECK(iter != NULL && ftls_next(iter, &entry));
+    CHECK(entry.has_checksum && entry.checksum == 0x364b3fb7ULL);
+    ftls_closedir(iter);
+    ftls_destroy(ctx);
+}
+
+/* A reset context lists like a fresh one, with its caches still warm. */
+static void test_reset(void)
+{
+    ftls_ctx *fresh = ftls_create();
+    ftls_ctx *ctx = ftls_create();
+    char expected[1024];
+    char output[1024];
+
+    CHECK(fresh != NULL && ctx != NULL);
+    ftls_set_flags(fresh, FTLS_LONG);
+    list(fresh, expected, sizeof(expected));
+    CHECK(strstr(expected, " link -> a\n") != NULL);
+
+    ftls_set_flags(ctx, FTLS_LONG | FTLS_ALL);
+    CHECK(ftls_set_option(ctx, "exclude", "a") == FTLS_OK);
+    CHECK(ftls_set_option(ctx, "head", "3") == FTLS_OK);
+    CHECK(ftls_set_option(ctx, "quoting-style", "c") == FTLS_OK);
+    list(ctx, output, sizeof(output));
+    CHECK(strstr(output, "\".hidden\"") != NULL && strstr(output, "\"a\"") == NULL);
+
+    for (int i = 0; i < 2; i++)
+    {
+        ftls_reset(ctx);
+        CHECK(ftls_get_flags(ctx) == 0);
+        ftls_set_flags(ctx, FTLS_LONG);
+        list(ctx, output, sizeof(output));
+        CHECK(strcmp(output, expected) == 0);
+    }
+    ftls_destroy(fresh);
+    ftls_destroy(ctx);
+}
+
+int main(void)
+{
+    make_tree();
+    test_iterator();
+    test_options();
+    test_reset();
+    remove_tree();
+    if (g_failed)
+        return 1;
+    printf("libftls tests passed\n");
+    return 0;
+}
@@ -0,0 +1,223 @@
+#include "ft_list.h"
+#include "error_codes.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Unit tests for the chunked deque and the SPMC queue in inc/ft_list.c.
+ * The deque runs a random mix of operations against a plain array model;
+ * the queue is drained by several consumers while one thread pushes, and
+ * every element must come out exactly once. Exit status 1 on failure. */
+
+#define MODEL_SIZE (1 << 16)
+#define SPMC_ITEMS 500000
+#define SPMC_CONSUMERS 4
+
+static int g_failed;
+
+#define CHECK(expr) do { if (!(expr)) { \
+    printf("FAIL: %s:%d: %s\n", __FILE__, __LINE__, #expr); g_failed = 1; return; } } while (0)
+
+/* Odd-sized, so elements never line up with the chunk size. */
+typedef struct
+{
+    unsigned int value;
+    char pad[9];
+} t_item;
+
+static void test_empty(void)
+{
+    ft_list_t list;
+    t_item item;
+
+    CHECK(ft_list_init(&list, 0) == INVALID_ARGS);
+    CHECK(ft_list_init(&list, sizeof(t_item)) == OK);
+    CHECK(ft_list_get_size(&list) == 0);
+    CHECK(ft_list_get_first(&list) == NULL);
+    CHECK(ft_list_get_last(&list) == NULL);
+    CHECK(ft_list_pop_first(&list, &item) == FAILURE);
+    CHECK(ft_list_pop_last(&list, &item) == FAILURE);
+
+    /* add_first on an empty list used to dereference NULL. */
+    item.value = 7;
+    CHECK(ft_list_add_first(&list, &item) == OK);
+    CHECK(((t_item *)ft_list_get_first(&list))->value == 7);
+    CHECK(((t_item *)ft_list_get_last(&list))->value == 7);
+    CHECK(ft_list_pop_last(&list, &item) == OK && item.value == 7);
+    CHECK(ft_list_get_size(&list) == 0);
+    ft_list_destroy(&list);
+}
+
+/* ft_list_foreach must visit exactly the model's elements, in order. */
+typedef struct
+{
+    const unsigned int *model;
+    size_t index;
+    int mismatches;
+} t_walk;
+
+static void walk_check(void *elem, void *arg)
+{
+    t_walk *walk = arg;
+
+    if (((t_item *)elem)->value != walk->model[walk->index++])
+        walk->mismatches++;
+}
+
+static void test_model(void)
+{
+    static unsigned int model[2 * MODEL_SIZE];
+    size_t model_head = MODEL_SIZE;
+    size_t model_tail = MODEL_SIZE;
+    unsigned int next = 0;
+    unsigned int seed = 42;
+    ft_list_t list;
+    t_item item;
+
+    ft_list_init(&list, sizeof(t_item));
+    for (int step = 0; step < 1000000; step++)
+    {
+        seed = seed * 1103515245 + 12345;
+        /* Drift between growing and shrinking so chunks come and go at
+         * both ends and the list empties now and then. */
+        int grow = ((seed >> 16) % 100) < ((step / 50000) % 2 ? 40 : 60);
+        int front = (seed >> 8) & 1;
+        size_t size = model_tail - model_head;
+
+        if (grow && size < MODEL_SIZE - 1 && model_head > 0 && model_tail < 2 * MODEL_SIZE)
+        {
+            item.value = next++;
+            if (front)
+            {
+                CHECK(ft_list_add_first(&list, &item) == OK);
+                model[--model_head] = item.value;
+            }
+            else
+            {
+                CHECK(ft_list_add_last(&list, &item) == OK);
+                model[model_tail++] = item.value;
+            }
+        }
+        else if (size > 0)
+        {
+            if (front)
+            {
+                CHECK(ft_list_pop_first(&list, &item) == OK);
+                CHECK(item.value == model[model_head++]);
+            }
+            else
+            {
+                CHECK(ft_list_pop_last(&list, &item) == OK);
+                CHECK(item.value == model[--model_tail]);
+            }
+        }
+        else
+        {
+            /* Recentre the model while it is empty. */
+            model_head = MODEL_SIZE;
+            model_tail = MODEL_SIZE;
+        }
+
+        CHECK(ft_list_get_size(&list) == model_tail - model_head);
+        if (model_tail > model_head)
+        {
+            CHECK(((t_item *)ft_list_get_first(&list))->value == model[model_head]);
+            CHECK(((t_item *)ft_list_get_last(&list))->value == model[model_tail - 1]);
+        }
+        if (step % 4999 == 0)
+        {
+            t_walk walk = { model + model_head, 0, 0 };
+
+            ft_list_foreach(&list, walk_check, &walk);
+            CHECK(walk.index == model_tail - model_head && walk.mismatches == 0);
+        }
+    }
+    ft_list_destroy(&list);
+}
+
+typedef struct
+{
+    ft_spmc_t *queue;
+    volatile int *done;
+    unsigned char *seen;
+    unsigned long count;
+} t_consumer;
+
+static void *consumer_main(void *arg)
+{
+    t_consumer *consumer = arg;
+    unsigned int value;
+
+    for (;;)
+    {
+        if (ft_spmc_pop(consumer->queue, &value) == OK)
+        {
+            __atomic_fetch_add(&consumer->seen[value], 1, __ATOMIC_RELAXED);
+            consumer->count++;
+        }
+        else if (__atomic_load_n(consumer->done, __ATOMIC_ACQUIRE))
+        {
+            if (ft_spmc_pop(consumer->queue, &value) != OK)
+                break;
+            __atomic_fetch_add(&consumer->seen[value], 1, __ATOMIC_RELAXED);
+            consumer->count++;
+        }
+        else
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void test_spmc(void)
+{
+    ft_spmc_t *queue = ft_spmc_create(sizeof(unsigned int), 1000);
+    unsigned char *seen = calloc(SPMC_ITEMS, 1);
+    t_consumer consumers[SPMC_CONSUMERS];
+    pthread_t threads[SPMC_CONSUMERS];
+    volatile int done = 0;
+    unsigned long total = 0;
+    unsigned int value;
+
+    CHECK(queue != NULL && seen != NULL);
+    CHECK(ft_spmc_pop(queue, &value) == FAILURE);
+
+    /* Capacity rounds up to 1024: exactly that many fit. */
+    for (value = 0; value < 1024; value++)
+        CHECK(ft_spmc_push(queue, &value) == OK);
+    CHECK(ft_spmc_push(queue, &value) == FAILURE);
+    for (unsigned int i = 0; i < 1024; i++)
+        CHECK(ft_spmc_pop(queue, &value) == OK && value == i);
+
+    for (int i = 0; i < SPMC_CONSUMERS; i++)
+    {
+        consumers[i] = (t_consumer){ queue, &done, seen, 0 };
+        pthread_create(&threads[i], NULL, consumer_main, &consumers[i]);
+    }
+    for (value = 0; value < SPMC_ITEMS; value++)
+        while (ft_spmc_push(queue, &value) != OK)
+            sched_yield();
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < SPMC_CONSUMERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        total += consumers[i].count;
+    }
+
+    CHECK(total == SPMC_ITEMS);
+    for (unsigned int i = 0; i < SPMC_ITEMS; i++)
+        CHECK(seen[i] == 1);
+    free(seen);
+    ft_spmc_destroy(queue);
+}
+
+int main(void)
+{
+    test_empty();
+    test_model();
+    test_spmc();
+    if (!g_failed)
+        printf("ft_list tests passed\n");
+    return g_failed;
+}